@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2015 Apple Inc.  All Rights Reserved.
+ * 
+ * @APPLE_LICENSE_HEADER_START@
+ * 
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ * 
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ * 
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/*
+ * rrdecode: prints a retain count trace written by 
+ * objc_dumpRetainCountTrace().
+ * 
+ *   rrdecode [-s] [-o object] file
+ * 
+ * Prints each record with its time, thread, operation, object, and 
+ * caller as image+offset, then a summary of each object's retains 
+ * and releases, largest imbalance first. 
+ * -s prints only the summary. -o prints only records for one object.
+ * Callers can be symbolicated with atos -o image -l address.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// from "objc-internal.h"
+#define OBJC_RR_TRACE_MAGIC "OBJCRRT1"
+
+enum {
+    OBJC_RR_TRACE_RETAIN = 1,
+    OBJC_RR_TRACE_RELEASE = 2,
+    OBJC_RR_TRACE_AUTORELEASE = 3,
+};
+
+typedef struct {
+    uint64_t object;
+    uint64_t caller;
+    uint64_t time;
+    uint32_t thread;
+    uint32_t op;
+} objc_rr_trace_record_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t imageCount;
+    uint32_t recordSize;
+    uint64_t recordCount;
+    uint32_t timebaseNumer;
+    uint32_t timebaseDenom;
+} objc_rr_trace_header_t;
+
+
+struct Image {
+    uint64_t address;
+    std::string path;
+    bool operator < (const Image& other) const {
+        return address < other.address;
+    }
+};
+
+struct Totals {
+    uint64_t retains;
+    uint64_t releases;
+    uint64_t autoreleases;
+    int64_t net() const { return (int64_t)retains - (int64_t)releases; }
+};
+
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: rrdecode [-s] [-o object] file\n");
+    exit(1);
+}
+
+static void fail(const char *file, const char *msg)
+{
+    fprintf(stderr, "rrdecode: %s: %s\n", file, msg);
+    exit(1);
+}
+
+static void readOrFail(FILE *f, void *buf, size_t len, const char *file)
+{
+    if (len  &&  fread(buf, len, 1, f) != 1) fail(file, "truncated trace");
+}
+
+static const char *opName(uint32_t op)
+{
+    switch (op) {
+    case OBJC_RR_TRACE_RETAIN:      return "retain";
+    case OBJC_RR_TRACE_RELEASE:     return "release";
+    case OBJC_RR_TRACE_AUTORELEASE: return "autorelease";
+    default:                        return "?";
+    }
+}
+
+// Caller as image+offset, using the nearest image at or below it.
+static std::string 
+describeCaller(const std::vector<Image>& images, uint64_t caller)
+{
+    char buf[64];
+    auto it = std::upper_bound(images.begin(), images.end(), 
+                               Image{caller, ""});
+    if (it == images.begin()) {
+        snprintf(buf, sizeof(buf), "0x%" PRIx64, caller);
+        return buf;
+    }
+    --it;
+    std::string name = it->path;
+    size_t slash = name.rfind('/');
+    if (slash != std::string::npos) name = name.substr(slash + 1);
+    snprintf(buf, sizeof(buf), "+0x%" PRIx64, caller - it->address);
+    return name + buf;
+}
+
+
+int main(int argc, char **argv)
+{
+    bool summaryOnly = false;
+    bool filter = false;
+    uint64_t filterObject = 0;
+
+    int ch;
+    while ((ch = getopt(argc, argv, "so:")) != -1) {
+        switch (ch) {
+        case 's':
+            summaryOnly = true;
+            break;
+        case 'o':
+            filter = true;
+            filterObject = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage();
+        }
+    }
+    if (optind != argc - 1) usage();
+    const char *file = argv[optind];
+
+    FILE *f = fopen(file, "rb");
+    if (!f) {
+        perror(file);
+        return 1;
+    }
+
+    objc_rr_trace_header_t header;
+    readOrFail(f, &header, sizeof(header), file);
+    if (memcmp(header.magic, OBJC_RR_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fail(file, "not a retain count trace");
+    }
+    if (header.recordSize != sizeof(objc_rr_trace_record_t)) {
+        fail(file, "unknown record size");
+    }
+    if (header.timebaseDenom == 0) fail(file, "bad timebase");
+
+    std::vector<Image> images;
+    for (uint32_t i = 0; i < header.imageCount; i++) {
+        Image image;
+        uint32_t len;
+        readOrFail(f, &image.address, sizeof(image.address), file);
+        readOrFail(f, &len, sizeof(len), file);
+        image.path.resize(len);
+        readOrFail(f, &image.path[0], len, file);
+        if (len) images.push_back(image);
+    }
+    std::sort(images.begin(), images.end());
+
+    std::map<uint64_t, Totals> totals;
+    uint64_t firstTime = 0;
+    bool haveFirstTime = false;
+    for (uint64_t i = 0; i < header.recordCount; i++) {
+        objc_rr_trace_record_t rec;
+        readOrFail(f, &rec, sizeof(rec), file);
+        if (filter  &&  rec.object != filterObject) continue;
+
+        Totals& t = totals[rec.object];
+        if (rec.op == OBJC_RR_TRACE_RETAIN) t.retains++;
+        else if (rec.op == OBJC_RR_TRACE_RELEASE) t.releases++;
+        else if (rec.op == OBJC_RR_TRACE_AUTORELEASE) t.autoreleases++;
+
+        if (summaryOnly) continue;
+        if (!haveFirstTime) {
+            firstTime = rec.time;
+            haveFirstTime = true;
+        }
+        double us = (double)(rec.time - firstTime) * 
+            header.timebaseNumer / header.timebaseDenom / 1000.0;
+        printf("%14.3f us  thread 0x%-6x %-11s 0x%016" PRIx64 "  %s\n", 
+               us, rec.thread, opName(rec.op), rec.object, 
+               describeCaller(images, rec.caller).c_str());
+    }
+    fclose(f);
+
+    std::vector<std::pair<uint64_t, Totals>> sorted(totals.begin(), 
+                                                    totals.end());
+    std::stable_sort(sorted.begin(), sorted.end(), 
+                     [](const std::pair<uint64_t, Totals>& a, 
+                        const std::pair<uint64_t, Totals>& b) {
+                         return llabs(a.second.net()) > llabs(b.second.net());
+                     });
+
+    if (!summaryOnly) printf("\n");
+    printf("%-18s  %8s  %8s  %12s  %8s\n", 
+           "object", "retains", "releases", "autoreleases", "net");
+    for (auto& entry : sorted) {
+        const Totals& t = entry.second;
+        printf("0x%016" PRIx64 "  %8" PRIu64 "  %8" PRIu64 "  %12" PRIu64 
+               "  %+8" PRId64 "\n", entry.first, 
+               t.retains, t.releases, t.autoreleases, t.net());
+    }
+
+    return 0;
+}
@@ -29,6 +29,7 @@
 #ifdef __arm64__
 	
 #include <arm/arch.h>
+#include "../objc-config.h"
 
 
 .data
@@ -262,11 +263,13 @@ LGetIsaDone:
 LNilOrTagged:
 	b.eq	LReturnZero		// nil check
 
-	// tagged
-	adrp	x10, _objc_debug_taggedpointer_classes@PAGE
-	add	x10, x10, _objc_debug_taggedpointer_classes@PAGEOFF
+	// tagged: search the tag's cache without loading the class
+	// __class_lookupMethodAndLoadCache3 translates x9 back to the class
+	adrp	x10, _objc_tag_caches@PAGE
+	add	x10, x10, _objc_tag_caches@PAGEOFF
 	ubfx	x11, x0, #60, #4
-	ldr	x9, [x10, x11, LSL #3]
+	add	x9, x10, x11, LSL #TAG_CACHE_SHIFT	// x9 = &objc_tag_caches[slot]
+	sub	x9, x9, #CLASS_CACHE_OFFSET	// x9 = pseudo-class for CacheLookup
 	b	LGetIsaDone
 
 LReturnZero:
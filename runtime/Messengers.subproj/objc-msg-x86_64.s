@@ -22,6 +22,7 @@
  */
 
 #include <TargetConditionals.h>
+#include "../objc-config.h"
 #if __x86_64__  &&  !TARGET_IPHONE_SIMULATOR
 
 /********************************************************************
@@ -530,12 +531,16 @@ LExit$0:
 // GetIsaFast return-type
 // GetIsaSupport return-type
 //
-// Sets r11 = obj->isa. Consults the tagged isa table if necessary.
+// Sets r11 = obj->isa. 
+// For tagged pointers, sets r11 to the tag's entry in objc_tag_caches 
+// minus the offset of the cache in a class. CacheLookup then searches 
+// the tagged class's cache without loading the class first. 
+// _class_lookupMethodAndLoadCache3 translates r11 back to the class.
 //
 // Takes:	$0 = NORMAL or FPRET or FP2RET or STRET
 //		a1 or a2 (STRET) = receiver
 //
-// On exit: 	r11 = receiver->isa
+// On exit: 	r11 = receiver->isa, or tagged pointer cache - CLASS_CACHE_OFFSET
 //		r10 is clobbered
 //
 /////////////////////////////////////////////////////////////////////
@@ -559,14 +564,15 @@ LGetIsaDone:
 
 .macro GetIsaSupport2
 LGetIsaSlow:
-	leaq	_objc_debug_taggedpointer_classes(%rip), %r11
+	leaq	_objc_tag_caches-CLASS_CACHE_OFFSET(%rip), %r11
 .if $0 != STRET
 	movl	%a1d, %r10d
 .else
 	movl	%a2d, %r10d
 .endif
 	andl	$$0xF, %r10d
-	movq	(%r11, %r10, 8), %r11	// read isa from table
+	shlq	$$TAG_CACHE_SHIFT, %r10	// r10 = slot * sizeof(cache_t)
+	addq	%r10, %r11		// r11 = &objc_tag_caches[slot] - CLASS_CACHE_OFFSET
 .endmacro
 	
 .macro GetIsaSupport
@@ -36,6 +36,7 @@
 #include <mach-o/nlist.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/sysctl.h>
 #include <libkern/OSAtomic.h>
 #include <Block.h>
 #include <map>
@@ -136,22 +137,251 @@ namespace {
 // don't want the table to act as a root for `leaks`.
 typedef objc::DenseMap<DisguisedPtr<objc_object>,size_t,true> RefcountMap;
 
+#if SUPPORT_NONPOINTER_ISA
+// Retain counts that overflowed a nonpointer isa's extra_rc.
+// 
+// Counts are updated atomically, so a retain whose extra_rc overflows 
+// can move half of it here without the side table lock. See 
+// objc_object::sidetable_retainOverflow(). Borrowing counts back, 
+// erasing, and resizing still require the side table lock.
+// 
+// Open addressing with linear probing. Keys are disguised like 
+// RefcountMap's. A slot is claimed with compare-and-swap and keeps its 
+// key until the table is rebuilt, so a lock-free caller can hold an 
+// entry while it updates it. Erased slots become tombstones until the 
+// next rebuild. A rebuild first sets `resizing`, then waits for 
+// lock-free callers to leave before it replaces the slot array.
+// 
+// A biased object has a raw isa and no overflowed counts. Its entry 
+// records its owner thread and the releases other threads left for 
+// the owner. See objc_object::biasedrc_addDebt_nolock().
+class RefcountOverflowTable {
+ public:
+    struct Entry {
+        uintptr_t key;      // disguised object pointer
+        size_t count;       // overflowed retain counts
+        int32_t transfers;  // lock-free overflows in progress
+        uint32_t owner;     // biased objects: owner thread's index, or 0
+        size_t debts;       // biased objects: releases left for the owner
+    };
+
+    static const size_t Pinned = ~(size_t)0;
+
+ private:
+    static const uintptr_t EmptyKey = 0;
+    static const uintptr_t TombstoneKey = ~(uintptr_t)0;  // disguised 1
+    enum { InitialCapacity = 16 };
+
+    Entry *entries;
+    uint32_t capacity;       // power of two
+    uint32_t used;           // claimed slots including tombstones
+    uint32_t tombstones;     // changed only with the side table lock
+    int32_t users;           // lock-free callers using entries
+    bool resizing;
+
+    // Disguised the same way as DisguisedPtr.
+    static uintptr_t keyFor(objc_object *obj) {
+        return -(uintptr_t)obj;
+    }
+
+    static size_t volatileLoad(size_t *p) { return *(volatile size_t *)p; }
+
+    Entry *findKey(uintptr_t key) {
+        uint32_t mask = capacity - 1;
+        uint32_t i = ptr_hash(key) & mask;
+        for (uint32_t n = 0; n < capacity; n++, i = (i+1) & mask) {
+            uintptr_t k = *(volatile uintptr_t *)&entries[i].key;
+            if (k == key) return &entries[i];
+            if (k == EmptyKey) return nil;
+        }
+        return nil;
+    }
+
+    // Returns nil if the table is too full to insert key.
+    Entry *findOrInsertKey(uintptr_t key) {
+        uint32_t mask = capacity - 1;
+        uint32_t i = ptr_hash(key) & mask;
+        for (uint32_t n = 0; n < capacity; n++, i = (i+1) & mask) {
+            uintptr_t k = *(volatile uintptr_t *)&entries[i].key;
+            if (k == key) return &entries[i];
+            if (k != EmptyKey) continue;
+
+            // Keep the table at most 3/4 full.
+            if (__sync_add_and_fetch(&used, 1) > capacity / 4 * 3) {
+                __sync_fetch_and_sub(&used, 1);
+                return nil;
+            }
+            if (__sync_bool_compare_and_swap(&entries[i].key, EmptyKey, key)) {
+                return &entries[i];
+            }
+            __sync_fetch_and_sub(&used, 1);
+            // Another thread may have inserted the same key here.
+            if (entries[i].key == key) return &entries[i];
+        }
+        return nil;
+    }
+
+    // Side table lock must be held.
+    void rebuild(uint32_t newCapacity) {
+        resizing = true;
+        __sync_synchronize();
+        while (*(volatile int32_t *)&users) sched_yield();
+
+        Entry *oldEntries = entries;
+        uint32_t oldCapacity = capacity;
+        entries = (Entry *)calloc(newCapacity, sizeof(Entry));
+        capacity = newCapacity;
+        used = 0;
+        tombstones = 0;
+        for (uint32_t i = 0; i < oldCapacity; i++) {
+            Entry& e = oldEntries[i];
+            // Entries with no count and no owner are the same as no entry.
+            if (e.key == EmptyKey  ||  e.key == TombstoneKey) continue;
+            if (e.count == 0  &&  e.owner == 0) continue;
+            *findOrInsertKey(e.key) = e;
+        }
+        free(oldEntries);
+
+        __sync_synchronize();
+        resizing = false;
+    }
+
+ public:
+    RefcountOverflowTable() 
+        : entries(nil), capacity(0), used(0), tombstones(0), 
+          users(0), resizing(false) { }
+
+    // Lock-free. Returns obj's entry, inserting it if necessary, 
+    // or nil if the caller must take the side table lock instead.
+    // Call release() when done with the entry.
+    Entry *acquire(objc_object *obj) {
+        __sync_fetch_and_add(&users, 1);
+        if (!*(volatile bool *)&resizing  &&  entries) {
+            Entry *e = findOrInsertKey(keyFor(obj));
+            if (e) return e;
+        }
+        __sync_fetch_and_sub(&users, 1);
+        return nil;
+    }
+
+    void release() {
+        __sync_fetch_and_sub(&users, 1);
+    }
+
+    // Side table lock must be held.
+    Entry *find(objc_object *obj) {
+        if (!entries) return nil;
+        return findKey(keyFor(obj));
+    }
+
+    // Side table lock must be held.
+    Entry *findOrInsert(objc_object *obj) {
+        uintptr_t key = keyFor(obj);
+        Entry *e;
+        while (!(e = entries ? findOrInsertKey(key) : nil)) {
+            // Full. Drop tombstones, and grow if still at least half full.
+            uint32_t live = used - tombstones;
+            uint32_t newCapacity = capacity;
+            if (newCapacity == 0) newCapacity = InitialCapacity;
+            else if (live >= capacity / 2) newCapacity *= 2;
+            rebuild(newCapacity);
+        }
+        return e;
+    }
+
+    // Side table lock must be held, and e must have no transfers.
+    void erase(Entry *e) {
+        e->count = 0;
+        e->owner = 0;
+        e->debts = 0;
+        e->key = TombstoneKey;
+        tombstones++;
+    }
+
+    // Side table lock must be held. 
+    // Waits for lock-free overflows of e's object to finish, 
+    // so that every count already removed from the isa is in e->count.
+    static void waitForTransfers(Entry *e) {
+        // Order the caller's earlier isa load before the transfer check.
+        __sync_synchronize();
+        while (*(volatile int32_t *)&e->transfers) sched_yield();
+        __sync_synchronize();
+    }
+
+    // Lock-free. Returns true if the count is now pinned.
+    static bool add(Entry *e, size_t delta) {
+        size_t oldCount, newCount;
+        do {
+            oldCount = volatileLoad(&e->count);
+            if (oldCount == Pinned) return true;
+            newCount = oldCount + delta;
+            if (newCount < oldCount) newCount = Pinned;
+        } while (!__sync_bool_compare_and_swap(&e->count, oldCount, newCount));
+        return newCount == Pinned;
+    }
+
+    // Side table lock must be held, so no one else subtracts.
+    // Returns the count subtracted: delta, or 0 if the count is zero.
+    static size_t sub(Entry *e, size_t delta) {
+        size_t oldCount;
+        do {
+            oldCount = volatileLoad(&e->count);
+            if (oldCount == 0) return 0;
+            if (oldCount == Pinned) return delta;
+            assert(oldCount >= delta);  // shouldn't underflow
+        } while (!__sync_bool_compare_and_swap(&e->count, oldCount, 
+                                               oldCount - delta));
+        return delta;
+    }
+};
+#endif
+
 struct SideTable {
     spinlock_t slock;
     RefcountMap refcnts;
+#if SUPPORT_NONPOINTER_ISA
+    RefcountOverflowTable overflow;
+#endif
     weak_table_t weak_table;
 
+    // Lock statistics for objc_copySideTableStatistics().
+    // Counted only when OBJC_PROFILE_SIDE_TABLES is set, and only with 
+    // slock held.
+    uint64_t lockCount;
+    uint64_t contendedCount;
+    uint64_t waitTime;  // mach_absolute_time() units
+
     SideTable() {
         memset(&weak_table, 0, sizeof(weak_table));
+        lockCount = contendedCount = waitTime = 0;
     }
 
     ~SideTable() {
         _objc_fatal("Do not delete SideTable.");
     }
 
-    void lock() { slock.lock(); }
+    ALWAYS_INLINE void lock() { 
+        if (__builtin_expect(ProfileSideTables, 0)) return lockCounted();
+        slock.lock();
+    }
     void unlock() { slock.unlock(); }
-    bool trylock() { return slock.trylock(); }
+    bool trylock() { 
+        if (!slock.trylock()) return false;
+        if (__builtin_expect(ProfileSideTables, 0)) lockCount++;
+        return true;
+    }
+
+    void lockCounted() __attribute__((noinline)) {
+        // The lock profile should blame our caller, not us.
+        void *caller = __builtin_return_address(0);
+        if (!slock.trylock(caller)) {
+            uint64_t start = mach_absolute_time();
+            slock.lockContended(caller);
+            contendedCount++;
+            waitTime += mach_absolute_time() - start;
+        }
+        lockCount++;
+    }
 
     // Address-ordered lock discipline for a pair of side tables.
 
@@ -164,7 +394,14 @@ struct SideTable {
 
 template<>
 void SideTable::lockTwo<true, true>(SideTable *lock1, SideTable *lock2) {
-    spinlock_t::lockTwo(&lock1->slock, &lock2->slock);
+    // Same order as spinlock_t::lockTwo(), but counted.
+    if (lock1 > lock2) {
+        lock1->lock();
+        lock2->lock();
+    } else {
+        lock2->lock();
+        if (lock2 != lock1) lock1->lock();
+    }
 }
 
 template<>
@@ -194,19 +431,48 @@ void SideTable::unlockTwo<false, true>(SideTable *, SideTable *lock2) {
     
 
 
+// SideTables get more stripes on machines with more CPUs, up to 
+// SideTableMaxStripeCount. OBJC_SIDE_TABLE_STRIPES overrides the count.
+#if TARGET_OS_EMBEDDED
+enum { SideTableMaxStripeCount = 64 };
+#else
+enum { SideTableMaxStripeCount = 512 };
+#endif
+
+typedef StripedMap<SideTable, SideTableMaxStripeCount> SideTableMap;
+
+static unsigned int SideTableStripeCount() {
+    unsigned long count = numericOption(SideTableStripes, 0);
+    if (count == 0) {
+        // Four stripes per CPU, but never fewer than before.
+        int ncpu = 1;
+        size_t len = sizeof(ncpu);
+        if (sysctlbyname("hw.logicalcpu_max", &ncpu, &len, nil, 0) != 0) {
+            ncpu = 1;
+        }
+        count = MAX((unsigned long)ncpu * 4, 
+                    (unsigned long)StripedMapDefaultStripeCount);
+    }
+
+    count = MIN(count, (unsigned long)SideTableMaxStripeCount);
+    unsigned int result = 1;
+    while (result < count) result *= 2;
+    return result;
+}
+
 // We cannot use a C++ static initializer to initialize SideTables because
 // libc calls us before our C++ initializers run. We also don't want a global 
 // pointer to this struct because of the extra indirection.
 // Do it the hard way.
-alignas(StripedMap<SideTable>) static uint8_t 
-    SideTableBuf[sizeof(StripedMap<SideTable>)];
+alignas(SideTableMap) static uint8_t 
+    SideTableBuf[sizeof(SideTableMap)];
 
 static void SideTableInit() {
-    new (SideTableBuf) StripedMap<SideTable>();
+    new (SideTableBuf) SideTableMap("SideTable", SideTableStripeCount());
 }
 
-static StripedMap<SideTable>& SideTables() {
-    return *reinterpret_cast<StripedMap<SideTable>*>(SideTableBuf);
+static SideTableMap& SideTables() {
+    return *reinterpret_cast<SideTableMap*>(SideTableBuf);
 }
 
 // anonymous namespace
@@ -440,12 +706,161 @@ objc_destroyWeak(id *location)
 }
 
 
+#if SUPPORT_NONPOINTER_ISA
+/***********************************************************************
+* Lock-free weak loads.
+* objc_loadWeakRetained() retains a nonpointer isa referent with a 
+* compare-and-swap on its isa instead of taking the side table lock. 
+* The referent must not be freed while the loader looks at it, so the 
+* loader first publishes it as the hazard in its weak_reader_t, then 
+* checks that the weak variable still holds it. Deallocation clears 
+* the weak variables and then waits until no reader's hazard is the 
+* object.
+* 
+* Records are never freed; a terminated thread's record is reused.
+**********************************************************************/
+struct weak_reader_t {
+    weak_reader_t *next;
+    objc_object *hazard;
+    uintptr_t sequence;  // incremented after each load
+    int32_t active;
+};
+
+static weak_reader_t * volatile weak_readers = nil;
+
+static weak_reader_t *weak_reader_self(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    weak_reader_t *rec = data->weakReader;
+    if (rec) return rec;
+
+    // Reuse a dead thread's record, or push a new one.
+    for (rec = weak_readers; rec; rec = rec->next) {
+        if (!rec->active  &&  
+            OSAtomicCompareAndSwap32Barrier(0, 1, &rec->active)) 
+        {
+            break;
+        }
+    }
+    if (!rec) {
+        rec = (weak_reader_t *)calloc(1, sizeof(weak_reader_t));
+        rec->active = 1;
+        do {
+            rec->next = weak_readers;
+        } while (!OSAtomicCompareAndSwapPtrBarrier(rec->next, rec, 
+                                          (void * volatile *)&weak_readers));
+    }
+
+    data->weakReader = rec;
+    return rec;
+}
+
+// Called by _objc_pthread_destroyspecific().
+void weak_reader_threadExit(weak_reader_t *rec)
+{
+    assert(rec->hazard == nil);
+    OSMemoryBarrier();
+    rec->active = 0;
+}
+
+// Called after obj's weak variables are cleared and before obj is freed.
+static void weak_waitForReaders(objc_object *obj)
+{
+    // Order the clearing stores before the hazard loads.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (weak_reader_t *rec = weak_readers; rec; rec = rec->next) {
+        while (__atomic_load_n(&rec->hazard, __ATOMIC_ACQUIRE) == obj) {
+            sched_yield();
+        }
+    }
+}
+
+// Like weak_waitForReaders() for many objects at once. 
+// Waits for every load in progress to finish, whether or not its 
+// hazard is one of the objects. A reader that keeps loading the same 
+// object still bumps its sequence each time, so this can't starve.
+static void weak_waitForAllReaders(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (weak_reader_t *rec = weak_readers; rec; rec = rec->next) {
+        uintptr_t sequence = __atomic_load_n(&rec->sequence, __ATOMIC_ACQUIRE);
+        if (!__atomic_load_n(&rec->hazard, __ATOMIC_ACQUIRE)) continue;
+        while (__atomic_load_n(&rec->sequence, __ATOMIC_ACQUIRE) == sequence) {
+            sched_yield();
+        }
+    }
+}
+
+// Returns false if the caller must take the side table lock instead.
+static bool weak_loadRetainedLockFree(id *location, id *result)
+{
+    objc_object *obj = (objc_object *)*location;
+    if (!obj) {
+        *result = nil;
+        return true;
+    }
+    if (obj->isTaggedPointer()) {
+        *result = (id)obj;
+        return true;
+    }
+
+    weak_reader_t *rec = weak_reader_self();
+    __atomic_store_n(&rec->hazard, obj, __ATOMIC_SEQ_CST);
+    bool handled = false;
+    // If the variable still holds obj, obj's weak variables haven't been 
+    // cleared yet, and deallocation will wait for us to finish.
+    if (__atomic_load_n((objc_object **)location, __ATOMIC_SEQ_CST) == obj) {
+        handled = obj->rootTryRetainLockFree(result);
+    }
+    __atomic_store_n(&rec->hazard, (objc_object *)nil, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->sequence, rec->sequence + 1, __ATOMIC_RELEASE);
+    return handled;
+}
+
+
+// Nonpointer isa only. Deallocating objects fail the retain as usual.
+// Raw isa (including biased objects), custom RR, and extra_rc overflow 
+// all need the side table lock.
+bool 
+objc_object::rootTryRetainLockFree(id *result)
+{
+    if (!isa.indexed  ||  ISA()->hasCustomRR()) return false;
+
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.indexed) return false;
+        if (newisa.deallocating) {
+            *result = nil;
+            return true;
+        }
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (carry) return false;
+    } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RETAIN, __builtin_return_address(0));
+    }
+    *result = (id)this;
+    return true;
+}
+#endif
+
+
 id
 objc_loadWeakRetained(id *location)
 {
     id result;
 
     SideTable *table;
+
+#if SUPPORT_NONPOINTER_ISA
+    if (weak_loadRetainedLockFree(location, &result)) return result;
+#endif
     
  retry:
     result = *location;
@@ -1057,6 +1472,8 @@ public:
 NEVER_INLINE id 
 objc_object::rootRetain_overflow(bool tryRetain)
 {
+    id result;
+    if (sidetable_retainOverflow(tryRetain, &result)) return result;
     return rootRetain(tryRetain, true);
 }
 
@@ -1079,13 +1496,28 @@ objc_object::clearDeallocating_slow()
 
     SideTable& table = SideTables()[this];
     table.lock();
-    if (isa.weakly_referenced) {
+    bool weaklyReferenced = clearDeallocating_slow_nolock(table);
+    table.unlock();
+
+    // Lock-free weak loads may still be looking at us.
+    if (weaklyReferenced) weak_waitForReaders(this);
+}
+
+// Returns true if the object was weakly referenced.
+bool
+objc_object::clearDeallocating_slow_nolock(SideTable& table)
+{
+    bool weaklyReferenced = isa.weakly_referenced;
+    if (weaklyReferenced) {
         weak_clear_no_lock(&table.weak_table, (id)this);
     }
     if (isa.has_sidetable_rc) {
-        table.refcnts.erase(this);
+        // No overflow can be in progress: the object is deallocating, 
+        // and -_tryRetain callers hold the side table lock.
+        RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+        if (entry) table.overflow.erase(entry);
     }
-    table.unlock();
+    return weaklyReferenced;
 }
 
 #endif
@@ -1132,6 +1564,11 @@ objc_object::sidetable_present()
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it != table.refcnts.end()) result = true;
 
+#if SUPPORT_NONPOINTER_ISA
+    RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+    if (entry  &&  entry->count) result = true;
+#endif
+
     if (weak_is_registered_no_lock(&table.weak_table, (id)this)) result = true;
 
     table.unlock();
@@ -1159,6 +1596,7 @@ objc_object::sidetable_unlock()
 
 // Move the entire retain count to the side table, 
 // as well as isDeallocating and weaklyReferenced.
+// Overflowed retain counts move from table.overflow to table.refcnts.
 void 
 objc_object::sidetable_moveExtraRC_nolock(size_t extra_rc, 
                                           bool isDeallocating, 
@@ -1167,6 +1605,21 @@ objc_object::sidetable_moveExtraRC_nolock(size_t extra_rc,
     assert(!isa.indexed);        // should already be changed to not-indexed
     SideTable& table = SideTables()[this];
 
+    bool pinned = false;
+    RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+    if (entry) {
+        // Overflows that started before the isa changed may still be 
+        // adding their counts. None can start after it.
+        RefcountOverflowTable::waitForTransfers(entry);
+        size_t overflow = entry->count;
+        table.overflow.erase(entry);
+
+        uintptr_t carry;
+        extra_rc = addc(extra_rc, overflow, 0, &carry);
+        if (carry  ||  overflow == RefcountOverflowTable::Pinned) pinned = true;
+    }
+    if (extra_rc > (SIDE_TABLE_RC_PINNED >> SIDE_TABLE_RC_SHIFT)) pinned = true;
+
     size_t& refcntStorage = table.refcnts[this];
     size_t oldRefcnt = refcntStorage;
     // not deallocating - that was in the isa
@@ -1175,7 +1628,7 @@ objc_object::sidetable_moveExtraRC_nolock(size_t extra_rc,
 
     uintptr_t carry;
     size_t refcnt = addc(oldRefcnt, extra_rc << SIDE_TABLE_RC_SHIFT, 0, &carry);
-    if (carry) refcnt = SIDE_TABLE_RC_PINNED;
+    if (carry  ||  pinned) refcnt = SIDE_TABLE_RC_PINNED;
     if (isDeallocating) refcnt |= SIDE_TABLE_DEALLOCATING;
     if (weaklyReferenced) refcnt |= SIDE_TABLE_WEAKLY_REFERENCED;
 
@@ -1191,26 +1644,8 @@ objc_object::sidetable_addExtraRC_nolock(size_t delta_rc)
     assert(isa.indexed);
     SideTable& table = SideTables()[this];
 
-    size_t& refcntStorage = table.refcnts[this];
-    size_t oldRefcnt = refcntStorage;
-    // isa-side bits should not be set here
-    assert((oldRefcnt & SIDE_TABLE_DEALLOCATING) == 0);
-    assert((oldRefcnt & SIDE_TABLE_WEAKLY_REFERENCED) == 0);
-
-    if (oldRefcnt & SIDE_TABLE_RC_PINNED) return true;
-
-    uintptr_t carry;
-    size_t newRefcnt = 
-        addc(oldRefcnt, delta_rc << SIDE_TABLE_RC_SHIFT, 0, &carry);
-    if (carry) {
-        refcntStorage =
-            SIDE_TABLE_RC_PINNED | (oldRefcnt & SIDE_TABLE_FLAG_MASK);
-        return true;
-    }
-    else {
-        refcntStorage = newRefcnt;
-        return false;
-    }
+    RefcountOverflowTable::Entry *entry = table.overflow.findOrInsert(this);
+    return RefcountOverflowTable::add(entry, delta_rc);
 }
 
 
@@ -1222,21 +1657,15 @@ objc_object::sidetable_subExtraRC_nolock(size_t delta_rc)
     assert(isa.indexed);
     SideTable& table = SideTables()[this];
 
-    RefcountMap::iterator it = table.refcnts.find(this);
-    if (it == table.refcnts.end()  ||  it->second == 0) {
+    RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+    if (!entry) {
         // Side table retain count is zero. Can't borrow.
         return 0;
     }
-    size_t oldRefcnt = it->second;
-
-    // isa-side bits should not be set here
-    assert((oldRefcnt & SIDE_TABLE_DEALLOCATING) == 0);
-    assert((oldRefcnt & SIDE_TABLE_WEAKLY_REFERENCED) == 0);
 
-    size_t newRefcnt = oldRefcnt - (delta_rc << SIDE_TABLE_RC_SHIFT);
-    assert(oldRefcnt > newRefcnt);  // shouldn't underflow
-    it->second = newRefcnt;
-    return delta_rc;
+    // Don't mistake an unfinished overflow for a zero count.
+    RefcountOverflowTable::waitForTransfers(entry);
+    return RefcountOverflowTable::sub(entry, delta_rc);
 }
 
 
@@ -1245,128 +1674,614 @@ objc_object::sidetable_getExtraRC_nolock()
 {
     assert(isa.indexed);
     SideTable& table = SideTables()[this];
-    RefcountMap::iterator it = table.refcnts.find(this);
-    if (it == table.refcnts.end()) return 0;
-    else return it->second >> SIDE_TABLE_RC_SHIFT;
+
+    RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+    if (!entry) return 0;
+    RefcountOverflowTable::waitForTransfers(entry);
+    size_t count = entry->count;
+    // A pinned count is too large to know. Report a saturated count 
+    // that leaves room for the inline count, so rootRetainCount() 
+    // doesn't wrap around to a small number.
+    if (count == RefcountOverflowTable::Pinned) {
+        return RefcountOverflowTable::Pinned >> 1;
+    }
+    return count;
+}
+
+
+// Slow path of rootRetain() when extra_rc overflows. Moves half of 
+// the inline retain count to the side table without the side table 
+// lock, so many threads retaining one object don't serialize on it.
+// Returns false if the caller must use the locked path instead.
+// 
+// The entry's transfer count tells sidetable_subExtraRC_nolock() that 
+// counts may be on their way from the isa. A -release that underflows 
+// waits for them instead of deciding that the object should be 
+// deallocated.
+bool 
+objc_object::sidetable_retainOverflow(bool tryRetain, id *result)
+{
+    RefcountOverflowTable& overflow = SideTables()[this].overflow;
+    RefcountOverflowTable::Entry *entry = overflow.acquire(this);
+    if (!entry) return false;
+
+    __sync_fetch_and_add(&entry->transfers, 1);
+
+    bool handled = true;
+    bool transcribeToSideTable;
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        transcribeToSideTable = false;
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.indexed) {
+            // Lost a race vs the indexed -> not indexed transition.
+            handled = false;
+            break;
+        }
+        if (tryRetain  &&  newisa.deallocating) {
+            *result = nil;
+            break;
+        }
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (carry) {
+            // Leave half of the retain counts inline and 
+            // move the other half to the side table.
+            transcribeToSideTable = true;
+            newisa.extra_rc = RC_HALF;
+            newisa.has_sidetable_rc = true;
+        }
+        // else some other thread released since the overflow
+        *result = (id)this;
+    } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+
+    if (transcribeToSideTable) {
+        RefcountOverflowTable::add(entry, RC_HALF);
+    }
+
+    __sync_fetch_and_sub(&entry->transfers, 1);
+    overflow.release();
+    return handled;
 }
 
 
-// SUPPORT_NONPOINTER_ISA
-#endif
+/***********************************************************************
+* Biased retain counts.
+* A biased object is owned by the thread that allocated it. The owner 
+* retains and releases it by updating a count in its own table, without 
+* atomic operations.
+* 
+* Biased objects get a raw isa, so the nonpointer isa layout and its 
+* fast path are unchanged. Their retains and releases reach the 
+* unindexed path of rootRetain() and rootRelease(), where the owner 
+* finds the object in its table. Other threads fall through to the 
+* side table retain count, which holds only their references. The 
+* object's RefcountOverflowTable entry records the owner's index.
+* 
+* A release by another thread that would deallocate the object can't 
+* tell whether the owner still holds references. It leaves a debt in 
+* the entry instead, and the first debt puts the object on the owner's 
+* debtor list. The owner then unbiases the object: with the side table 
+* locked, it folds its own count and the debts into the side table 
+* count and erases the entry. From then on the object is counted like 
+* any other object with a raw isa.
+* 
+* Owners look at their debtor list when they pop an autorelease pool, 
+* so that costs nothing until other threads leave debts. Owners unbias 
+* all of their objects when they exit and in _objc_handOffBiasedObjects(). 
+* An object is also unbiased when its owner releases its last reference. 
+* object_setClass() never changes a raw isa to a nonpointer one, so it 
+* leaves biased objects alone.
+* 
+* Owner records are never freed; a terminated thread's record and 
+* index are reused by a later thread.
+**********************************************************************/
 
+bool biasedrc_enabled = false;
 
-__attribute__((used,noinline,nothrow))
-id
-objc_object::sidetable_retain_slow(SideTable& table)
-{
-#if SUPPORT_NONPOINTER_ISA
-    assert(!isa.indexed);
-#endif
+struct BiasedCount {
+    objc_object *obj;
+    uintptr_t count;
+};
 
-    table.lock();
-    size_t& refcntStorage = table.refcnts[this];
-    if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
-        refcntStorage += SIDE_TABLE_RC_ONE;
-    }
-    table.unlock();
+// An object with debts, waiting for its owner to look at it.
+struct BiasedDebtor {
+    objc_object *obj;
+    BiasedDebtor *next;
+};
 
-    return (id)this;
-}
+struct BiasedOwner {
+    uint32_t index;    // stored in the overflow entries of objects we own
+    int32_t active;
+    BiasedDebtor *debtors;  // pushed by other threads, lock-free
 
+    // Only the owner thread uses these.
+    bool exiting;
+    uint32_t capacity; // power of two, or 0
+    uint32_t occupied;
+    BiasedCount *counts;
 
-id
-objc_object::sidetable_retain()
-{
-#if SUPPORT_NONPOINTER_ISA
-    assert(!isa.indexed);
-#endif
-    SideTable& table = SideTables()[this];
+    enum { InitialCapacity = 64 };
 
-    if (table.trylock()) {
-        size_t& refcntStorage = table.refcnts[this];
-        if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
-            refcntStorage += SIDE_TABLE_RC_ONE;
+    // Called with obj's side table locked.
+    void pushDebtor(objc_object *obj) {
+        BiasedDebtor *node = (BiasedDebtor *)malloc(sizeof(BiasedDebtor));
+        node->obj = obj;
+        BiasedDebtor *head;
+        do {
+            head = *(BiasedDebtor * volatile *)&debtors;
+            node->next = head;
+        } while (!__sync_bool_compare_and_swap(&debtors, head, node));
+    }
+
+    // Owner thread only. Takes the whole list at once, 
+    // so pushes and takes can't suffer ABA.
+    BiasedDebtor *takeDebtors() {
+        if (!*(BiasedDebtor * volatile *)&debtors) return nil;
+        return __sync_lock_test_and_set(&debtors, (BiasedDebtor *)nil);
+    }
+
+    BiasedCount *find(objc_object *obj) {
+        if (!counts) return nil;
+        uint32_t mask = capacity - 1;
+        for (uint32_t i = ptr_hash((uintptr_t)obj) & mask; ; i = (i+1) & mask) {
+            if (counts[i].obj == obj) return &counts[i];
+            if (!counts[i].obj) return nil;
         }
-        table.unlock();
-        return (id)this;
     }
-    return sidetable_retain_slow(table);
-}
 
+    void insert(objc_object *obj, uintptr_t count) {
+        if ((occupied + 1) * 4 > capacity * 3) {
+            grow(capacity ? capacity * 2 : InitialCapacity);
+        }
+        uint32_t mask = capacity - 1;
+        uint32_t i = ptr_hash((uintptr_t)obj) & mask;
+        while (counts[i].obj) i = (i+1) & mask;
+        counts[i].obj = obj;
+        counts[i].count = count;
+        occupied++;
+    }
+
+    // Backward-shift deletion, so lookups never see tombstones.
+    void erase(BiasedCount *c) {
+        uint32_t mask = capacity - 1;
+        uint32_t hole = (uint32_t)(c - counts);
+        for (uint32_t i = (hole+1) & mask; counts[i].obj; i = (i+1) & mask) {
+            uint32_t home = ptr_hash((uintptr_t)counts[i].obj) & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                counts[hole] = counts[i];
+                hole = i;
+            }
+        }
+        counts[hole].obj = nil;
+        counts[hole].count = 0;
+        occupied--;
+    }
+
+    void grow(uint32_t newCapacity) {
+        BiasedCount *oldCounts = counts;
+        uint32_t oldCapacity = capacity;
+        counts = (BiasedCount *)calloc(newCapacity, sizeof(BiasedCount));
+        capacity = newCapacity;
+        occupied = 0;
+        for (uint32_t i = 0; i < oldCapacity; i++) {
+            if (oldCounts[i].obj) insert(oldCounts[i].obj, oldCounts[i].count);
+        }
+        free(oldCounts);
+    }
 
-bool
-objc_object::sidetable_tryRetain()
-{
-#if SUPPORT_NONPOINTER_ISA
-    assert(!isa.indexed);
-#endif
-    SideTable& table = SideTables()[this];
+    // Returns a malloc'd list of the objects we own.
+    objc_object **copyObjects(uint32_t *outCount) {
+        objc_object **list = 
+            (objc_object **)malloc(occupied * sizeof(objc_object *));
+        uint32_t n = 0;
+        for (uint32_t i = 0; i < capacity; i++) {
+            if (counts[i].obj) list[n++] = counts[i].obj;
+        }
+        *outCount = n;
+        return list;
+    }
+};
 
-    // NO SPINLOCK HERE
-    // _objc_rootTryRetain() is called exclusively by _objc_loadWeak(), 
-    // which already acquired the lock on our behalf.
+// Index 0 means no owner.
+enum { BiasedOwnerCount = 1024 };
 
-    // fixme can't do this efficiently with os_lock_handoff_s
-    // if (table.slock == 0) {
-    //     _objc_fatal("Do not call -_tryRetain.");
-    // }
+static BiasedOwner *biasedOwners[BiasedOwnerCount];
+static mutex_t biasedOwnersLock;
 
-    bool result = true;
-    RefcountMap::iterator it = table.refcnts.find(this);
-    if (it == table.refcnts.end()) {
-        table.refcnts[this] = SIDE_TABLE_RC_ONE;
-    } else if (it->second & SIDE_TABLE_DEALLOCATING) {
-        result = false;
-    } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
-        it->second += SIDE_TABLE_RC_ONE;
-    }
-    
-    return result;
+static inline BiasedOwner *biasedrc_self(void)
+{
+    return (BiasedOwner *)tls_get_direct(BIASED_OWNER_KEY);
 }
 
+// Returns obj's count if this thread owns obj.
+static inline BiasedCount *biasedrc_ownCount(objc_object *obj)
+{
+    BiasedOwner *owner = biasedrc_self();
+    return owner ? owner->find(obj) : nil;
+}
 
-uintptr_t
-objc_object::sidetable_retainCount()
+// Returns nil if every index is in use.
+static BiasedOwner *biasedrc_register(void)
 {
-    SideTable& table = SideTables()[this];
+    mutex_locker_t lock(biasedOwnersLock);
 
-    size_t refcnt_result = 1;
-    
-    table.lock();
-    RefcountMap::iterator it = table.refcnts.find(this);
-    if (it != table.refcnts.end()) {
-        // this is valid for SIDE_TABLE_RC_PINNED too
-        refcnt_result += it->second >> SIDE_TABLE_RC_SHIFT;
+    for (uint32_t i = 1; i < BiasedOwnerCount; i++) {
+        BiasedOwner *owner = biasedOwners[i];
+        if (!owner) {
+            owner = (BiasedOwner *)calloc(1, sizeof(BiasedOwner));
+            owner->index = i;
+            biasedOwners[i] = owner;
+        }
+        else if (owner->active) {
+            continue;
+        }
+        owner->active = 1;
+        owner->exiting = false;
+        tls_set_direct(BIASED_OWNER_KEY, owner);
+        return owner;
     }
-    table.unlock();
-    return refcnt_result;
+
+    return nil;
 }
 
 
+// Called when a new instance's isa is set up. 
+// Biases the object to this thread if its class asks for it.
+// Returns true if it did so, after giving the object a raw isa.
 bool 
-objc_object::sidetable_isDeallocating()
+objc_object::biasedrc_initInstance(Class cls)
 {
-    SideTable& table = SideTables()[this];
-
-    // NO SPINLOCK HERE
-    // _objc_rootIsDeallocating() is called exclusively by _objc_storeWeak(), 
-    // which already acquired the lock on our behalf.
+    if (!BiasedRetainCounts  &&  !cls->instancesHaveBiasedRC()) return false;
+    // Overrides may not go through rootRetain(). Don't risk it.
+    if (cls->hasCustomRR()) return false;
 
+    BiasedOwner *owner = biasedrc_self();
+    if (!owner) owner = biasedrc_register();
+    if (!owner  ||  owner->exiting) return false;
 
-    // fixme can't do this efficiently with os_lock_handoff_s
-    // if (table.slock == 0) {
-    //     _objc_fatal("Do not call -_isDeallocating.");
-    // }
+    // Nobody else can see the object yet, 
+    // so its entry can be filled in without the side table lock.
+    SideTable& table = SideTables()[this];
+    RefcountOverflowTable::Entry *entry = table.overflow.acquire(this);
+    if (entry) {
+        entry->owner = owner->index;
+        entry->debts = 0;
+        table.overflow.release();
+    } else {
+        // No room without resizing.
+        table.lock();
+        entry = table.overflow.findOrInsert(this);
+        entry->owner = owner->index;
+        entry->debts = 0;
+        table.unlock();
+    }
 
-    RefcountMap::iterator it = table.refcnts.find(this);
-    return (it != table.refcnts.end()) && (it->second & SIDE_TABLE_DEALLOCATING);
+    isa.cls = cls;
+    owner->insert(this, 1);
+    return true;
 }
 
 
+// Retains without atomic operations if this thread owns the object. 
+// Returns false if it doesn't.
 bool 
-objc_object::sidetable_isWeaklyReferenced()
+objc_object::biasedrc_retainOwned()
 {
-    bool result = false;
+    BiasedCount *c = biasedrc_ownCount(this);
+    if (!c) return false;
+    c->count++;
+    return true;
+}
+
+
+// Releases without atomic operations if this thread owns the object. 
+// Returns false if it doesn't. Otherwise sets *result to whether the 
+// object should now be deallocated, and if performDealloc is set, 
+// deallocates it.
+bool 
+objc_object::biasedrc_releaseOwned(bool performDealloc, bool *result)
+{
+    BiasedOwner *owner = biasedrc_self();
+    BiasedCount *c = owner ? owner->find(this) : nil;
+    if (!c) return false;
+
+    *result = false;
+    if (--c->count > 0) return true;
+
+    // Our last reference. Other threads may still hold some.
+    *result = biasedrc_unbias(owner, c, true);
+    if (*result  &&  performDealloc) {
+        ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
+    }
+    return true;
+}
+
+
+// Owner thread only. Returns the object to the ordinary side table 
+// retain count. If !all, does nothing unless other threads left 
+// releases for us.
+// Returns true if no references remain; the caller must deallocate.
+bool 
+objc_object::biasedrc_unbias(BiasedOwner *owner, BiasedCount *c, bool all)
+{
+    SideTable& table = SideTables()[this];
+    table.lock();
+
+    RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+    if (entry  &&  entry->owner != owner->index) entry = nil;
+    if (entry  &&  !all  &&  entry->debts == 0) {
+        // Left over from an earlier unbias.
+        table.unlock();
+        return false;
+    }
+
+    size_t ownerCount = c->count;
+    owner->erase(c);
+    if (!entry) {
+        // The object was deallocated without its last release.
+        table.unlock();
+        return false;
+    }
+
+    size_t debts = entry->debts;
+    table.overflow.erase(entry);
+
+    // The side table count holds other threads' references. 
+    // Biased objects don't use its implicit extra reference.
+    bool dealloc = false;
+    size_t& refcnt = table.refcnts[this];
+    if (! (refcnt & SIDE_TABLE_RC_PINNED)) {
+        size_t rc = (refcnt >> SIDE_TABLE_RC_SHIFT) + ownerCount;
+        assert(rc >= debts);
+        rc -= debts;
+        refcnt &= SIDE_TABLE_FLAG_MASK;
+        if (rc == 0) {
+            refcnt |= SIDE_TABLE_DEALLOCATING;
+            dealloc = true;
+        } else if (rc - 1 >= (SIDE_TABLE_RC_PINNED >> SIDE_TABLE_RC_SHIFT)) {
+            refcnt |= SIDE_TABLE_RC_PINNED;
+        } else {
+            refcnt |= (rc - 1) << SIDE_TABLE_RC_SHIFT;
+        }
+    }
+
+    table.unlock();
+    return dealloc;
+}
+
+
+// Owner thread only. Unbiases our objects: all of them, 
+// or only those that other threads left releases for.
+void 
+objc_object::biasedrc_handOff(BiasedOwner *owner, bool all)
+{
+    if (all) {
+        // Deallocation may change our table, so work from a copy.
+        uint32_t count;
+        objc_object **objs = owner->copyObjects(&count);
+        for (uint32_t i = 0; i < count; i++) {
+            objc_object *obj = objs[i];
+            // Check the table first; obj may have been deallocated already.
+            BiasedCount *c = owner->find(obj);
+            if (c  &&  obj->biasedrc_unbias(owner, c, true)) {
+                ((void(*)(objc_object *, SEL))objc_msgSend)(obj, SEL_dealloc);
+            }
+        }
+        free(objs);
+    }
+
+    // A debtor may have been unbiased or deallocated since it was 
+    // listed. unbias() skips objects that have no debts.
+    BiasedDebtor *debtor = owner->takeDebtors();
+    while (debtor) {
+        BiasedDebtor *next = debtor->next;
+        objc_object *obj = debtor->obj;
+        free(debtor);
+        BiasedCount *c = owner->find(obj);
+        if (c  &&  obj->biasedrc_unbias(owner, c, false)) {
+            ((void(*)(objc_object *, SEL))objc_msgSend)(obj, SEL_dealloc);
+        }
+        debtor = next;
+    }
+}
+
+
+// Side table lock must be held. Called when a release by a thread 
+// other than the owner would deallocate this object. If the object 
+// is biased, the owner may still hold references: leave the release 
+// for the owner and return true.
+bool 
+objc_object::biasedrc_addDebt_nolock(SideTable& table)
+{
+    RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+    if (!entry  ||  !entry->owner) return false;
+
+    if (entry->debts++ == 0) biasedOwners[entry->owner]->pushDebtor(this);
+    return true;
+}
+
+
+// Side table lock must be held. rc is the side table's retain count 
+// for this object. Returns it adjusted if the object is biased. 
+// Threads other than the owner can't read the owner's count; 
+// they count it as one.
+uintptr_t 
+objc_object::biasedrc_retainCount_nolock(SideTable& table, uintptr_t rc)
+{
+    RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+    if (!entry  ||  !entry->owner) return rc;
+
+    // rc includes the implicit extra reference that biased objects 
+    // don't use.
+    BiasedCount *c = biasedrc_ownCount(this);
+    rc = rc - 1 + (c ? c->count : 1);
+    return (rc > entry->debts) ? rc - entry->debts : 1;
+}
+
+
+// Pthread destructor for BIASED_OWNER_KEY.
+static void biasedrc_threadExit(void *arg)
+{
+    BiasedOwner *owner = (BiasedOwner *)arg;
+
+    // Reinstate TLS value while we work.
+    tls_set_direct(BIASED_OWNER_KEY, owner);
+    owner->exiting = true;
+    while (owner->occupied) objc_object::biasedrc_handOff(owner, true);
+    // No object names us now, so no more debtors can arrive.
+    assert(!owner->debtors);
+
+    free(owner->counts);
+    owner->counts = nil;
+    owner->capacity = 0;
+
+    // Clear TLS value so TLS destruction doesn't loop.
+    tls_set_direct(BIASED_OWNER_KEY, nil);
+    OSMemoryBarrier();
+    owner->active = 0;
+}
+
+
+static void biasedrc_init(void)
+{
+    int r __unused = pthread_key_init_np(BIASED_OWNER_KEY, 
+                                         &biasedrc_threadExit);
+    assert(r == 0);
+    if (BiasedRetainCounts  &&  !DisableIndexedIsa) biasedrc_enabled = true;
+}
+
+
+// SUPPORT_NONPOINTER_ISA
+#endif
+
+
+// Side table retain count increment. table must be this object's 
+// side table, and must be locked.
+inline void
+objc_object::sidetable_retain_nolock(SideTable& table)
+{
+    size_t& refcntStorage = table.refcnts[this];
+    if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+        refcntStorage += SIDE_TABLE_RC_ONE;
+    }
+}
+
+
+__attribute__((used,noinline,nothrow))
+id
+objc_object::sidetable_retain_slow(SideTable& table)
+{
+#if SUPPORT_NONPOINTER_ISA
+    assert(!isa.indexed);
+#endif
+
+    table.lock();
+    sidetable_retain_nolock(table);
+    table.unlock();
+
+    return (id)this;
+}
+
+
+id
+objc_object::sidetable_retain()
+{
+#if SUPPORT_NONPOINTER_ISA
+    assert(!isa.indexed);
+#endif
+    SideTable& table = SideTables()[this];
+
+    if (table.trylock()) {
+        sidetable_retain_nolock(table);
+        table.unlock();
+        return (id)this;
+    }
+    return sidetable_retain_slow(table);
+}
+
+
+bool
+objc_object::sidetable_tryRetain()
+{
+#if SUPPORT_NONPOINTER_ISA
+    assert(!isa.indexed);
+#endif
+    SideTable& table = SideTables()[this];
+
+    // NO SPINLOCK HERE
+    // _objc_rootTryRetain() is called exclusively by _objc_loadWeak(), 
+    // which already acquired the lock on our behalf.
+
+    // fixme can't do this efficiently with os_lock_handoff_s
+    // if (table.slock == 0) {
+    //     _objc_fatal("Do not call -_tryRetain.");
+    // }
+
+    bool result = true;
+    RefcountMap::iterator it = table.refcnts.find(this);
+    if (it == table.refcnts.end()) {
+        table.refcnts[this] = SIDE_TABLE_RC_ONE;
+    } else if (it->second & SIDE_TABLE_DEALLOCATING) {
+        result = false;
+    } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
+        it->second += SIDE_TABLE_RC_ONE;
+    }
+    
+    return result;
+}
+
+
+uintptr_t
+objc_object::sidetable_retainCount()
+{
+    SideTable& table = SideTables()[this];
+
+    size_t refcnt_result = 1;
+    
+    table.lock();
+    RefcountMap::iterator it = table.refcnts.find(this);
+    if (it != table.refcnts.end()) {
+        // this is valid for SIDE_TABLE_RC_PINNED too
+        refcnt_result += it->second >> SIDE_TABLE_RC_SHIFT;
+    }
+#if SUPPORT_NONPOINTER_ISA
+    if (__builtin_expect(biasedrc_enabled, 0)) {
+        refcnt_result = biasedrc_retainCount_nolock(table, refcnt_result);
+    }
+#endif
+    table.unlock();
+    return refcnt_result;
+}
+
+
+bool 
+objc_object::sidetable_isDeallocating()
+{
+    SideTable& table = SideTables()[this];
+
+    // NO SPINLOCK HERE
+    // _objc_rootIsDeallocating() is called exclusively by _objc_storeWeak(), 
+    // which already acquired the lock on our behalf.
+
+
+    // fixme can't do this efficiently with os_lock_handoff_s
+    // if (table.slock == 0) {
+    //     _objc_fatal("Do not call -_isDeallocating.");
+    // }
+
+    RefcountMap::iterator it = table.refcnts.find(this);
+    return (it != table.refcnts.end()) && (it->second & SIDE_TABLE_DEALLOCATING);
+}
+
+
+bool 
+objc_object::sidetable_isWeaklyReferenced()
+{
+    bool result = false;
 
     SideTable& table = SideTables()[this];
     table.lock();
@@ -1395,6 +2310,35 @@ objc_object::sidetable_setWeaklyReferenced_nolock()
 }
 
 
+// Side table retain count decrement. Does not call -dealloc.
+// Returns true if the object should now be deallocated.
+// table must be this object's side table, and must be locked.
+inline bool
+objc_object::sidetable_release_nolock(SideTable& table)
+{
+    RefcountMap::iterator it = table.refcnts.find(this);
+#if SUPPORT_NONPOINTER_ISA
+    if (__builtin_expect(biasedrc_enabled, 0)  &&  
+        (it == table.refcnts.end()  ||  it->second < SIDE_TABLE_DEALLOCATING)  &&  
+        biasedrc_addDebt_nolock(table))
+    {
+        return false;
+    }
+#endif
+    if (it == table.refcnts.end()) {
+        table.refcnts[this] = SIDE_TABLE_DEALLOCATING;
+        return true;
+    } else if (it->second < SIDE_TABLE_DEALLOCATING) {
+        // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
+        it->second |= SIDE_TABLE_DEALLOCATING;
+        return true;
+    } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
+        it->second -= SIDE_TABLE_RC_ONE;
+    }
+    return false;
+}
+
+
 // rdar://20206767
 // return uintptr_t instead of bool so that the various raw-isa 
 // -release paths all return zero in eax
@@ -1408,17 +2352,7 @@ objc_object::sidetable_release_slow(SideTable& table, bool performDealloc)
     bool do_dealloc = false;
 
     table.lock();
-    RefcountMap::iterator it = table.refcnts.find(this);
-    if (it == table.refcnts.end()) {
-        do_dealloc = true;
-        table.refcnts[this] = SIDE_TABLE_DEALLOCATING;
-    } else if (it->second < SIDE_TABLE_DEALLOCATING) {
-        // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
-        do_dealloc = true;
-        it->second |= SIDE_TABLE_DEALLOCATING;
-    } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
-        it->second -= SIDE_TABLE_RC_ONE;
-    }
+    do_dealloc = sidetable_release_nolock(table);
     table.unlock();
     if (do_dealloc  &&  performDealloc) {
         ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
@@ -1441,17 +2375,7 @@ objc_object::sidetable_release(bool performDealloc)
     bool do_dealloc = false;
 
     if (table.trylock()) {
-        RefcountMap::iterator it = table.refcnts.find(this);
-        if (it == table.refcnts.end()) {
-            do_dealloc = true;
-            table.refcnts[this] = SIDE_TABLE_DEALLOCATING;
-        } else if (it->second < SIDE_TABLE_DEALLOCATING) {
-            // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
-            do_dealloc = true;
-            it->second |= SIDE_TABLE_DEALLOCATING;
-        } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
-            it->second -= SIDE_TABLE_RC_ONE;
-        }
+        do_dealloc = sidetable_release_nolock(table);
         table.unlock();
         if (do_dealloc  &&  performDealloc) {
             ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
@@ -1472,14 +2396,253 @@ objc_object::sidetable_clearDeallocating()
     // clear extra retain count and deallocating bit
     // (fixme warn or abort if extra retain count == 0 ?)
     table.lock();
+    bool weaklyReferenced = sidetable_clearDeallocating_nolock(table);
+    table.unlock();
+
+#if SUPPORT_NONPOINTER_ISA
+    // Lock-free weak loads may still be looking at us to see 
+    // that our isa is not a nonpointer isa.
+    if (weaklyReferenced) weak_waitForReaders(this);
+#else
+    (void)weaklyReferenced;
+#endif
+}
+
+// Returns true if the object was weakly referenced.
+bool 
+objc_object::sidetable_clearDeallocating_nolock(SideTable& table)
+{
+    bool weaklyReferenced = false;
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it != table.refcnts.end()) {
         if (it->second & SIDE_TABLE_WEAKLY_REFERENCED) {
+            weaklyReferenced = true;
             weak_clear_no_lock(&table.weak_table, (id)this);
         }
         table.refcnts.erase(it);
     }
-    table.unlock();
+#if SUPPORT_NONPOINTER_ISA
+    if (__builtin_expect(biasedrc_enabled, 0)) {
+        // Still biased if it was deallocated without its last release.
+        RefcountOverflowTable::Entry *entry = table.overflow.find(this);
+        if (entry  &&  entry->owner) table.overflow.erase(entry);
+    }
+#endif
+    return weaklyReferenced;
+}
+
+
+/***********************************************************************
+* Retain count tracing
+* The root retain, release, and autorelease implementations test 
+* rrtrace_enabled, which is false until the first call to 
+* _class_setTracesRetainCounts(), so untraced processes pay one 
+* predictable branch. rrtrace() then tests the class's RW_TRACE_RR bit.
+* 
+* Each thread appends records to its own ring buffer, found through 
+* _objc_pthread_data. Only the owning thread writes a buffer, so 
+* recording takes no lock and no atomic read-modify-write. Readers 
+* copy a buffer without stopping its thread and discard the records 
+* that may have been overwritten while they copied.
+* Buffers are never freed; an exited thread's buffer is reused.
+**********************************************************************/
+bool rrtrace_enabled = false;
+
+struct rrtrace_buffer_t {
+    rrtrace_buffer_t *next;
+    uint64_t head;      // records ever written; the next goes at head & mask
+    uint32_t mask;
+    uint32_t thread;
+    int32_t active;
+    objc_rr_trace_record_t records[0];
+};
+
+static rrtrace_buffer_t * volatile rrtrace_buffers = nil;
+
+static uint32_t rrtrace_bufferSize(void)
+{
+    static uint32_t size;
+    if (!size) {
+        unsigned long n = numericOption(TraceRRBuffer, 4096);
+        if (n < 16) n = 16;
+        if (n > (1UL << 24)) n = 1UL << 24;
+        size = 1U << (log2u((uint32_t)n - 1) + 1);
+    }
+    return size;
+}
+
+static rrtrace_buffer_t *rrtrace_self(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    rrtrace_buffer_t *buf = data->rrTraceBuffer;
+    if (buf) return buf;
+
+    // Reuse an exited thread's buffer, or push a new one.
+    for (buf = rrtrace_buffers; buf; buf = buf->next) {
+        if (!buf->active  &&  
+            OSAtomicCompareAndSwap32Barrier(0, 1, &buf->active)) 
+        {
+            break;
+        }
+    }
+    if (!buf) {
+        uint32_t size = rrtrace_bufferSize();
+        buf = (rrtrace_buffer_t *)
+            calloc(1, sizeof(rrtrace_buffer_t) + 
+                   size * sizeof(objc_rr_trace_record_t));
+        buf->mask = size - 1;
+        buf->active = 1;
+        do {
+            buf->next = rrtrace_buffers;
+        } while (!OSAtomicCompareAndSwapPtrBarrier(buf->next, buf, 
+                                       (void * volatile *)&rrtrace_buffers));
+    }
+
+    buf->thread = pthread_mach_thread_np(pthread_self());
+    data->rrTraceBuffer = buf;
+    return buf;
+}
+
+// Called by _objc_pthread_destroyspecific().
+void rrtrace_threadExit(rrtrace_buffer_t *buf)
+{
+    OSMemoryBarrier();
+    buf->active = 0;
+}
+
+
+NEVER_INLINE void 
+objc_object::rrtrace(uint32_t op, void *caller)
+{
+    if (isTaggedPointer()) return;
+#if __OBJC2__
+    if (!ISA()->instancesTraceRR()) return;
+#else
+    return;
+#endif
+
+    rrtrace_buffer_t *buf = rrtrace_self();
+    uint64_t head = buf->head;
+    objc_rr_trace_record_t *rec = &buf->records[head & buf->mask];
+    rec->object = (uintptr_t)this;
+    rec->caller = (uintptr_t)caller;
+    rec->time = mach_absolute_time();
+    rec->thread = buf->thread;
+    rec->op = op;
+    // Publish the record.
+    __atomic_store_n(&buf->head, head + 1, __ATOMIC_RELEASE);
+}
+
+
+// Appends buf's surviving records to result. Returns the new count.
+static size_t 
+rrtrace_copyBuffer(rrtrace_buffer_t *buf, objc_rr_trace_record_t *result, 
+                   size_t count)
+{
+    uint64_t size = (uint64_t)buf->mask + 1;
+    uint64_t end = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+    uint64_t start = end > size ? end - size : 0;
+    size_t first = count;
+    for (uint64_t i = start; i < end; i++) {
+        result[count++] = buf->records[i & buf->mask];
+    }
+
+    // The owner may have overwritten the oldest records while we copied, 
+    // and may be writing the slot of record head - size right now.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t head = __atomic_load_n(&buf->head, __ATOMIC_RELAXED);
+    if (head >= size  &&  head - size + 1 > start) {
+        uint64_t lost = head - size + 1 - start;
+        if (lost > end - start) lost = end - start;
+        memmove(&result[first], &result[first + lost], 
+                (count - first - lost) * sizeof(result[0]));
+        count -= lost;
+    }
+    return count;
+}
+
+static int compareRRTraceRecords(const void *a, const void *b)
+{
+    uint64_t ta = ((const objc_rr_trace_record_t *)a)->time;
+    uint64_t tb = ((const objc_rr_trace_record_t *)b)->time;
+    return (ta < tb) ? -1 : (ta > tb) ? 1 : 0;
+}
+
+
+objc_rr_trace_record_t *
+objc_copyRetainCountTrace(size_t *outCount)
+{
+    // Buffers are only ever pushed, so a snapshot of the list head 
+    // bounds the number of buffers we'll see.
+    rrtrace_buffer_t *list = rrtrace_buffers;
+    size_t capacity = 0;
+    for (rrtrace_buffer_t *buf = list; buf; buf = buf->next) {
+        capacity += buf->mask + 1;
+    }
+
+    objc_rr_trace_record_t *result = (objc_rr_trace_record_t *)
+        malloc((capacity ? capacity : 1) * sizeof(objc_rr_trace_record_t));
+    size_t count = 0;
+    for (rrtrace_buffer_t *buf = list; buf; buf = buf->next) {
+        count = rrtrace_copyBuffer(buf, result, count);
+    }
+
+    if (count > 1) {
+        qsort(result, count, sizeof(result[0]), &compareRRTraceRecords);
+    }
+    if (outCount) *outCount = count;
+    return result;
+}
+
+
+static bool rrtrace_write(int fd, const void *bytes, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)bytes;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0  &&  errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool
+objc_dumpRetainCountTrace(int fd)
+{
+    size_t count;
+    objc_rr_trace_record_t *records = objc_copyRetainCountTrace(&count);
+
+    mach_timebase_info_data_t tb;
+    mach_timebase_info(&tb);
+
+    // Images may be loaded while we write; the count is rechecked below.
+    uint32_t imageCount = _dyld_image_count();
+
+    objc_rr_trace_header_t header;
+    bzero(&header, sizeof(header));
+    memcpy(header.magic, OBJC_RR_TRACE_MAGIC, sizeof(header.magic));
+    header.imageCount = imageCount;
+    header.recordSize = sizeof(objc_rr_trace_record_t);
+    header.recordCount = count;
+    header.timebaseNumer = tb.numer;
+    header.timebaseDenom = tb.denom;
+
+    bool ok = rrtrace_write(fd, &header, sizeof(header));
+    for (uint32_t i = 0; ok  &&  i < imageCount; i++) {
+        // An unloaded image is written with an empty path.
+        const char *path = _dyld_get_image_name(i);
+        uint64_t address = (uintptr_t)_dyld_get_image_header(i);
+        uint32_t len = path ? (uint32_t)strlen(path) : 0;
+        ok = rrtrace_write(fd, &address, sizeof(address))  &&  
+            rrtrace_write(fd, &len, sizeof(len))  &&  
+            rrtrace_write(fd, path, len);
+    }
+    if (ok) ok = rrtrace_write(fd, records, count * sizeof(records[0]));
+
+    free(records);
+    return ok;
 }
 
 
@@ -1533,6 +2696,343 @@ id objc_autorelease(id obj) { return [obj autorelease]; }
 #endif
 
 
+/***********************************************************************
+* objc_retainBatch
+* objc_releaseBatch
+* Retain or release every object in an array, as if by objc_retain() 
+* or objc_release() on each one. nil and tagged pointers are skipped.
+* Objects with custom RR get -retain or -release. Objects with a 
+* nonpointer isa use the inline fast path. Objects whose retain count 
+* lives in the side table are sorted by side table, so each side 
+* table lock is taken once per group of objects instead of once 
+* per object.
+* objc_releaseBatch() sends -dealloc after the side table locks are 
+* released, so objects in the batch may be deallocated in any order.
+**********************************************************************/
+#if __OBJC2__
+
+// Objects are handled in chunks so the sort buffer fits on the stack.
+enum { RRBatchChunk = 128 };
+
+namespace {
+struct RRBatchEntry {
+    SideTable *table;
+    objc_object *obj;
+};
+}
+
+static int compareRRBatchEntries(const void *a, const void *b)
+{
+    uintptr_t ta = (uintptr_t)((const RRBatchEntry *)a)->table;
+    uintptr_t tb = (uintptr_t)((const RRBatchEntry *)b)->table;
+    return (ta < tb) ? -1 : (ta > tb) ? 1 : 0;
+}
+
+// Retains or releases objs that do not keep their retain count in the 
+// side table. Returns the rest in entries, sorted by side table.
+static size_t 
+gatherRRBatch(id *objs, size_t count, RRBatchEntry *entries, bool retain)
+{
+    SideTableMap& tables = SideTables();
+    size_t n = 0;
+    for (size_t i = 0; i < count; i++) {
+        id obj = objs[i];
+        if (!obj  ||  obj->isTaggedPointer()) continue;
+
+        if (obj->ISA()->hasCustomRR()) {
+            if (retain) ((id(*)(objc_object *, SEL))objc_msgSend)(obj, SEL_retain);
+            else ((void(*)(objc_object *, SEL))objc_msgSend)(obj, SEL_release);
+        }
+        else if (obj->hasIndexedIsa()) {
+            if (retain) obj->rootRetain();
+            else obj->rootRelease();
+        }
+#if SUPPORT_NONPOINTER_ISA
+        else if (__builtin_expect(biasedrc_enabled, 0)  &&  
+                 biasedrc_ownCount(obj))
+        {
+            // Biased to this thread, so no side table lock is needed.
+            if (retain) obj->rootRetain();
+            else obj->rootRelease();
+        }
+#endif
+        else {
+            entries[n].table = &tables[obj];
+            entries[n].obj = obj;
+            n++;
+        }
+    }
+
+    if (n > 1) {
+        qsort(entries, n, sizeof(entries[0]), &compareRRBatchEntries);
+    }
+    return n;
+}
+
+
+void 
+objc_object::rootRetainBatch(id *objs, size_t count)
+{
+    RRBatchEntry entries[RRBatchChunk];
+
+    while (count > 0) {
+        size_t chunk = MIN(count, (size_t)RRBatchChunk);
+        size_t n = gatherRRBatch(objs, chunk, entries, true);
+
+        for (size_t i = 0; i < n; ) {
+            SideTable *table = entries[i].table;
+            table->lock();
+            for ( ; i < n  &&  entries[i].table == table; i++) {
+                entries[i].obj->sidetable_retain_nolock(*table);
+            }
+            table->unlock();
+        }
+
+        objs += chunk;
+        count -= chunk;
+    }
+}
+
+
+void 
+objc_object::rootReleaseBatch(id *objs, size_t count)
+{
+    RRBatchEntry entries[RRBatchChunk];
+
+    while (count > 0) {
+        size_t chunk = MIN(count, (size_t)RRBatchChunk);
+        size_t n = gatherRRBatch(objs, chunk, entries, false);
+
+        // Objects to deallocate are compacted to the front of entries.
+        size_t deallocCount = 0;
+        for (size_t i = 0; i < n; ) {
+            SideTable *table = entries[i].table;
+            table->lock();
+            for ( ; i < n  &&  entries[i].table == table; i++) {
+                objc_object *obj = entries[i].obj;
+                if (obj->sidetable_release_nolock(*table)) {
+                    entries[deallocCount++].obj = obj;
+                }
+            }
+            table->unlock();
+        }
+
+        for (size_t i = 0; i < deallocCount; i++) {
+            ((void(*)(objc_object *, SEL))objc_msgSend)
+                (entries[i].obj, SEL_dealloc);
+        }
+
+        objs += chunk;
+        count -= chunk;
+    }
+}
+
+
+void 
+objc_retainBatch(id *objs, size_t count)
+{
+    objc_object::rootRetainBatch(objs, count);
+}
+
+
+void 
+objc_releaseBatch(id *objs, size_t count)
+{
+    objc_object::rootReleaseBatch(objs, count);
+}
+
+
+/***********************************************************************
+* objc_deallocBatchPush
+* objc_deallocBatchPop
+* While a thread has a dealloc batch, rootDealloc() destroys objects 
+* that need the side table but doesn't free them. Their weak variables 
+* still point at them, but weak loads see that they are deallocating 
+* and return nil, so only the side table lock per object is deferred.
+* Weakly referenced objects with custom RR are not batched: weak loads 
+* ask them, not the runtime, whether they are deallocating.
+* The batch sorts its objects by side table like objc_releaseBatch(), 
+* clears them with one lock per side table, waits once for lock-free 
+* weak loads, and frees them.
+**********************************************************************/
+#if SUPPORT_NONPOINTER_ISA
+
+enum { DeallocBatchSize = 1024 };
+
+struct DeallocBatch {
+    unsigned depth;
+    size_t count;
+    RRBatchEntry entries[DeallocBatchSize];
+};
+
+static void deallocBatchFlush(DeallocBatch *batch)
+{
+    RRBatchEntry *entries = batch->entries;
+    size_t n = batch->count;
+    if (n > 1) {
+        qsort(entries, n, sizeof(entries[0]), &compareRRBatchEntries);
+    }
+
+    bool weaklyReferenced = false;
+    for (size_t i = 0; i < n; ) {
+        SideTable *table = entries[i].table;
+        table->lock();
+        for ( ; i < n  &&  entries[i].table == table; i++) {
+            objc_object *obj = entries[i].obj;
+            if (obj->hasIndexedIsa()) {
+                weaklyReferenced |= obj->clearDeallocating_slow_nolock(*table);
+            } else {
+                weaklyReferenced |= obj->sidetable_clearDeallocating_nolock(*table);
+            }
+        }
+        table->unlock();
+    }
+
+    // Lock-free weak loads may still be looking at them.
+    if (weaklyReferenced) weak_waitForAllReaders();
+
+    for (size_t i = 0; i < n; i++) {
+        free(entries[i].obj);
+    }
+    batch->count = 0;
+}
+
+
+// Called by _objc_pthread_destroyspecific().
+void deallocBatch_threadExit(DeallocBatch *batch)
+{
+    deallocBatchFlush(batch);
+    free(batch);
+}
+
+
+// objc_destructInstance() and free(), with clearDeallocating() and 
+// free() left to the batch.
+NEVER_INLINE void 
+objc_object::rootDealloc_batched()
+{
+    DeallocBatch *batch = _objc_fetch_pthread_data(false)->deallocBatch;
+    assert(batch);
+
+    // Weak loads of objects with custom RR send -retainWeakReference, 
+    // which must not reach an object that has already been destroyed. 
+    // Those objects can't leave their weak variables set for the batch.
+    if (ISA()->hasCustomRR()  &&  (!hasIndexedIsa()  ||  isa.weakly_referenced)) {
+        object_dispose((id)this);
+        return;
+    }
+
+    // This order is important.
+    if (hasCxxDtor()) object_cxxDestruct((id)this);
+    if (hasAssociatedObjects()) _object_remove_assocations((id)this);
+
+    if (!hasIndexedIsa()  ||  isa.weakly_referenced  ||  isa.has_sidetable_rc) 
+    {
+        // C++ destructors may have deallocated other objects into 
+        // the batch and filled it.
+        if (batch->count == DeallocBatchSize) deallocBatchFlush(batch);
+        batch->entries[batch->count].table = &SideTables()[this];
+        batch->entries[batch->count].obj = this;
+        batch->count++;
+    } 
+    else {
+        // Only C++ destructors or associated objects. No lock needed.
+        free(this);
+    }
+}
+
+#endif
+
+
+void *
+objc_deallocBatchPush(void)
+{
+    void *pool = objc_autoreleasePoolPush();
+#if SUPPORT_NONPOINTER_ISA
+    if (!UseGC) {
+        _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+        DeallocBatch *batch = data->deallocBatch;
+        if (!batch) {
+            batch = (DeallocBatch *)calloc(1, sizeof(DeallocBatch));
+            data->deallocBatch = batch;
+        }
+        batch->depth++;
+    }
+#endif
+    return pool;
+}
+
+
+void 
+objc_deallocBatchPop(void *ctxt)
+{
+    objc_autoreleasePoolPop(ctxt);
+#if SUPPORT_NONPOINTER_ISA
+    if (!UseGC) {
+        _objc_pthread_data *data = _objc_fetch_pthread_data(false);
+        DeallocBatch *batch = data ? data->deallocBatch : nil;
+        if (!batch  ||  batch->depth == 0) {
+            _objc_fatal("objc_deallocBatchPop() without "
+                        "objc_deallocBatchPush()");
+        }
+        if (--batch->depth == 0) {
+            // Objects deallocated from here on are freed immediately.
+            data->deallocBatch = nil;
+            deallocBatchFlush(batch);
+            free(batch);
+        }
+    }
+#endif
+}
+
+
+// OBJC2
+#else
+// not OBJC2
+
+
+void 
+objc_retainBatch(id *objs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) objc_retain(objs[i]);
+}
+
+
+void 
+objc_releaseBatch(id *objs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) objc_release(objs[i]);
+}
+
+
+void *
+objc_deallocBatchPush(void)
+{
+    return objc_autoreleasePoolPush();
+}
+
+
+void 
+objc_deallocBatchPop(void *ctxt)
+{
+    objc_autoreleasePoolPop(ctxt);
+}
+
+
+#endif
+
+
+void 
+_objc_handOffBiasedObjects(void)
+{
+#if SUPPORT_NONPOINTER_ISA
+    if (BiasedOwner *owner = biasedrc_self()) {
+        objc_object::biasedrc_handOff(owner, true);
+    }
+#endif
+}
+
+
 /***********************************************************************
 * Basic operations for root class implementations a.k.a. _objc_root*()
 **********************************************************************/
@@ -1758,6 +3258,17 @@ objc_autoreleasePoolPop(void *ctxt)
 {
     if (UseGC) return;
     AutoreleasePoolPage::pop(ctxt);
+#if __OBJC2__
+    cache_quiescent();
+#endif
+#if SUPPORT_NONPOINTER_ISA
+    if (__builtin_expect(biasedrc_enabled, 0)) {
+        // Apply releases other threads left for our biased objects.
+        if (BiasedOwner *owner = biasedrc_self()) {
+            objc_object::biasedrc_handOff(owner, false);
+        }
+    }
+#endif
 }
 
 
@@ -1866,10 +3377,46 @@ id objc_unretainedObject(objc_objectptr_t pointer) { return (id)pointer; }
 objc_objectptr_t objc_unretainedPointer(id object) { return object; }
 
 
+/***********************************************************************
+* objc_copySideTableStatistics
+* Returns lock statistics for each side table stripe, in stripe order.
+* The statistics are all zero unless OBJC_PROFILE_SIDE_TABLES is set.
+* The caller must free() the result.
+* Locking: acquires each side table lock in turn, without counting it
+**********************************************************************/
+objc_side_table_stats_t *
+objc_copySideTableStatistics(unsigned int *outCount)
+{
+    SideTableMap& tables = SideTables();
+    unsigned int count = tables.stripeCount();
+    objc_side_table_stats_t *result = (objc_side_table_stats_t *)
+        calloc(count, sizeof(objc_side_table_stats_t));
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+
+    for (unsigned int i = 0; i < count; i++) {
+        SideTable& table = tables.stripeAtIndex(i);
+        table.slock.lock();
+        result[i].acquisitions = table.lockCount;
+        result[i].contended = table.contendedCount;
+        result[i].waitNanoseconds = 
+            table.waitTime * timebase.numer / timebase.denom;
+        table.slock.unlock();
+    }
+
+    if (outCount) *outCount = count;
+    return result;
+}
+
+
 void arr_init(void) 
 {
     AutoreleasePoolPage::init();
     SideTableInit();
+#if SUPPORT_NONPOINTER_ISA
+    biasedrc_init();
+#endif
 }
 
 @implementation NSObject
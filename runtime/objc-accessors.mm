@@ -41,7 +41,7 @@
 - (id)mutableCopyWithZone:(void *)zone;
 @end
 
-static StripedMap<spinlock_t> PropertyLocks;
+static StripedMap<spinlock_t> PropertyLocks("PropertyLocks");
 
 #define MUTABLE_COPY 2
 
@@ -166,7 +166,7 @@ objc_setProperty(id self, SEL _cmd, ptrdiff_t offset, id newValue,
 // if simultaneously used for a setter then there would be contention on src.
 // So we need two locks - one of which will be contended.
 void objc_copyStruct(void *dest, const void *src, ptrdiff_t size, BOOL atomic, BOOL hasStrong) {
-    static StripedMap<spinlock_t> StructLocks;
+    static StripedMap<spinlock_t> StructLocks("StructLocks");
     spinlock_t *srcLock = nil;
     spinlock_t *dstLock = nil;
     if (atomic) {
@@ -188,7 +188,7 @@ void objc_copyStruct(void *dest, const void *src, ptrdiff_t size, BOOL atomic, B
 }
 
 void objc_copyCppObjectAtomic(void *dest, const void *src, void (*copyHelper) (void *dest, const void *source)) {
-    static StripedMap<spinlock_t> CppObjectLocks;
+    static StripedMap<spinlock_t> CppObjectLocks("CppObjectLocks");
     spinlock_t *srcLock = &CppObjectLocks[src];
     spinlock_t *dstLock = &CppObjectLocks[dest];
     spinlock_t::lockTwo(srcLock, dstLock);
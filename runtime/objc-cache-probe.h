@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2015 Apple Inc.  All Rights Reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/***********************************************************************
+* objc-cache-probe.h
+* Method cache bucket probing for the C code in objc-cache.mm.
+* objc_msgSend has its own probe loop in assembly.
+*
+* The buckets are an array of {key, imp} pairs, and mask+1 is a power
+* of two. cache_probe() visits at most count buckets in probe order
+* starting at index i, and returns the index of the first bucket whose
+* key is key or 0, or CACHE_PROBE_NONE. The probe order ascends on
+* most architectures and descends on arm64, just like objc_msgSend's.
+*
+* The bucket layout is fixed by objc_msgSend, so the keys are not
+* contiguous. Instead the vector versions test the four buckets of
+* one 64-byte group at once, gathering the keys from their pairs.
+* Groups start at multiples of four buckets so they never straddle
+* the wrap-around. The scalar loop handles the partial group where the
+* probe starts and any leftover buckets. Loads are unaligned because
+* _objc_empty_cache is only 8-byte aligned.
+*
+* This file has no runtime dependencies so the tests can include it.
+**********************************************************************/
+
+#ifndef _OBJC_CACHE_PROBE_H
+#define _OBJC_CACHE_PROBE_H
+
+#include <stdint.h>
+
+#if __x86_64__
+#   include <emmintrin.h>
+#   define CACHE_PROBE_SSE2 1
+#elif __arm64__  &&  __LP64__
+#   include <arm_neon.h>
+#   define CACHE_PROBE_NEON 1
+#endif
+
+#define CACHE_PROBE_NONE ((uint32_t)~0)
+
+// Same layout as bucket_t.
+typedef struct {
+    uintptr_t key;
+    uintptr_t imp;
+} cache_probe_bucket_t;
+
+
+static inline uint32_t
+cache_probe_next(uint32_t i, uint32_t mask)
+{
+#if __arm64__
+    return i ? i-1 : mask;
+#else
+    return (i+1) & mask;
+#endif
+}
+
+
+static inline uint32_t
+cache_probe_scalar(const cache_probe_bucket_t *b, uint32_t mask,
+                   uintptr_t key, uint32_t i, uint32_t count)
+{
+    for ( ; count > 0; count--) {
+        uintptr_t k = b[i].key;
+        if (k == key  ||  k == 0) return i;
+        i = cache_probe_next(i, mask);
+    }
+    return CACHE_PROBE_NONE;
+}
+
+
+#if CACHE_PROBE_SSE2
+
+// Returns a 2-bit mask of the 64-bit lanes of keys that are key or 0.
+// SSE2 has no 64-bit compare, so both 32-bit halves must match.
+static inline int
+cache_probe_match2(__m128i keys, __m128i key, __m128i zero)
+{
+    __m128i eq = _mm_cmpeq_epi32(keys, key);
+    eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2,3,0,1)));
+    __m128i z = _mm_cmpeq_epi32(keys, zero);
+    z = _mm_and_si128(z, _mm_shuffle_epi32(z, _MM_SHUFFLE(2,3,0,1)));
+    return _mm_movemask_pd(_mm_castsi128_pd(_mm_or_si128(eq, z)));
+}
+
+static inline uint32_t
+cache_probe(const cache_probe_bucket_t *b, uint32_t mask,
+            uintptr_t key, uint32_t i, uint32_t count)
+{
+    if (mask < 3) return cache_probe_scalar(b, mask, key, i, count);
+
+    // Finish the partial group.
+    for ( ; count > 0  &&  (i & 3) != 0; count--) {
+        uintptr_t k = b[i].key;
+        if (k == key  ||  k == 0) return i;
+        i = (i+1) & mask;
+    }
+
+    const __m128i vkey = _mm_set1_epi64x((long long)key);
+    const __m128i zero = _mm_setzero_si128();
+    for ( ; count >= 4; count -= 4) {
+        const __m128i *p = (const __m128i *)&b[i];
+        __m128i keys01 = _mm_unpacklo_epi64(_mm_loadu_si128(p+0),
+                                            _mm_loadu_si128(p+1));
+        __m128i keys23 = _mm_unpacklo_epi64(_mm_loadu_si128(p+2),
+                                            _mm_loadu_si128(p+3));
+        int hits = cache_probe_match2(keys01, vkey, zero) |
+            (cache_probe_match2(keys23, vkey, zero) << 2);
+        if (hits) return i + __builtin_ctz(hits);
+        i = (i+4) & mask;
+    }
+
+    return cache_probe_scalar(b, mask, key, i, count);
+}
+
+#elif CACHE_PROBE_NEON
+
+static inline uint32_t
+cache_probe(const cache_probe_bucket_t *b, uint32_t mask,
+            uintptr_t key, uint32_t i, uint32_t count)
+{
+    if (mask < 3) return cache_probe_scalar(b, mask, key, i, count);
+
+    // Finish the partial group. The probe descends,
+    // so a group is entered at its last bucket.
+    for ( ; count > 0  &&  (i & 3) != 3; count--) {
+        uintptr_t k = b[i].key;
+        if (k == key  ||  k == 0) return i;
+        i = i ? i-1 : mask;
+    }
+
+    const uint64x2_t vkey = vdupq_n_u64(key);
+    const uint64x2_t zero = vdupq_n_u64(0);
+    for ( ; count >= 4; count -= 4) {
+        uint32_t base = i - 3;
+        // vld2q_u64 deinterleaves the pairs: val[0] holds the keys.
+        uint64x2_t keys01 = vld2q_u64((const uint64_t *)&b[base+0]).val[0];
+        uint64x2_t keys23 = vld2q_u64((const uint64_t *)&b[base+2]).val[0];
+        uint64x2_t hits01 = vorrq_u64(vceqq_u64(keys01, vkey),
+                                      vceqq_u64(keys01, zero));
+        uint64x2_t hits23 = vorrq_u64(vceqq_u64(keys23, vkey),
+                                      vceqq_u64(keys23, zero));
+        uint32x4_t hits = vcombine_u32(vmovn_u64(hits01), vmovn_u64(hits23));
+        if (vmaxvq_u32(hits)) {
+            // The highest matching index comes first in probe order.
+            uint32_t lanes[4];
+            vst1q_u32(lanes, hits);
+            for (uint32_t j = 3; ; j--) {
+                if (lanes[j]) return base + j;
+            }
+        }
+        i = base ? base-1 : mask;
+    }
+
+    return cache_probe_scalar(b, mask, key, i, count);
+}
+
+#else
+
+static inline uint32_t
+cache_probe(const cache_probe_bucket_t *b, uint32_t mask,
+            uintptr_t key, uint32_t i, uint32_t count)
+{
+    return cache_probe_scalar(b, mask, key, i, count);
+}
+
+#endif
+
+#endif
@@ -10,12 +10,28 @@ extern IMP cache_getImp(Class cls, SEL sel);
 
 extern void cache_fill(Class cls, SEL sel, IMP imp, id receiver);
 
+extern void cache_reserve(Class cls, uint32_t count);
+
 extern void cache_erase_nolock(Class cls);
 
 extern void cache_delete(Class cls);
 
+extern bool cache_negativeContains(Class cls, SEL sel);
+
+extern void cache_negativeAdd(Class cls, SEL sel);
+
 extern void cache_collect(bool collectALot);
 
+extern void cache_getStatistics(Class cls, objc_class_cache_stats_t *stats);
+
+extern void cache_getTotals(objc_cache_totals_t *totals);
+
+#if SUPPORT_TAGGED_POINTERS
+extern void cache_setTaggedClass(unsigned slot, Class cls);
+
+extern Class cache_classForLookup(Class cls, id obj);
+#endif
+
 __END_DECLS
 
 #endif
@@ -46,31 +46,63 @@
  * The memory is now only accessible to instances of objc_msgSend that 
  * were running when the memory was disconnected; any further calls to 
  * objc_msgSend will not see the garbage memory because the other data 
- * structures don't point to it anymore. The collecting_in_critical
- * function checks the PC of all threads and returns FALSE when all threads 
- * are found to be outside objc_msgSend. This means any call to objc_msgSend 
- * that could have had access to the garbage has finished or moved past the 
- * cache lookup stage, so it is safe to free the memory.
+ * structures don't point to it anymore. 
  *
- * All functions that modify cache data or structures must acquire the 
+ * Garbage is tagged with the cache epoch in which it was disconnected. 
+ * Each thread publishes the current epoch in its cache_reader_t at 
+ * quiescent points, where it is known not to be scanning any cache: 
+ * the message send slow path and autorelease pool pop. Once every 
+ * thread has published an epoch at least as new as the garbage's tag, 
+ * any call to objc_msgSend that could have had access to the garbage 
+ * has finished or moved past the cache lookup stage, so it is safe to 
+ * free the memory. Threads that have not reached a quiescent point 
+ * recently are "lagging"; when too much garbage piles up, the PCs of 
+ * the lagging threads (and only those threads) are checked instead.
+ *
+ * Functions that replace a cache's buckets must acquire the 
  * cacheUpdateLock to prevent interference from concurrent modifications.
  * The function that frees cache garbage must acquire the cacheUpdateLock 
- * and use collecting_in_critical() to flush out cache readers.
+ * and wait for cache readers to pass a newer epoch.
  * The cacheUpdateLock is also used to protect the custom allocator used 
  * for large method cache blocks.
  *
- * Cache readers (PC-checked by collecting_in_critical())
+ * Adding an entry to a cache that already has room for it does not 
+ * acquire the cacheUpdateLock. Instead the writer enters the class's 
+ * cache_fill_gate_t, claims an empty bucket with compare-and-swap on 
+ * its imp, and then publishes the bucket's key. A thread that replaces 
+ * the buckets closes the gate and waits for writers inside it to leave 
+ * before the old buckets are disconnected. Writers for different classes 
+ * therefore never wait for each other.
+ *
+ * A cache may shrink, which the old collector never allowed while any 
+ * objc_msgSend could still hold a pointer to its buckets. A reader loads 
+ * the mask and the buckets separately, so it may pair a stale mask with 
+ * newer buckets. Shrinking stays safe because such a pair never reaches 
+ * past the end of the buckets:
+ * - cache_erase_nolock() shrinks only the mask. The buckets it installs 
+ *   are a constant empty array of the old, larger capacity.
+ * - reallocate() allocates fewer buckets than that only once every 
+ *   cache reader has announced the epoch of the shrink, or has been 
+ *   PC-checked outside the cache-reading code. No reader can then 
+ *   still hold the larger mask.
+ * - The buckets that were replaced go on the garbage list like any 
+ *   other, and are freed by epoch.
+ *
+ * Cache readers (epoch-tracked; PC-checked when lagging)
  * objc_msgSend*
  * cache_getImp
  *
- * Cache writers (hold cacheUpdateLock while reading or writing; not PC-checked)
- * cache_fill         (acquires lock)
- * cache_expand       (only called from cache_fill)
- * cache_create       (only called from cache_expand)
- * bcopy               (only called from instrumented cache_expand)
- * flush_caches        (acquires lock)
- * cache_flush        (only called from cache_fill and flush_caches)
- * cache_collect_free (only called from cache_expand and cache_flush)
+ * Cache writers (not PC-checked)
+ * cache_fill         (lock-free if possible, else acquires lock)
+ * cache_t::insert    (lock-free; called with or without lock)
+ * cache_t::expand    (only called from cache_fill; holds lock)
+ * cache_t::reallocate (called from cache_fill and cache_reserve; holds lock)
+ * cache_reserve      (acquires lock)
+ * flushCaches        (acquires lock)
+ * cache_erase_nolock (only called from flushCaches; holds lock)
+ * cache_t::shrinkMask (only called from erase; holds lock)
+ * cache_collect_free (only called from reallocate and erase; holds lock)
+ * cache_negativeAdd  (lock-free; runtimeLock read-locked)
  *
  * UNPROTECTED cache readers (NOT thread-safe; used for debug info only)
  * cache_print
@@ -85,6 +117,8 @@
 
 #include "objc-private.h"
 #include "objc-cache.h"
+#include "objc-cache-probe.h"
+#include <pthread/introspection.h>
 
 
 /* Initial cache bucket count. INIT_CACHE_SIZE must be a power of two. */
@@ -94,8 +128,27 @@ enum {
 };
 
 static void cache_collect_free(struct bucket_t *data, mask_t capacity);
+#if DEBUG_TASK_THREADS
 static int _collecting_in_critical(void);
+#endif
 static void _garbage_make_room(void);
+static uintptr_t cache_advanceEpoch(void);
+static uintptr_t cache_reader_min_epoch(bool checkLagging);
+static struct cache_thread_stats_t *cache_threadStats(void);
+
+
+/***********************************************************************
+* Cache statistics for objc_copyCacheStatistics()
+* Always on. Per-class counts live in the class's cache_policy_t. 
+* Process-wide counts are kept per thread, so threads never contend 
+* on them, and are added up when read.
+**********************************************************************/
+struct cache_thread_stats_t {
+    uint64_t misses;
+    uint64_t fills;
+    uint64_t lockfreeFills;
+    uint64_t reallocations;
+};
 
 
 /***********************************************************************
@@ -104,6 +157,7 @@ static void _garbage_make_room(void);
 static unsigned int cache_counts[16];
 static size_t cache_allocations;
 static size_t cache_collections;
+static size_t cache_shrunk_bytes;
 
 static void recordNewCache(mask_t capacity)
 {
@@ -122,6 +176,19 @@ static void recordDeadCache(mask_t capacity)
     }
 }
 
+/***********************************************************************
+* Adaptive cache size policy
+* A cache that is still sparse when it is flushed 
+* cache_shrink_flushes times in a row is shrunk.
+* A cache grows before it is 3/4 full if it is at least half full and 
+* its entries are on average more than cache_grow_probes buckets 
+* away from their hash position.
+* Set by OBJC_CACHE_SHRINK_FLUSHES and OBJC_CACHE_GROW_PROBES.
+**********************************************************************/
+static uint32_t cache_shrink_flushes = 3;
+static uint32_t cache_grow_probes = 2;
+
+
 /***********************************************************************
 * Pointers used by compiled class objects
 * These use asm to avoid conflicts with the compiler's internal declarations
@@ -159,6 +226,9 @@ asm("\n .section __TEXT,__const"
 static inline mask_t cache_next(mask_t i, mask_t mask) {
     return (i+1) & mask;
 }
+static inline mask_t cache_distance(mask_t begin, mask_t i, mask_t mask) {
+    return (i - begin) & mask;
+}
 
 #elif __arm64__
 // objc_msgSend has lots of registers available.
@@ -167,11 +237,90 @@ static inline mask_t cache_next(mask_t i, mask_t mask) {
 static inline mask_t cache_next(mask_t i, mask_t mask) {
     return i ? i-1 : mask;
 }
+static inline mask_t cache_distance(mask_t begin, mask_t i, mask_t mask) {
+    return (begin - i) & mask;
+}
 
 #else
 #error unknown architecture
 #endif
 
+// cache_probe() reads bucket_t as cache_probe_bucket_t.
+STATIC_ASSERT(sizeof(bucket_t) == sizeof(cache_probe_bucket_t));
+STATIC_ASSERT(offsetof(cache_probe_bucket_t, key) == 0);
+
+
+#if SUPPORT_TAGGED_POINTERS
+/***********************************************************************
+* Tagged pointer method caches.
+* objc_msgSend used to find a tagged pointer's class in objc_tag_classes 
+* and then load the class's cache: two dependent loads before the probe.
+* objc_tag_caches mirrors the cache of each registered tagged pointer 
+* class, indexed by the same slot. The x86_64 and arm64 objc_msgSend 
+* compute the mirror's address from the tag bits and load its 
+* buckets and mask directly.
+*
+* A mirror shares its class's buckets, so entries added to one appear 
+* in both. cache_updateTagged() copies the buckets and mask whenever the 
+* class's change, in the same order and before the old buckets become 
+* garbage. Only objc_msgSend reads the mirrors, and the garbage 
+* collector already waits for objc_msgSend.
+*
+* On a cache miss objc_msgSend passes the mirror's address minus 
+* offsetof(objc_class, cache) as the class to search. 
+* cache_classForLookup() translates it back.
+**********************************************************************/
+extern "C" {
+    __attribute__((visibility("hidden"))) cache_t objc_tag_caches[TAG_COUNT*2];
+}
+
+// objc_msgSend computes a mirror's address and pseudo-class with these.
+STATIC_ASSERT(sizeof(cache_t) == 1 << TAG_CACHE_SHIFT);
+STATIC_ASSERT(offsetof(objc_class, cache) == CLASS_CACHE_OFFSET);
+
+static void cache_copyToTagged(cache_t *mirror, Class cls)
+{
+    // No class is registered for this slot.
+    if (!cls) return;
+
+    mirror->setBucketsAndMask(cls->cache.buckets(), cls->cache.mask());
+}
+
+// Call after changing cls's buckets or mask, before freeing the old buckets.
+static void cache_updateTagged(Class cls)
+{
+    cacheUpdateLock.assertLocked();
+
+    for (unsigned slot = 0; slot < TAG_COUNT*2; slot++) {
+        if (objc_tag_classes[slot] == cls) {
+            cache_copyToTagged(&objc_tag_caches[slot], cls);
+        }
+    }
+}
+
+void cache_setTaggedClass(unsigned slot, Class cls)
+{
+    mutex_locker_t lock(cacheUpdateLock);
+    cache_copyToTagged(&objc_tag_caches[slot], cls);
+}
+
+Class cache_classForLookup(Class cls, id obj)
+{
+    uintptr_t cache = (uintptr_t)cls + offsetof(objc_class, cache);
+    if (cache >= (uintptr_t)&objc_tag_caches[0]  &&  
+        cache < (uintptr_t)&objc_tag_caches[TAG_COUNT*2]) 
+    {
+        return obj->getIsa();
+    }
+    return cls;
+}
+
+#else
+
+static inline void cache_updateTagged(Class cls __unused) { }
+
+#endif
+
 
 #if SUPPORT_IGNORED_SELECTOR_CONSTANT
 #error sorry not implemented
@@ -283,6 +432,18 @@ void bucket_t::set(cache_key_t newKey, IMP newImp)
 
 #endif
 
+// Reserve an empty bucket for a concurrent cache writer.
+// An empty bucket has key 0 and imp 0. The winning writer stores its 
+// imp first, which objc_msgSend ignores until the key is set, 
+// and then calls set() to publish the key.
+// Returns false if some other writer already claimed this bucket.
+bool bucket_t::claim(IMP newImp)
+{
+    assert(newImp);
+    return OSAtomicCompareAndSwapPtrBarrier(nil, (void *)newImp, 
+                                            (void * volatile *)&_imp);
+}
+
 void cache_t::setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask)
 {
     // objc_msgSend uses mask and buckets with no locks.
@@ -305,6 +466,23 @@ void cache_t::setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask)
 }
 
 
+// Reduce the mask of an empty cache whose buckets are a constant empty 
+// array at least as large as the old mask requires.
+// objc_msgSend may still read the old mask with the new buckets later, 
+// so the buckets must not be replaced with a smaller array until every 
+// thread has passed a newer cache epoch. See cache_erase_nolock().
+void cache_t::shrinkMask(mask_t newMask)
+{
+    assert(newMask < _mask);
+    assert(_occupied == 0);
+
+    // ensure other threads see the empty buckets before the new mask
+    mega_barrier();
+
+    _mask = newMask;
+}
+
+
 struct bucket_t *cache_t::buckets() 
 {
     return _buckets; 
@@ -320,9 +498,23 @@ mask_t cache_t::occupied()
     return _occupied;
 }
 
-void cache_t::incrementOccupied() 
+// Atomically count one more occupied bucket, 
+// unless that would make the cache more than limit full.
+bool cache_t::reserveOccupied(mask_t limit) 
+{
+    mask_t oldOccupied, newOccupied;
+    do {
+        oldOccupied = _occupied;
+        newOccupied = oldOccupied + 1;
+        if (newOccupied > limit) return false;
+    } while (!__sync_bool_compare_and_swap(&_occupied, 
+                                           oldOccupied, newOccupied));
+    return true;
+}
+
+void cache_t::unreserveOccupied() 
 {
-    _occupied++;
+    __sync_fetch_and_sub(&_occupied, 1);
 }
 
 void cache_t::initializeToEmpty()
@@ -395,6 +587,10 @@ bucket_t *allocateBuckets(mask_t newCapacity)
 #endif
 
 
+// Shared empty buckets for caches too big for _objc_empty_cache.
+static bucket_t **emptyBucketsList = nil;
+static mask_t emptyBucketsListCount = 0;
+
 bucket_t *emptyBucketsForCapacity(mask_t capacity, bool allocate = true)
 {
     cacheUpdateLock.assertLocked();
@@ -407,9 +603,6 @@ bucket_t *emptyBucketsForCapacity(mask_t capacity, bool allocate = true)
     }
 
     // Use shared empty buckets allocated on the heap.
-    static bucket_t **emptyBucketsList = nil;
-    static mask_t emptyBucketsListCount = 0;
-    
     mask_t index = log2u(capacity);
 
     if (index >= emptyBucketsListCount) {
@@ -436,11 +629,23 @@ bucket_t *emptyBucketsForCapacity(mask_t capacity, bool allocate = true)
 }
 
 
+static bool isConstantEmptyBuckets(bucket_t *b)
+{
+    cacheUpdateLock.assertLocked();
+
+    if (b == (bucket_t *)&_objc_empty_cache) return true;
+    for (mask_t i = 0; i < emptyBucketsListCount; i++) {
+        if (b == emptyBucketsList[i]) return true;
+    }
+    return false;
+}
+
+// A shrunk cache's empty buckets may be larger than its capacity.
 bool cache_t::isConstantEmptyCache()
 {
     return 
         occupied() == 0  &&  
-        buckets() == emptyBucketsForCapacity(capacity(), false);
+        isConstantEmptyBuckets(buckets());
 }
 
 bool cache_t::canBeFreed()
@@ -449,12 +654,13 @@ bool cache_t::canBeFreed()
 }
 
 
-void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity)
+void cache_t::reallocate(Class cls, mask_t oldCapacity, mask_t newCapacity)
 {
+    cacheUpdateLock.assertLocked();
+
     bool freeOld = canBeFreed();
 
     bucket_t *oldBuckets = buckets();
-    bucket_t *newBuckets = allocateBuckets(newCapacity);
 
     // Cache's old contents are not propagated. 
     // This is thought to save cache memory at the cost of extra cache fills.
@@ -463,7 +669,45 @@ void cache_t::reallocate(mask_t oldCapacity, mask_t newCapacity)
     assert(newCapacity > 0);
     assert((uintptr_t)(mask_t)(newCapacity-1) == newCapacity-1);
 
+    cache_policy_t& policy = cls->data()->cachePolicy;
+    if (policy.shrunkFrom) {
+        // cache_erase_nolock() shrank the mask. objc_msgSend calls that 
+        // started before then may still use the old mask with the new 
+        // buckets. Don't allocate fewer buckets until they are all gone.
+        // Idle threads never announce a new epoch, so check their PCs.
+        if (newCapacity < policy.shrunkFrom) {
+            if (cache_reader_min_epoch(true) < policy.shrinkEpoch) {
+                newCapacity = policy.shrunkFrom;
+            } else {
+                size_t saved = bytesForCapacity(policy.shrunkFrom) - 
+                    bytesForCapacity(newCapacity);
+                cache_shrunk_bytes += saved;
+                if (PrintCaches) {
+                    _objc_inform("CACHES: shrank %s%s cache from %u to %u "
+                                 "buckets, saving %zu bytes (%zu total)", 
+                                 cls->isMetaClass() ? "+" : "", 
+                                 cls->nameForLogging(), 
+                                 policy.shrunkFrom, (unsigned)newCapacity, 
+                                 saved, cache_shrunk_bytes);
+                }
+            }
+        }
+        policy.shrunkFrom = 0;
+    }
+    policy.reallocations++;
+    cache_threadStats()->reallocations++;
+
+    bucket_t *newBuckets = allocateBuckets(newCapacity);
+
+    // Wait for lock-free writers to stop using the old buckets.
+    // With the gate closed, nobody else updates the policy counts.
+    cache_fill_gate_t& gate = cls->data()->cacheGate;
+    gate.beginReplace();
     setBucketsAndMask(newBuckets, newCapacity - 1);
+    policy.probes = 0;
+    policy.inserts = 0;
+    cache_updateTagged(cls);
+    gate.endReplace();
     
     if (freeOld) {
         cache_collect_free(oldBuckets, oldCapacity);
@@ -504,13 +748,11 @@ bucket_t * cache_t::find(cache_key_t k, id receiver)
 
     bucket_t *b = buckets();
     mask_t m = mask();
-    mask_t begin = cache_hash(k, m);
-    mask_t i = begin;
-    do {
-        if (b[i].key() == 0  ||  b[i].key() == k) {
-            return &b[i];
-        }
-    } while ((i = cache_next(i, m)) != begin);
+    uint32_t i = cache_probe((const cache_probe_bucket_t *)b, m, 
+                             k, cache_hash(k, m), (uint32_t)m + 1);
+    if (i != CACHE_PROBE_NONE) {
+        return &b[i];
+    }
 
     // hack
     Class cls = (Class)((uintptr_t)this - offsetof(objc_class, cache));
@@ -518,7 +760,7 @@ bucket_t * cache_t::find(cache_key_t k, id receiver)
 }
 
 
-void cache_t::expand()
+void cache_t::expand(Class cls)
 {
     cacheUpdateLock.assertLocked();
     
@@ -531,7 +773,74 @@ void cache_t::expand()
         newCapacity = oldCapacity;
     }
 
-    reallocate(oldCapacity, newCapacity);
+    reallocate(cls, oldCapacity, newCapacity);
+}
+
+
+// Add key/imp to this cache if it is less than 3/4 full.
+// Returns false if the cache is too full. 
+// The caller must either be inside the class's cacheGate 
+// or hold cacheUpdateLock, so the buckets can't be replaced underneath us.
+// The cache must not be a constant empty cache.
+// Other writers may be inserting concurrently.
+bool cache_t::insert(Class cls, cache_key_t key, IMP imp, id receiver)
+{
+    assert(key != 0);
+
+    // Read the mask first, just like objc_msgSend.
+    mask_t m = mask();
+    bucket_t *b = buckets();
+    mask_t capacity = m + 1;
+
+    // Count our bucket before claiming it. The 3/4 limit then holds 
+    // no matter how many writers race, so there is always an empty 
+    // bucket to terminate objc_msgSend's scan.
+    if (!reserveOccupied(capacity / 4 * 3)) return false;
+
+    // Scan for the first unclaimed slot and insert there.
+    // If another writer claims it first, resume the scan after it.
+    mask_t begin = cache_hash(key, m);
+    mask_t i = begin;
+    uint32_t remaining = (uint32_t)m + 1;
+    while (remaining > 0) {
+        uint32_t found = cache_probe((const cache_probe_bucket_t *)b, m, 
+                                     key, i, remaining);
+        if (found == CACHE_PROBE_NONE) break;
+
+        cache_key_t k = b[found].key();
+        if (k == key) {
+            // Some other writer added the same entry first.
+            unreserveOccupied();
+            return true;
+        }
+        if (k == 0  &&  b[found].claim(imp)) {
+            b[found].set(key, imp);
+            cache_policy_t& policy = cls->data()->cachePolicy;
+            OSAtomicAdd32(cache_distance(begin, found, m), 
+                          (volatile int32_t *)&policy.probes);
+            OSAtomicIncrement32((volatile int32_t *)&policy.inserts);
+            return true;
+        }
+
+        remaining -= cache_distance(i, found, m) + 1;
+        i = cache_next(found, m);
+    }
+
+    cache_t::bad_cache(receiver, (SEL)key, cls);
+}
+
+
+// Returns true if cls's cache should grow before it is 3/4 full, 
+// because its entries collide too much.
+static bool cache_wantsEarlyExpand(Class cls, cache_t *cache)
+{
+    if (!cache_grow_probes) return false;
+
+    cache_policy_t& policy = cls->data()->cachePolicy;
+    return 
+        policy.inserts >= INIT_CACHE_SIZE  &&  
+        cache->occupied() * 2 >= cache->capacity()  &&  
+        policy.probes > cache_grow_probes * policy.inserts;
 }
 
 
@@ -549,34 +858,64 @@ static void cache_fill_nolock(Class cls, SEL sel, IMP imp, id receiver)
     cache_t *cache = getCache(cls);
     cache_key_t key = getKey(sel);
 
-    // Use the cache as-is if it is less than 3/4 full
-    mask_t newOccupied = cache->occupied() + 1;
-    mask_t capacity = cache->capacity();
     if (cache->isConstantEmptyCache()) {
         // Cache is read-only. Replace it.
-        cache->reallocate(capacity, capacity ?: INIT_CACHE_SIZE);
+        mask_t capacity = cache->capacity();
+        cache->reallocate(cls, capacity, capacity ?: INIT_CACHE_SIZE);
     }
-    else if (newOccupied <= capacity / 4 * 3) {
-        // Cache is less than 3/4 full. Use it as-is.
+    else if (cache_wantsEarlyExpand(cls, cache)) {
+        // Probe sequences are long. Grow before the cache is 3/4 full.
+        cache->expand(cls);
     }
-    else {
-        // Cache is too full. Expand it.
-        cache->expand();
+
+    // Insert, expanding the cache if it is too full.
+    // Lock-free writers may fill the cache between our attempts.
+    while (!cache->insert(cls, key, imp, receiver)) {
+        cache->expand(cls);
+    }
+}
+
+
+// Try to add to cls's cache without taking cacheUpdateLock.
+// Returns false if the cache must be replaced first.
+static bool cache_fill_lockfree(Class cls, SEL sel, IMP imp, id receiver)
+{
+    cache_fill_gate_t& gate = cls->data()->cacheGate;
+    if (!gate.tryEnter()) return false;
+
+    cache_t *cache = getCache(cls);
+    bool done;
+    if (cache->occupied() == 0) {
+        // Cache may be a constant empty cache, which is read-only.
+        // Caches with any occupied buckets never are.
+        done = false;
+    } else if (cache_wantsEarlyExpand(cls, cache)) {
+        // Let cache_fill_nolock() expand it.
+        done = false;
+    } else {
+        done = cache->insert(cls, getKey(sel), imp, receiver);
     }
 
-    // Scan for the first unused slot and insert there.
-    // There is guaranteed to be an empty slot because the 
-    // minimum size is 4 and we resized at 3/4 full.
-    bucket_t *bucket = cache->find(key, receiver);
-    if (bucket->key() == 0) cache->incrementOccupied();
-    bucket->set(key, imp);
+    gate.leave();
+    return done;
 }
 
+
 void cache_fill(Class cls, SEL sel, IMP imp, id receiver)
 {
 #if !DEBUG_TASK_THREADS
+    // Never cache before +initialize is done
+    if (!cls->isInitialized()) return;
+
+    cache_thread_stats_t *stats = cache_threadStats();
+    if (cache_fill_lockfree(cls, sel, imp, receiver)) {
+        stats->lockfreeFills++;
+        return;
+    }
+
     mutex_locker_t lock(cacheUpdateLock);
     cache_fill_nolock(cls, sel, imp, receiver);
+    stats->fills++;
 #else
     _collecting_in_critical();
     return;
@@ -584,19 +923,270 @@ void cache_fill(Class cls, SEL sel, IMP imp, id receiver)
 }
 
 
+// Make room for count more entries in cls's cache in one allocation, 
+// so that filling them causes no intermediate expansions.
+// Does nothing if the cache already has room or cls is not +initialized.
+void cache_reserve(Class cls, uint32_t count)
+{
+    mutex_locker_t lock(cacheUpdateLock);
+
+    // Never cache before +initialize is done
+    if (!cls->isInitialized()) return;
+
+    cache_t *cache = getCache(cls);
+    uint32_t oldCapacity = cache->capacity();
+    uint32_t needed = cache->occupied() + count;
+
+    uint32_t newCapacity = oldCapacity ? oldCapacity : INIT_CACHE_SIZE;
+    while (newCapacity / 4 * 3 < needed  &&  
+           (uint32_t)(mask_t)(newCapacity*2) == newCapacity*2)
+    {
+        newCapacity *= 2;
+    }
+
+    if (newCapacity == oldCapacity  &&  !cache->isConstantEmptyCache()) {
+        // Already big enough.
+        return;
+    }
+
+    cache->reallocate(cls, oldCapacity, newCapacity);
+}
+
+
+// Returns the capacity cls's cache should have after it is erased.
+// A cache that is sparse at several flushes in a row is shrunk 
+// to about half full.
+static mask_t cache_erasedCapacity(Class cls, mask_t capacity, 
+                                   mask_t occupied)
+{
+    cache_policy_t& policy = cls->data()->cachePolicy;
+
+    if (!cache_shrink_flushes  ||  capacity <= INIT_CACHE_SIZE) {
+        return capacity;
+    }
+
+    // Sparse means less than 1/4 full.
+    if (occupied * 4 >= capacity) {
+        policy.sparseFlushes = 0;
+        return capacity;
+    }
+    if (++policy.sparseFlushes < cache_shrink_flushes) {
+        return capacity;
+    }
+
+    policy.sparseFlushes = 0;
+    mask_t newCapacity = capacity;
+    while (newCapacity/2 >= INIT_CACHE_SIZE  &&  occupied*2 <= newCapacity/2) {
+        newCapacity /= 2;
+    }
+    return newCapacity;
+}
+
+
+/***********************************************************************
+* Negative lookup cache.
+* Selectors that a class definitely does not implement, even after 
+* its method resolvers ran. lookUpImpOrNil() consults it so that 
+* respondsToSelector: and friends don't rewalk the superclass chain 
+* for selectors that will never be found, and records such misses 
+* here instead of filling the method cache with _objc_msgForward_impcache.
+*
+* The table is allocated the first time the class records a miss, and 
+* kept until the class is disposed. A selector lives in one of the 
+* NEGATIVE_PROBES slots after its hash slot; when those are full it 
+* replaces the one in its hash slot. Entries are added with 
+* compare-and-swap by threads holding runtimeLock for reading. 
+* Readers don't lock. cache_erase_nolock() empties the table with 
+* runtimeLock held for writing, so the entries go away whenever the 
+* method cache is flushed: after category attachment, method 
+* addition, and _objc_flush_caches().
+**********************************************************************/
+enum {
+    NEGATIVE_CACHE_SIZE = 16,  // must be a power of two
+    NEGATIVE_PROBES = 4
+};
+
+struct cache_negative_t {
+    SEL sels[NEGATIVE_CACHE_SIZE];
+};
+
+static inline unsigned cache_negative_hash(SEL sel)
+{
+    return (unsigned)((uintptr_t)sel >> 3) & (NEGATIVE_CACHE_SIZE - 1);
+}
+
+bool cache_negativeContains(Class cls, SEL sel)
+{
+    cache_negative_t *table = cls->data()->negativeCache;
+    if (!table) return false;
+
+    unsigned h = cache_negative_hash(sel);
+    for (unsigned i = 0; i < NEGATIVE_PROBES; i++) {
+        if (table->sels[(h + i) & (NEGATIVE_CACHE_SIZE - 1)] == sel) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void cache_negativeAdd(Class cls, SEL sel)
+{
+    runtimeLock.assertReading();
+    assert(cls->isRealized());
+
+    class_rw_t *rw = cls->data();
+    cache_negative_t *table = rw->negativeCache;
+    if (!table) {
+        table = (cache_negative_t *)calloc(1, sizeof(cache_negative_t));
+        if (!OSAtomicCompareAndSwapPtrBarrier(nil, table, 
+                                              (void * volatile *)&rw->negativeCache))
+        {
+            // Some other thread allocated it first.
+            free(table);
+            table = rw->negativeCache;
+        }
+    }
+
+    unsigned h = cache_negative_hash(sel);
+    for (unsigned i = 0; i < NEGATIVE_PROBES; i++) {
+        SEL *slot = &table->sels[(h + i) & (NEGATIVE_CACHE_SIZE - 1)];
+        if (*slot == sel) return;
+        if (*slot == nil  &&  
+            OSAtomicCompareAndSwapPtrBarrier(nil, sel, (void * volatile *)slot))
+        {
+            return;
+        }
+    }
+
+    // Full. Evict whatever is in the hash slot.
+    table->sels[h] = sel;
+}
+
+static void cache_negativeErase(Class cls)
+{
+    runtimeLock.assertWriting();
+
+    cache_negative_t *table = cls->data()->negativeCache;
+    if (table) bzero(table, sizeof(*table));
+}
+
+
+/***********************************************************************
+* Inline IMP caches.
+* Each class has a cache generation number that changes every time 
+* its method cache is erased. objc_imp_cache_t remembers an IMP along 
+* with its class and that class's generation, and is only trusted while 
+* the generation is unchanged.
+*
+* Generation numbers come from one process-wide counter, so a class 
+* never reuses a number, not even a new class at a disposed class's 
+* address. 0 means none yet; it is replaced with a real number 
+* the first time an objc_imp_cache_t is filled for the class.
+*
+* objc_imp_cache_t is a sequence lock. Writers that can't make the 
+* sequence odd simply don't fill it. Readers retry with a full lookup 
+* if the sequence is odd or changed while they read the entry.
+**********************************************************************/
+static uintptr_t cache_generation;
+
+static uintptr_t cache_nextGeneration(void)
+{
+    return __sync_add_and_fetch(&cache_generation, 1);
+}
+
+static void cache_bumpGeneration(Class cls)
+{
+    cls->data()->cacheGeneration = cache_nextGeneration();
+}
+
+static uintptr_t cache_classGeneration(Class cls)
+{
+    class_rw_t *rw = cls->data();
+    uintptr_t gen = rw->cacheGeneration;
+    if (!gen) {
+        __sync_bool_compare_and_swap(&rw->cacheGeneration, 0, 
+                                     cache_nextGeneration());
+        gen = rw->cacheGeneration;
+    }
+    return gen;
+}
+
+IMP objc_imp_cache_lookup(objc_imp_cache_t *cache, id receiver, SEL sel)
+{
+    if (!receiver) return nil;
+    Class cls = receiver->getIsa();
+
+    uintptr_t seq = __atomic_load_n(&cache->sequence, __ATOMIC_ACQUIRE);
+    Class cachedCls = cache->cls;
+    SEL cachedSel = cache->sel;
+    uintptr_t cachedGen = cache->generation;
+    IMP imp = cache->imp;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if ((seq & 1) == 0  &&  seq == cache->sequence  &&  
+        cachedCls == cls  &&  cachedSel == sel  &&  
+        cachedGen == cls->data()->cacheGeneration)
+    {
+        return imp;
+    }
+
+    // Miss. Read the generation before the lookup, so a flush 
+    // that races with the lookup leaves the entry stale, not wrong.
+    uintptr_t gen = cls->isRealized() ? cache_classGeneration(cls) : 0;
+    OSMemoryBarrier();
+    imp = class_getMethodImplementation(cls, sel);
+    if (!gen) return imp;
+
+    seq = cache->sequence;
+    if ((seq & 1) == 0  &&  
+        __sync_bool_compare_and_swap(&cache->sequence, seq, seq + 1))
+    {
+        cache->cls = cls;
+        cache->sel = sel;
+        cache->generation = gen;
+        cache->imp = imp;
+        __atomic_store_n(&cache->sequence, seq + 2, __ATOMIC_RELEASE);
+    }
+
+    return imp;
+}
+
+
 // Reset this entire cache to the uncached lookup by reallocating it.
-// This must not shrink the cache - that breaks the lock-free scheme.
+// The cache may shrink, but only in two steps: the mask shrinks now, 
+// while the buckets are a constant empty array of the old size, and 
+// reallocate() allocates fewer buckets only once no objc_msgSend 
+// can still be using the old mask.
 void cache_erase_nolock(Class cls)
 {
     cacheUpdateLock.assertLocked();
 
+    cache_negativeErase(cls);
+    cache_bumpGeneration(cls);
+
     cache_t *cache = getCache(cls);
 
     mask_t capacity = cache->capacity();
-    if (capacity > 0  &&  cache->occupied() > 0) {
+    mask_t occupied = cache->occupied();
+    if (capacity > 0  &&  occupied > 0) {
         auto oldBuckets = cache->buckets();
         auto buckets = emptyBucketsForCapacity(capacity);
+        mask_t newCapacity = cache_erasedCapacity(cls, capacity, occupied);
+
+        // Wait for lock-free writers to stop using the old buckets.
+        cache_fill_gate_t& gate = cls->data()->cacheGate;
+        gate.beginReplace();
         cache->setBucketsAndMask(buckets, capacity - 1); // also clears occupied
+        if (newCapacity < capacity) {
+            cache->shrinkMask(newCapacity - 1);
+        }
+        cache_updateTagged(cls);
+        gate.endReplace();
+
+        if (newCapacity < capacity) {
+            cache_policy_t& policy = cls->data()->cachePolicy;
+            policy.shrunkFrom = capacity;
+            policy.shrinkEpoch = cache_advanceEpoch();
+        }
 
         cache_collect_free(oldBuckets, capacity);
         cache_collect(false);
@@ -611,6 +1201,8 @@ void cache_delete(Class cls)
         if (PrintCaches) recordDeadCache(cls->cache.capacity());
         free(cls->cache.buckets());
     }
+    free(cls->data()->negativeCache);
+    cls->data()->negativeCache = nil;
 }
 
 
@@ -663,20 +1255,48 @@ static uintptr_t _get_pc_for_thread(thread_t thread)
 #endif
 
 /***********************************************************************
-* _collecting_in_critical.
-* Returns TRUE if some thread is currently executing a cache-reading 
-* function. Collection of cache garbage is not allowed when a cache-
-* reading function is in progress because it might still be using 
-* the garbage memory.
+* _thread_in_critical.
+* Returns TRUE if the given thread is currently executing a cache-reading 
+* function, or if its PC can't be determined.
 **********************************************************************/
 OBJC_EXPORT uintptr_t objc_entryPoints[];
 OBJC_EXPORT uintptr_t objc_exitPoints[];
 
-static int _collecting_in_critical(void)
+static int _thread_in_critical(thread_t thread)
 {
 #if TARGET_OS_WIN32
     return TRUE;
 #else
+    // Find out where thread is executing
+    uintptr_t pc = _get_pc_for_thread(thread);
+
+    // Check for bad status, and if so, assume the worse (can't collect)
+    if (pc == PC_SENTINEL) return TRUE;
+
+    // Check whether it is in the cache lookup code
+    for (int region = 0; objc_entryPoints[region] != 0; region++) {
+        if ((pc >= objc_entryPoints[region]) &&
+            (pc <= objc_exitPoints[region])) 
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+#endif
+}
+
+
+/***********************************************************************
+* _collecting_in_critical.
+* Returns TRUE if some thread is currently executing a cache-reading 
+* function. Cache collection no longer uses this; it is kept for 
+* DEBUG_TASK_THREADS, which calls it during every message dispatch.
+**********************************************************************/
+#if DEBUG_TASK_THREADS
+
+static int _collecting_in_critical(void)
+{
     thread_act_port_array_t threads;
     unsigned number;
     unsigned count;
@@ -686,11 +1306,7 @@ static int _collecting_in_critical(void)
     mach_port_t mythread = pthread_mach_thread_np(pthread_self());
 
     // Get a list of all the threads in the current task
-#if !DEBUG_TASK_THREADS
-    ret = task_threads(mach_task_self(), &threads, &number);
-#else
     ret = objc_task_threads(mach_task_self(), &threads, &number);
-#endif
 
     if (ret != KERN_SUCCESS) {
         // See DEBUG_TASK_THREADS below to help debug this.
@@ -701,36 +1317,16 @@ static int _collecting_in_critical(void)
     result = FALSE;
     for (count = 0; count < number; count++)
     {
-        int region;
-        uintptr_t pc;
-
         // Don't bother checking ourselves
         if (threads[count] == mythread)
             continue;
 
-        // Find out where thread is executing
-        pc = _get_pc_for_thread (threads[count]);
-
-        // Check for bad status, and if so, assume the worse (can't collect)
-        if (pc == PC_SENTINEL)
-        {
+        if (_thread_in_critical(threads[count])) {
             result = TRUE;
-            goto done;
-        }
-        
-        // Check whether it is in the cache lookup code
-        for (region = 0; objc_entryPoints[region] != 0; region++)
-        {
-            if ((pc >= objc_entryPoints[region]) &&
-                (pc <= objc_exitPoints[region])) 
-            {
-                result = TRUE;
-                goto done;
-            }
+            break;
         }
     }
 
- done:
     // Deallocate the port rights for the threads
     for (count = 0; count < number; count++) {
         mach_port_deallocate(mach_task_self (), threads[count]);
@@ -741,7 +1337,321 @@ static int _collecting_in_critical(void)
 
     // Return our finding
     return result;
+}
+
+// DEBUG_TASK_THREADS
 #endif
+
+
+/***********************************************************************
+* Cache reader epochs.
+* cache_epoch advances every time a cache's buckets are disconnected 
+* and every time a cache's mask shrinks.
+* Every thread that may read method caches has a cache_reader_t 
+* holding the newest epoch that thread has observed at a quiescent point.
+*
+* Records are registered when a thread starts (via the pthread 
+* introspection hook) or lazily at the thread's first quiescent point, 
+* and are deactivated when the thread terminates. Records are never 
+* freed; a terminated thread's record is reused by a later thread. 
+* Readers therefore never need a lock to find their record, and 
+* cache_collect() can walk the list while threads come and go.
+*
+* Threads that already exist when cache_init() runs are registered 
+* then, once. Threads not created with pthreads can't run 
+* Objective-C code and are not tracked.
+**********************************************************************/
+
+struct cache_reader_t {
+    cache_reader_t *next;
+    uintptr_t epoch;
+    mach_port_t thread;
+    int32_t active;
+    // Kept when the record is reused. Only the owning thread writes these.
+    cache_thread_stats_t stats;
+};
+
+static cache_reader_t * volatile cache_readers = nil;
+static uintptr_t cache_epoch = 0;
+
+static pthread_introspection_hook_t cache_prevThreadHook = nil;
+
+// Statistics for _objc_getCacheGarbageInfo() and OBJC_PRINT_CACHE_SETUP
+static size_t cache_freed_bytes;
+static unsigned cache_lagging_threads;
+static unsigned cache_pc_checks;
+
+
+// Start a new cache epoch after disconnecting some cache memory.
+// Full barrier: a reader that sees the new epoch also sees the 
+// disconnection.
+static uintptr_t cache_advanceEpoch(void)
+{
+    cacheUpdateLock.assertLocked();
+    return __sync_add_and_fetch(&cache_epoch, 1);
+}
+
+
+static cache_reader_t *cache_reader_register(mach_port_t thread)
+{
+    cache_reader_t *rec;
+
+    // Our record may already exist, if it was registered at thread start 
+    // or if our pthread data was destroyed and then created again.
+    for (rec = cache_readers; rec; rec = rec->next) {
+        if (rec->active  &&  rec->thread == thread) return rec;
+    }
+
+    // Reuse a dead thread's record. A collector may see the old thread 
+    // and epoch for a moment; that only makes it more conservative.
+    for (rec = cache_readers; rec; rec = rec->next) {
+        if (!rec->active  &&  
+            OSAtomicCompareAndSwap32Barrier(0, 1, &rec->active)) 
+        {
+            rec->thread = thread;
+            rec->epoch = cache_epoch;
+            OSMemoryBarrier();
+            return rec;
+        }
+    }
+
+    // Push a new record.
+    rec = (cache_reader_t *)calloc(1, sizeof(cache_reader_t));
+    rec->thread = thread;
+    rec->epoch = cache_epoch;
+    rec->active = 1;
+    do {
+        rec->next = cache_readers;
+    } while (!OSAtomicCompareAndSwapPtrBarrier(rec->next, rec, 
+                                               (void * volatile *)&cache_readers));
+    return rec;
+}
+
+
+static void cache_reader_unregister(mach_port_t thread)
+{
+    for (cache_reader_t *rec = cache_readers; rec; rec = rec->next) {
+        if (rec->active  &&  rec->thread == thread) {
+            OSMemoryBarrier();
+            rec->active = 0;
+        }
+    }
+}
+
+
+static void cache_thread_hook(unsigned int event, pthread_t thread, 
+                              void *addr, size_t size)
+{
+    // START and TERMINATE are delivered on the thread itself. 
+    // TERMINATE comes after the thread's last pthread destructor.
+    if (event == PTHREAD_INTROSPECTION_THREAD_START) {
+        cache_reader_register(pthread_mach_thread_np(thread));
+    }
+    else if (event == PTHREAD_INTROSPECTION_THREAD_TERMINATE) {
+        cache_reader_unregister(pthread_mach_thread_np(thread));
+    }
+
+    if (cache_prevThreadHook) {
+        cache_prevThreadHook(event, thread, addr, size);
+    }
+}
+
+
+/***********************************************************************
+* cache_init
+* Read the cache size policy settings. Start tracking the threads 
+* created from now on, then register every thread that already exists 
+* as a cache reader. The hook is installed first so no thread is 
+* missed in between; a thread seen both ways is registered once.
+* Called by _objc_init() before any other thread can use the runtime.
+**********************************************************************/
+void cache_init(void)
+{
+    thread_act_port_array_t threads;
+    unsigned number;
+    unsigned count;
+    kern_return_t ret;
+
+    cache_shrink_flushes = (uint32_t)
+        numericOption(CacheShrinkFlushes, cache_shrink_flushes);
+    cache_grow_probes = (uint32_t)
+        numericOption(CacheGrowProbes, cache_grow_probes);
+
+    cache_reader_register(pthread_mach_thread_np(pthread_self()));
+    cache_prevThreadHook = 
+        pthread_introspection_hook_install(&cache_thread_hook);
+
+    ret = task_threads(mach_task_self(), &threads, &number);
+    if (ret != KERN_SUCCESS) {
+        _objc_fatal("task_threads failed (result 0x%x)\n", ret);
+    }
+
+    for (count = 0; count < number; count++) {
+        cache_reader_register(threads[count]);
+    }
+
+    // Deallocate the port rights for the threads. Each thread's 
+    // pthread keeps its own right, so the names stay valid.
+    for (count = 0; count < number; count++) {
+        mach_port_deallocate(mach_task_self(), threads[count]);
+    }
+    vm_deallocate(mach_task_self(), (vm_address_t)threads, 
+                  sizeof(threads[0]) * number);
+}
+
+
+/***********************************************************************
+* cache_quiescent
+* Announce that this thread is not reading any method cache and 
+* holds no pointer to any cache's buckets, so all garbage disconnected 
+* so far may be freed as far as this thread is concerned.
+* Cheap unless the cache epoch changed since this thread's last call.
+**********************************************************************/
+static cache_reader_t *cache_reader_self(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    cache_reader_t *rec = data->cacheReader;
+    if (!rec) {
+        rec = cache_reader_register(pthread_mach_thread_np(pthread_self()));
+        data->cacheReader = rec;
+    }
+    return rec;
+}
+
+static cache_thread_stats_t *cache_threadStats(void)
+{
+    return &cache_reader_self()->stats;
+}
+
+void cache_quiescent(void)
+{
+    cache_reader_t *rec = cache_reader_self();
+
+    uintptr_t epoch = cache_epoch;
+    if (rec->epoch != epoch) {
+        // Finish our old cache reads before announcing. 
+        // Also make sure our later cache reads see every disconnection 
+        // that happened before epoch was incremented.
+        OSMemoryBarrier();
+        rec->epoch = epoch;
+    }
+}
+
+
+/***********************************************************************
+* cache_miss
+* Count a message send that missed cls's cache.
+* objc_msgSend is done with the cache, so this is also a quiescent point.
+**********************************************************************/
+void cache_miss(Class cls)
+{
+    cache_quiescent();
+    cache_threadStats()->misses++;
+
+    // Unrealized classes have no cache_policy_t yet.
+    // Many threads may miss in the same class at once.
+    if (cls->isRealized()) {
+        cache_policy_t& policy = cls->data()->cachePolicy;
+        OSAtomicIncrement64((volatile int64_t *)&policy.misses);
+    }
+}
+
+
+/***********************************************************************
+* cache_getStatistics
+* Fill in the cache statistics for one class.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+void cache_getStatistics(Class cls, objc_class_cache_stats_t *stats)
+{
+    cacheUpdateLock.assertLocked();
+
+    cache_t *cache = getCache(cls);
+    cache_policy_t& policy = cls->data()->cachePolicy;
+
+    bzero(stats, sizeof(*stats));
+    stats->cls = cls;
+    stats->capacity = cache->capacity();
+    stats->occupied = cache->occupied();
+    stats->misses = policy.misses;
+    stats->reallocations = policy.reallocations;
+
+    if (cache->isConstantEmptyCache()) return;
+
+    // Lock-free writers may add entries while we look. 
+    // The buckets themselves can't change.
+    bucket_t *b = cache->buckets();
+    mask_t m = cache->mask();
+    const mask_t last = countof(stats->probeCounts) - 1;
+    for (mask_t i = 0; i <= m; i++) {
+        cache_key_t k = b[i].key();
+        if (k == 0) continue;
+        mask_t distance = cache_distance(cache_hash(k, m), i, m);
+        stats->probeCounts[distance < last ? distance : last]++;
+    }
+}
+
+
+/***********************************************************************
+* cache_getTotals
+* Add up every thread's cache statistics, including finished threads.
+**********************************************************************/
+void cache_getTotals(objc_cache_totals_t *totals)
+{
+    bzero(totals, sizeof(*totals));
+    for (cache_reader_t *rec = cache_readers; rec; rec = rec->next) {
+        totals->misses += rec->stats.misses;
+        totals->fills += rec->stats.fills;
+        totals->lockfreeFills += rec->stats.lockfreeFills;
+        totals->reallocations += rec->stats.reallocations;
+    }
+}
+
+
+/***********************************************************************
+* cache_reader_min_epoch
+* Returns the oldest epoch that some active cache reader may still be 
+* using. Garbage tagged with this epoch or older is safe to free.
+* If checkLagging is set, the PC of each lagging reader is checked and 
+* a reader outside the cache-reading code is advanced on its behalf.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+static uintptr_t cache_reader_min_epoch(bool checkLagging)
+{
+    cacheUpdateLock.assertLocked();
+
+    uintptr_t current = cache_epoch;
+    uintptr_t result = current;
+    unsigned lagging = 0;
+
+    // We are collecting, not reading caches.
+    mach_port_t self = pthread_mach_thread_np(pthread_self());
+
+    for (cache_reader_t *rec = cache_readers; rec; rec = rec->next) {
+        if (!rec->active  ||  rec->thread == self) continue;
+
+        uintptr_t epoch = rec->epoch;
+        if (epoch >= current) continue;
+
+        lagging++;
+        if (checkLagging) {
+            cache_pc_checks++;
+            if (!_thread_in_critical(rec->thread)) {
+                // The thread can't be using any garbage right now. 
+                // If it announces an epoch concurrently, that wins.
+                OSAtomicCompareAndSwapPtrBarrier((void *)epoch, 
+                                                 (void *)current, 
+                                                 (void * volatile *)&rec->epoch);
+                lagging--;
+                continue;
+            }
+        }
+
+        if (epoch < result) result = epoch;
+    }
+
+    cache_lagging_threads = lagging;
+    return result;
 }
 
 
@@ -750,14 +1660,21 @@ static int _collecting_in_critical(void)
 * one more ref in the garbage.
 **********************************************************************/
 
+// one disconnected bucket array waiting to be freed
+struct cache_garbage_t {
+    bucket_t *buckets;
+    size_t bytes;
+    uintptr_t epoch;  // cache_epoch after the buckets were disconnected
+};
+
 // amount of memory represented by all refs in the garbage
 static size_t garbage_byte_size = 0;
 
 // do not empty the garbage until garbage_byte_size gets at least this big
 static size_t garbage_threshold = 32*1024;
 
-// table of refs to free
-static bucket_t **garbage_refs = 0;
+// table of refs to free, oldest epoch first
+static cache_garbage_t *garbage_refs = 0;
 
 // current number of refs in garbage_refs
 static size_t garbage_count = 0;
@@ -778,16 +1695,16 @@ static void _garbage_make_room(void)
     if (first)
     {
         first = 0;
-        garbage_refs = (bucket_t**)
-            malloc(INIT_GARBAGE_COUNT * sizeof(void *));
+        garbage_refs = (cache_garbage_t *)
+            malloc(INIT_GARBAGE_COUNT * sizeof(cache_garbage_t));
         garbage_max = INIT_GARBAGE_COUNT;
     }
 
     // Double the table if it is full
     else if (garbage_count == garbage_max)
     {
-        garbage_refs = (bucket_t**)
-            realloc(garbage_refs, garbage_max * 2 * sizeof(void *));
+        garbage_refs = (cache_garbage_t *)
+            realloc(garbage_refs, garbage_max * 2 * sizeof(cache_garbage_t));
         garbage_max *= 2;
     }
 }
@@ -798,6 +1715,7 @@ static void _garbage_make_room(void)
 * of them to free at some later point.
 * size is used for the collection threshold. It does not have to be 
 * precisely the block's size.
+* The memory must already be disconnected from every class.
 * Cache locks: cacheUpdateLock must be held by the caller.
 **********************************************************************/
 static void cache_collect_free(bucket_t *data, mask_t capacity)
@@ -807,8 +1725,39 @@ static void cache_collect_free(bucket_t *data, mask_t capacity)
     if (PrintCaches) recordDeadCache(capacity);
 
     _garbage_make_room ();
-    garbage_byte_size += cache_t::bytesForCapacity(capacity);
-    garbage_refs[garbage_count++] = data;
+    size_t bytes = cache_t::bytesForCapacity(capacity);
+    garbage_byte_size += bytes;
+
+    cache_garbage_t& garbage = garbage_refs[garbage_count++];
+    garbage.buckets = data;
+    garbage.bytes = bytes;
+    garbage.epoch = cache_advanceEpoch();
+}
+
+
+/***********************************************************************
+* _garbage_free_through.  Free every ref in the garbage whose epoch 
+* is no newer than epoch.
+* Cache locks: cacheUpdateLock must be held by the caller.
+**********************************************************************/
+static void _garbage_free_through(uintptr_t epoch)
+{
+    cacheUpdateLock.assertLocked();
+
+    // garbage_refs is sorted by epoch. Free a prefix and slide the rest.
+    size_t count = 0;
+    while (count < garbage_count  &&  garbage_refs[count].epoch <= epoch) {
+        free(garbage_refs[count].buckets);
+        garbage_byte_size -= garbage_refs[count].bytes;
+        cache_freed_bytes += garbage_refs[count].bytes;
+        count++;
+    }
+
+    if (count == 0) return;
+
+    garbage_count -= count;
+    memmove(garbage_refs, garbage_refs + count, 
+            garbage_count * sizeof(cache_garbage_t));
 }
 
 
@@ -826,40 +1775,39 @@ void cache_collect(bool collectALot)
         return;
     }
 
-    // Synchronize collection with objc_msgSend and other cache readers
-    if (!collectALot) {
-        if (_collecting_in_critical ()) {
-            // objc_msgSend (or other cache reader) is currently looking in
-            // the cache and might still be using some garbage.
-            if (PrintCaches) {
-                _objc_inform ("CACHES: not collecting; "
-                              "objc_msgSend in progress");
-            }
-            return;
-        }
-    } 
-    else {
-        // No excuses.
-        while (_collecting_in_critical()) 
-            ;
+    // Free everything that every cache reader has moved past.
+    size_t oldByteSize = garbage_byte_size;
+    _garbage_free_through(cache_reader_min_epoch(false));
+
+    // Lagging readers are holding on to too much garbage. 
+    // Check where they are. This is the only time threads are inspected.
+    if (garbage_byte_size >= garbage_threshold  ||  collectALot) {
+        _garbage_free_through(cache_reader_min_epoch(true));
     }
 
-    // No cache readers in progress - garbage is now deletable
+    if (collectALot) {
+        // No excuses.
+        while (garbage_count) {
+            sched_yield();
+            _garbage_free_through(cache_reader_min_epoch(true));
+        }
+    }
 
     // Log our progress
     if (PrintCaches) {
-        cache_collections++;
-        _objc_inform ("CACHES: COLLECTING %zu bytes (%zu allocations, %zu collections)", garbage_byte_size, cache_allocations, cache_collections);
-    }
-    
-    // Dispose all refs now in the garbage
-    while (garbage_count--) {
-        free(garbage_refs[garbage_count]);
+        if (garbage_byte_size != oldByteSize) {
+            cache_collections++;
+            _objc_inform ("CACHES: COLLECTED %zu bytes (%zu allocations, %zu collections)", oldByteSize - garbage_byte_size, cache_allocations, cache_collections);
+        }
+        if (garbage_count) {
+            // Some cache reader has not moved past some garbage yet.
+            _objc_inform("CACHES: not collecting %zu bytes; "
+                         "%u threads lagging (oldest epoch %lu, current %lu)", 
+                         garbage_byte_size, cache_lagging_threads, 
+                         (unsigned long)garbage_refs[0].epoch, 
+                         (unsigned long)cache_epoch);
+        }
     }
-    
-    // Clear the garbage count and total size indicator
-    garbage_count = 0;
-    garbage_byte_size = 0;
 
     if (PrintCaches) {
         size_t i;
@@ -882,10 +1830,34 @@ void cache_collect(bool collectALot)
 
         _objc_inform("CACHES:      total: %4zu caches, %6zu bytes", 
                      total_count, total_size);
+        if (cache_shrunk_bytes) {
+            _objc_inform("CACHES: shrinking saved %zu bytes", 
+                         cache_shrunk_bytes);
+        }
     }
 }
 
 
+/***********************************************************************
+* _objc_getCacheGarbageInfo.  Report how far cache reclamation lags.
+* Cache locks: acquires cacheUpdateLock.
+**********************************************************************/
+void _objc_getCacheGarbageInfo(objc_cache_garbage_info_t *info)
+{
+    if (!info) return;
+
+    mutex_locker_t lock(cacheUpdateLock);
+
+    info->pendingBytes = garbage_byte_size;
+    info->pendingCount = garbage_count;
+    info->freedBytes = cache_freed_bytes;
+    info->epoch = cache_epoch;
+    info->oldestPendingEpoch = garbage_count ? garbage_refs[0].epoch : 0;
+    info->laggingThreads = cache_lagging_threads;
+    info->pcChecks = cache_pc_checks;
+}
+
+
 /***********************************************************************
 * objc_task_threads
 * Replacement for task_threads(). Define DEBUG_TASK_THREADS to debug 
@@ -693,6 +693,22 @@ void _class_setIvarLayoutAccessor(Class cls, const uint8_t* (*accessor) (id obje
     cls->setInfo(CLS_HAS_INSTANCE_SPECIFIC_LAYOUT);
 }
 
+// SPI:  Biased retain counts. Not supported without nonpointer isa.
+
+void _class_setUsesBiasedRetainCounts(Class cls __unused) {
+}
+
+// SPI:  Retain count tracing. Not supported by the old runtime.
+
+void _class_setTracesRetainCounts(Class cls __unused) {
+}
+
+// SPI:  Inline associated objects. Not supported by the old runtime.
+
+BOOL _class_setUsesInlineAssociations(Class cls __unused) {
+    return NO;
+}
+
 const uint8_t *_object_getIvarLayout(Class cls, id object) {
     if (cls && (cls->info & CLS_EXT)) {
         const uint8_t* layout = cls->ivar_layout;
@@ -211,6 +211,24 @@ Class object_setClass(id obj, Class cls)
         _class_initialize(_class_getNonMetaClass(cls, nil));
     }
 
+#if __OBJC2__
+    // Associations live in the inline slot if the class has one, 
+    // so the new class must keep it at the same place.
+    if (!obj->isTaggedPointer()) {
+        Class oldCls = obj->ISA();
+        bool hadSlot = oldCls->instancesHaveInlineAssociations();
+        if (hadSlot != cls->instancesHaveInlineAssociations()  ||  
+            (hadSlot  &&  oldCls->inlineAssociationsOffset() != 
+                          cls->inlineAssociationsOffset()))
+        {
+            _objc_fatal("object_setClass(%p, %s): class does not share "
+                        "the inline associations slot of class %s", 
+                        (void*)obj, cls->nameForLogging(), 
+                        oldCls->nameForLogging());
+        }
+    }
+#endif
+
     return obj->changeIsa(cls);
 }
 
@@ -886,6 +904,9 @@ _class_createInstancesFromZone(Class cls, size_t extraBytes, void *zone,
     if (!cls) return 0;
 
     size_t size = cls->instanceSize(extraBytes);
+#if __OBJC2__
+    cls->setInstancesAllocated();
+#endif
 
 #if SUPPORT_GC
     if (UseGC) {
@@ -79,6 +79,15 @@
 #   define SUPPORT_MSB_TAGGED_POINTERS 1
 #endif
 
+// objc_msgSend finds a tagged pointer's method cache in objc_tag_caches 
+// at (slot << TAG_CACHE_SHIFT), then passes that address minus 
+// CLASS_CACHE_OFFSET to CacheLookup as the class.
+// objc-cache.mm asserts both against the C++ layout.
+#if SUPPORT_TAGGED_POINTERS
+#   define CLASS_CACHE_OFFSET 16  // offsetof(objc_class, cache)
+#   define TAG_CACHE_SHIFT 4      // log2(sizeof(cache_t))
+#endif
+
 // Define SUPPORT_NONPOINTER_ISA=1 to enable extra data in the isa field.
 #if !__LP64__  ||  TARGET_OS_WIN32  ||  TARGET_IPHONE_SIMULATOR
 #   define SUPPORT_NONPOINTER_ISA 0
@@ -1,6 +1,7 @@
 // -*- truncate-lines: t; -*-
 
-// OPTION(var, env, help)
+// OPTION(var, env, help)        var is true if env is YES
+// VALUE_OPTION(var, env, help)  var is env's value, or nil if env is not set
 
 OPTION( PrintImages,              OBJC_PRINT_IMAGES,               "log image and library names as they are loaded")
 OPTION( PrintImageTimes,          OBJC_PRINT_IMAGE_TIMES,          "measure duration of image loading steps")
@@ -42,3 +43,14 @@ OPTION( DisableVtables,           OBJC_DISABLE_VTABLES,            "disable vtab
 OPTION( DisablePreopt,            OBJC_DISABLE_PREOPTIMIZATION,    "disable preoptimization courtesy of dyld shared cache")
 OPTION( DisableTaggedPointers,    OBJC_DISABLE_TAGGED_POINTERS,    "disable tagged pointer optimization of NSNumber et al.") 
 OPTION( DisableIndexedIsa,        OBJC_DISABLE_NONPOINTER_ISA,     "disable non-pointer isa fields")
+OPTION( DisableFlushBatching,     OBJC_DISABLE_FLUSH_BATCHING,     "flush method caches once per category instead of once per image")
+OPTION( ProfileSideTables,        OBJC_PROFILE_SIDE_TABLES,        "count side table lock acquisitions, contention and wait time for objc_copySideTableStatistics()")
+OPTION( BiasedRetainCounts,       OBJC_BIASED_RETAIN_COUNTS,       "make each new object owned by its allocating thread, which retains and releases it without atomic operations")
+
+VALUE_OPTION( CacheShrinkFlushes, OBJC_CACHE_SHRINK_FLUSHES,       "shrink method caches that stay sparse across this many flushes (default 3; 0 never shrinks)")
+VALUE_OPTION( CacheGrowProbes,    OBJC_CACHE_GROW_PROBES,          "grow method caches early when the average probe distance exceeds this (default 2; 0 grows only when full)")
+VALUE_OPTION( RecordCacheProfile, OBJC_RECORD_CACHE_PROFILE,       "write each class's cached selectors to the named file at exit")
+VALUE_OPTION( ReplayCacheProfile, OBJC_REPLAY_CACHE_PROFILE,       "prefill method caches from the named OBJC_RECORD_CACHE_PROFILE file")
+VALUE_OPTION( ProfileLocks,       OBJC_PROFILE_LOCKS,              "sample one in N runtime spinlock acquisitions and log the most contended locks at exit (YES samples all of them)")
+VALUE_OPTION( TraceRRBuffer,      OBJC_TRACE_RR_BUFFER,            "records per thread kept by retain count tracing, rounded up to a power of two (default 4096)")
+VALUE_OPTION( SideTableStripes,   OBJC_SIDE_TABLE_STRIPES,         "number of lock stripes for retain counts and weak references, rounded up to a power of two (default depends on the CPU count)")
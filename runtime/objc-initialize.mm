@@ -271,8 +271,11 @@ static NXMapTable *pendingInitializeMap;
 * cls has completed its +initialize method, and so has its superclass.
 * Mark cls as initialized as well, then mark any of cls's subclasses 
 * that have already finished their own +initialize methods.
+* Those subclasses are added to *finished so the caller can finish 
+* setting them up after classInitLock is released.
 **********************************************************************/
-static void _finishInitializing(Class cls, Class supercls)
+static void _finishInitializing(Class cls, Class supercls, 
+                                PendingInitialize **finished)
 {
     PendingInitialize *pending;
 
@@ -309,8 +312,13 @@ static void _finishInitializing(Class cls, Class supercls)
 
     while (pending) {
         PendingInitialize *next = pending->next;
-        if (pending->subclass) _finishInitializing(pending->subclass, cls);
-        free(pending);
+        if (pending->subclass) {
+            _finishInitializing(pending->subclass, cls, finished);
+            pending->next = *finished;
+            *finished = pending;
+        } else {
+            free(pending);
+        }
         pending = next;
     }
 }
@@ -399,11 +407,29 @@ void _class_initialize(Class cls)
         //   the info bits and notify waiting threads.
         // If not, update them later. (This can happen if this +initialize 
         //   was itself triggered from inside a superclass +initialize.)
-        monitor_locker_t lock(classInitLock);
-        if (!supercls  ||  supercls->isInitialized()) {
-            _finishInitializing(cls, supercls);
-        } else {
-            _finishInitializingAfter(cls, supercls);
+        PendingInitialize *finished = nil;
+        {
+            monitor_locker_t lock(classInitLock);
+            if (!supercls  ||  supercls->isInitialized()) {
+                _finishInitializing(cls, supercls, &finished);
+            } else {
+                _finishInitializingAfter(cls, supercls);
+            }
+        }
+
+        // Prewarm the method caches now that these classes may be cached. 
+        // Subclasses that were waiting for cls are prewarmed here too.
+        // This is outside classInitLock because resolvers may run.
+#if __OBJC2__
+        if (cls->isInitialized()) cache_prewarmFromProfile(cls);
+#endif
+        while (finished) {
+            PendingInitialize *next = finished->next;
+#if __OBJC2__
+            cache_prewarmFromProfile(finished->subclass);
+#endif
+            free(finished);
+            finished = next;
         }
         return;
     }
@@ -121,6 +121,190 @@ OBJC_EXPORT void _objc_setClassLoader(BOOL (*newClassLoader)(const char *))  OBJ
 OBJC_EXPORT void _objc_setBadAllocHandler(id (*newHandler)(Class isa))
      __OSX_AVAILABLE_STARTING(__MAC_10_8, __IPHONE_6_0);
 
+// Method cache memory that has been replaced but not yet freed.
+// Replaced caches are freed after every thread has passed a 
+// quiescent point (a message send cache miss or an autorelease pool pop).
+// A large pendingBytes with laggingThreads != 0 means some threads 
+// rarely reach a quiescent point.
+#if __OBJC2__
+typedef struct {
+    size_t pendingBytes;           // replaced caches waiting to be freed
+    size_t pendingCount;
+    size_t freedBytes;             // total freed since launch
+    uintptr_t epoch;               // current cache epoch
+    uintptr_t oldestPendingEpoch;  // epoch of the oldest waiting cache, or 0
+    unsigned laggingThreads;       // threads behind at the last collection
+    unsigned pcChecks;             // lagging threads whose PC was inspected
+} objc_cache_garbage_info_t;
+
+OBJC_EXPORT void _objc_getCacheGarbageInfo(objc_cache_garbage_info_t *info)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+#endif
+
+// Method cache statistics, cheap enough to keep on all the time.
+// Per-class counts are approximate: concurrent updates may be lost.
+#if __OBJC2__
+typedef struct {
+    Class cls;                  // may be a metaclass
+    uint32_t capacity;          // buckets
+    uint32_t occupied;          // entries
+    uint32_t probeCounts[8];    // entries found N buckets after their 
+                                // hash position; the last counts N >= 7
+    uint64_t misses;            // message sends that missed the cache
+    uint32_t reallocations;     // times the cache was reallocated
+} objc_class_cache_stats_t;
+
+typedef struct {
+    uint64_t misses;            // message sends that missed any cache
+    uint64_t fills;             // entries added with cacheUpdateLock held
+    uint64_t lockfreeFills;     // entries added without it
+    uint64_t reallocations;     // caches reallocated
+} objc_cache_totals_t;
+
+// Returns statistics for every class whose method cache has been used, 
+// most misses first. outTotals, if not NULL, gets process-wide totals.
+// The caller must free() the result.
+OBJC_EXPORT objc_class_cache_stats_t *
+objc_copyCacheStatistics(unsigned int *outCount, objc_cache_totals_t *outTotals)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+#endif
+
+// Lock statistics for each stripe of the side tables that hold 
+// retain counts and weak references. Always on.
+typedef struct {
+    uint64_t acquisitions;      // times the stripe's lock was taken
+    uint64_t contended;         // acquisitions that had to wait
+    uint64_t waitNanoseconds;   // total time spent waiting
+} objc_side_table_stats_t;
+
+// Returns statistics for every side table stripe. 
+// *outCount is the stripe count. The caller must free() the result.
+// The statistics are only counted when OBJC_PROFILE_SIDE_TABLES is set.
+OBJC_EXPORT objc_side_table_stats_t *
+objc_copySideTableStatistics(unsigned int *outCount)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Spinlock profile from OBJC_PROFILE_LOCKS=N, which samples one in N 
+// acquisitions of the runtime's spinlocks, such as the side table, 
+// @synchronized, and atomic property locks. 
+// Counts are estimates scaled up from the samples.
+#define OBJC_LOCK_PROFILE_CALLERS 4
+
+typedef struct {
+    const void *lock;
+    const char *name;           // lock array, e.g. "SideTable", or NULL
+    size_t offset;              // lock's offset in that array
+    uint64_t acquisitions;
+    uint64_t contended;         // acquisitions that had to wait
+    uint64_t failedTrylocks;    // trylock calls that found it locked
+    uint64_t waitNanoseconds;   // total time spent waiting
+    const void *callers[OBJC_LOCK_PROFILE_CALLERS];
+                                // call sites with the most wait time, 
+                                // hottest first; unused slots are NULL
+} objc_lock_profile_t;
+
+// Returns the profile of every sampled lock, most wait time first, 
+// or NULL if OBJC_PROFILE_LOCKS is not set. The caller must free() 
+// the result.
+OBJC_EXPORT objc_lock_profile_t *
+objc_copyLockProfile(unsigned int *outCount)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Logs the profile. OBJC_PROFILE_LOCKS also does this at exit.
+OBJC_EXPORT void
+_objc_printLockProfile(void)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Retain count tracing. After _class_setTracesRetainCounts(cls), 
+// each retain, release, and autorelease of an instance of cls or its 
+// subclasses by the runtime's root implementations is recorded in 
+// the calling thread's ring buffer, which keeps the most recent 
+// OBJC_TRACE_RR_BUFFER records (default 4096). RR overrides that 
+// don't call super are not recorded. Autoreleases elided by the 
+// return value optimization are not recorded, and neither are 
+// their matching retains.
+enum {
+    OBJC_RR_TRACE_RETAIN = 1,
+    OBJC_RR_TRACE_RELEASE = 2,
+    OBJC_RR_TRACE_AUTORELEASE = 3,
+};
+
+typedef struct {
+    uint64_t object;
+    uint64_t caller;            // return address of the retain, release, 
+                                //   or autorelease call
+    uint64_t time;              // mach_absolute_time()
+    uint32_t thread;            // mach thread port
+    uint32_t op;                // OBJC_RR_TRACE_*
+} objc_rr_trace_record_t;
+
+OBJC_EXPORT void _class_setTracesRetainCounts(Class cls)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Returns the records in every thread's buffer, oldest first. 
+// Buffers of exited threads are included until new threads reuse them.
+// The caller must free() the result.
+OBJC_EXPORT objc_rr_trace_record_t *
+objc_copyRetainCountTrace(size_t *outCount)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Writes the records to fd for the offline decoder, rrdecode. 
+// Returns false if the write failed. The format, in native byte order:
+//   objc_rr_trace_header_t
+//   imageCount images: uint64_t mach header address, uint32_t path 
+//     length, path bytes without a terminating NUL
+//   recordCount objc_rr_trace_record_t, oldest first
+#define OBJC_RR_TRACE_MAGIC "OBJCRRT1"
+
+typedef struct {
+    char magic[8];              // OBJC_RR_TRACE_MAGIC, not NUL-terminated
+    uint32_t imageCount;
+    uint32_t recordSize;        // sizeof(objc_rr_trace_record_t)
+    uint64_t recordCount;
+    uint32_t timebaseNumer;     // mach_timebase_info()
+    uint32_t timebaseDenom;
+} objc_rr_trace_header_t;
+
+OBJC_EXPORT bool
+objc_dumpRetainCountTrace(int fd)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Fill cls's method cache with the given selectors in one pass, 
+// as if each had been sent once. cls may be a metaclass.
+// May send +initialize and run method resolvers.
+// OBJC_RECORD_CACHE_PROFILE and OBJC_REPLAY_CACHE_PROFILE use this 
+// to prewarm caches at launch.
+#if __OBJC2__
+OBJC_EXPORT void objc_cache_prewarm(Class cls, const SEL *sels, unsigned int count)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+#endif
+
+// Inline IMP cache for one call site.
+// objc_imp_cache_lookup() returns the IMP that [receiver sel] would 
+// call, like class_getMethodImplementation(object_getClass(receiver), sel), 
+// but remembers it for the receiver's class. While the call site stays 
+// monomorphic it skips the method cache probe. The cached IMP is 
+// discarded when the class's method cache is flushed, so it stays 
+// correct after method_setImplementation(), method_exchangeImplementations(), 
+// category loading, and class_addMethod().
+// An objc_imp_cache_t may be shared by threads. Zero-fill it or use 
+// OBJC_IMP_CACHE_INITIALIZER before first use, and treat it as opaque.
+// Returns nil if receiver is nil.
+#if __OBJC2__
+typedef struct {
+    uintptr_t sequence;
+    Class cls;
+    SEL sel;
+    uintptr_t generation;
+    IMP imp;
+} objc_imp_cache_t;
+
+#define OBJC_IMP_CACHE_INITIALIZER { 0, 0, 0, 0, 0 }
+
+OBJC_EXPORT IMP objc_imp_cache_lookup(objc_imp_cache_t *cache, id receiver, SEL sel)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+#endif
+
 // This can go away when AppKit stops calling it (rdar://7811851)
 #if __OBJC2__
 OBJC_EXPORT void objc_setMultithreaded (BOOL flag)
@@ -322,6 +506,36 @@ OBJC_EXPORT void _class_setIvarLayoutAccessor(Class cls_gen, const uint8_t* (*ac
 OBJC_EXPORT const uint8_t *_object_getIvarLayout(Class cls_gen, id object)
      __OSX_AVAILABLE_STARTING(__MAC_10_7, __IPHONE_NA);
 
+// Biased retain counts.
+// Instances of cls and its subclasses allocated after this call are 
+// owned by the thread that allocates them. The owner thread retains 
+// and releases them without atomic operations; other threads may still 
+// retain and release them through the side table, more slowly. 
+// Use for classes whose instances rarely leave the thread that 
+// creates them.
+// OBJC_BIASED_RETAIN_COUNTS=YES does this for every class.
+OBJC_EXPORT void _class_setUsesBiasedRetainCounts(Class cls)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Inline associated objects.
+// Instances of cls and its subclasses get a hidden slot after their 
+// ivars that points to their associated objects, so association calls 
+// on them don't search the runtime's association tables. Call before 
+// any instance of cls is allocated and before any subclass is used. 
+// Returns NO if that is too late, or if this runtime can't do it.
+// object_setClass() halts if it would move an object between classes 
+// that don't share the same slot.
+OBJC_EXPORT BOOL _class_setUsesInlineAssociations(Class cls)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Releases that other threads made on objects the calling thread owns 
+// are applied when the thread pops an autorelease pool or exits. 
+// Call this to apply them now, for example before the thread waits 
+// for a long time. Returns the calling thread's objects to the 
+// ordinary retain count.
+OBJC_EXPORT void _objc_handOffBiasedObjects(void)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
 OBJC_EXPORT BOOL _class_usesAutomaticRetainRelease(Class cls)
     __OSX_AVAILABLE_STARTING(__MAC_10_7, __IPHONE_5_0);
 
@@ -452,6 +666,33 @@ OBJC_EXPORT id objc_autorelease(id obj)
     __asm__("_objc_autorelease")
     __OSX_AVAILABLE_STARTING(__MAC_10_7, __IPHONE_5_0);
 
+// Retain or release each of count objects, as if by objc_retain() 
+// or objc_release(). nil and tagged pointers are allowed. 
+// Faster than a loop when many of the objects keep their retain 
+// counts in the side table, because each side table lock is taken 
+// once per batch instead of once per object. 
+// objc_releaseBatch() may deallocate the objects in any order.
+OBJC_EXPORT void objc_retainBatch(id *objs, size_t count)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+OBJC_EXPORT void objc_releaseBatch(id *objs, size_t count)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Dealloc batches, for releasing a large object graph. Between 
+// objc_deallocBatchPush() and the matching objc_deallocBatchPop(), 
+// objects the calling thread deallocates with -[NSObject dealloc] 
+// that were weakly referenced or kept a retain count in the side 
+// table are destroyed but not yet freed. Their weak references and 
+// side table entries are cleared with one side table lock per group 
+// of objects, and then they are freed, when the outermost batch pops 
+// or when too many are waiting. 
+// Push also pushes an autorelease pool, and pop pops it first.
+OBJC_EXPORT void *objc_deallocBatchPush(void)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+OBJC_EXPORT void objc_deallocBatchPop(void *context)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
 // Prepare a value at +1 for return through a +0 autoreleasing convention.
 OBJC_EXPORT
 id
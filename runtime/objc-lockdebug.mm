@@ -24,6 +24,7 @@
 /***********************************************************************
 * objc-lock.m
 * Error-checking locks for debugging.
+* Also spinlock profiling for OBJC_PROFILE_LOCKS.
 **********************************************************************/
 
 #include "objc-private.h"
@@ -430,3 +431,383 @@ lockdebug_rwlock_assert_unlocked(rwlock_tt<true> *lock)
 
 
 #endif
+
+
+/***********************************************************************
+* Spinlock profiling
+* OBJC_PROFILE_LOCKS=N samples one in N spinlock_t acquisitions on each 
+* thread. A sample records the lock, the call site, and how long the 
+* caller waited for the lock. Failed trylocks are sampled too. 
+* Samples go straight into a process-wide table that is allocated 
+* once and updated with atomic operations, so recording a sample 
+* takes no lock and allocates nothing, even with spinlocks held. 
+* spinlock_t::unlock() is therefore never profiled.
+* Owners of lock arrays call lockprofile_name() so the profile can 
+* say which lock is which.
+**********************************************************************/
+#if !TARGET_OS_WIN32
+
+bool lockprofile_enabled = false;
+static unsigned int lockprofile_interval;
+
+// Enough for every side table, @synchronized and property lock stripe. 
+// Samples of locks that don't fit are counted in lockprofile_dropped.
+#define LOCKPROFILE_CAPACITY 4096  // power of two
+
+enum lockprofile_kind_t : uint8_t {
+    LOCKPROFILE_ACQUIRED, 
+    LOCKPROFILE_CONTENDED, 
+    LOCKPROFILE_FAILED     // trylock found the lock held
+};
+
+// Samples for one lock. 
+// callers holds the hottest call sites seen so far. A new caller that 
+// finds the list full replaces the coldest one and inherits its counts, 
+// so hot callers are never lost but cold ones may be over-counted.
+// Concurrent samples may pick different coldest callers; 
+// the profile is an estimate anyway.
+struct lockprofile_caller_t {
+    void * volatile pc;
+    uint64_t samples;
+    uint64_t waitTime;  // mach_absolute_time() units
+};
+
+struct lockprofile_entry_t {
+    spinlock_t * volatile lock;
+    uint64_t samples;
+    uint64_t contended;
+    uint64_t failedTrylocks;
+    uint64_t waitTime;  // mach_absolute_time() units
+    lockprofile_caller_t callers[OBJC_LOCK_PROFILE_CALLERS];
+};
+
+static lockprofile_entry_t *lockprofile_table;  // open addressing
+static uint64_t lockprofile_dropped;
+static tls_key_t lockprofile_tls;
+
+// lockprofile_name() is called from C++ static initializers, 
+// so it must not use any lock.
+struct lockprofile_name_t {
+    uintptr_t start;
+    uintptr_t end;
+    const char *name;  // written last
+};
+static lockprofile_name_t lockprofile_names[32];
+static int32_t lockprofile_nameCount;
+
+
+void lockprofile_name(const void *start, size_t size, const char *name)
+{
+    int32_t i = OSAtomicIncrement32Barrier(&lockprofile_nameCount) - 1;
+    if (i >= (int32_t)countof(lockprofile_names)) {
+        _objc_fatal("too many lock arrays for the lock profile (%s); "
+                    "enlarge lockprofile_names", name);
+    }
+
+    lockprofile_names[i].start = (uintptr_t)start;
+    lockprofile_names[i].end = (uintptr_t)start + size;
+    OSMemoryBarrier();
+    lockprofile_names[i].name = name;
+}
+
+static const char *lockprofile_nameForLock(const void *lock, size_t *outOffset)
+{
+    int32_t count = lockprofile_nameCount;
+    for (int32_t i = 0; i < count; i++) {
+        const lockprofile_name_t& n = lockprofile_names[i];
+        if (n.name  &&  (uintptr_t)lock >= n.start  &&  (uintptr_t)lock < n.end) {
+            *outOffset = (uintptr_t)lock - n.start;
+            return n.name;
+        }
+    }
+    *outOffset = 0;
+    return nil;
+}
+
+
+// Returns lock's entry, claiming an empty one if necessary, 
+// or nil if the table is full. Entries are never removed.
+static lockprofile_entry_t *lockprofile_entry(spinlock_t *lock)
+{
+    // Striped locks are a cache line apart.
+    size_t mask = LOCKPROFILE_CAPACITY - 1;
+    size_t begin = ((uintptr_t)lock >> 6) & mask;
+    size_t i = begin;
+    do {
+        lockprofile_entry_t *entry = &lockprofile_table[i];
+        if (!entry->lock) {
+            OSAtomicCompareAndSwapPtrBarrier(nil, lock, 
+                                             (void * volatile *)&entry->lock);
+        }
+        // We or somebody else may have claimed it for this lock.
+        if (entry->lock == lock) return entry;
+        i = (i+1) & mask;
+    } while (i != begin);
+
+    return nil;
+}
+
+static bool lockprofile_hotter(const lockprofile_caller_t *a, 
+                               const lockprofile_caller_t *b)
+{
+    if (a->waitTime != b->waitTime) return a->waitTime > b->waitTime;
+    return a->samples > b->samples;
+}
+
+static void lockprofile_addCaller(lockprofile_entry_t *entry, 
+                                  void *pc, uint64_t wait)
+{
+    lockprofile_caller_t *caller = nil;
+    lockprofile_caller_t *coldest = &entry->callers[0];
+    for (unsigned int i = 0; i < countof(entry->callers); i++) {
+        lockprofile_caller_t *c = &entry->callers[i];
+        // Callers are only replaced once the list is full, so the 
+        // first empty slot means pc is not in the list.
+        if (!c->pc) OSAtomicCompareAndSwapPtrBarrier(nil, pc, &c->pc);
+        if (c->pc == pc) {
+            caller = c;
+            break;
+        }
+        if (lockprofile_hotter(coldest, c)) coldest = c;
+    }
+    if (!caller) {
+        caller = coldest;
+        caller->pc = pc;
+    }
+
+    __sync_fetch_and_add(&caller->samples, 1);
+    if (wait) __sync_fetch_and_add(&caller->waitTime, wait);
+}
+
+static void lockprofile_record(spinlock_t *lock, void *caller, 
+                               lockprofile_kind_t kind, uint64_t wait)
+{
+    lockprofile_entry_t *entry = lockprofile_entry(lock);
+    if (!entry) {
+        __sync_fetch_and_add(&lockprofile_dropped, 1);
+        return;
+    }
+
+    if (kind == LOCKPROFILE_FAILED) {
+        __sync_fetch_and_add(&entry->failedTrylocks, 1);
+    } else {
+        __sync_fetch_and_add(&entry->samples, 1);
+    }
+    if (kind == LOCKPROFILE_CONTENDED) {
+        __sync_fetch_and_add(&entry->contended, 1);
+        __sync_fetch_and_add(&entry->waitTime, wait);
+    }
+    lockprofile_addCaller(entry, caller, wait);
+}
+
+// Returns true if this acquisition should be sampled.
+// The countdown is per thread so threads don't contend on it.
+static bool lockprofile_sample(void)
+{
+    uintptr_t countdown = (uintptr_t)tls_get(lockprofile_tls);
+    if (countdown > 1) {
+        tls_set(lockprofile_tls, (void *)(countdown - 1));
+        return false;
+    }
+    tls_set(lockprofile_tls, (void *)(uintptr_t)lockprofile_interval);
+    return true;
+}
+
+
+/***********************************************************************
+* lockprofile_lock
+* lockprofile_lockContended
+* lockprofile_trylock
+* spinlock_t's methods when profiling is on.
+* Not inlined, so the return address is the call site in the function 
+* that inlined spinlock_t::lock(). Lock wrappers that are not inlined 
+* pass their own caller instead.
+**********************************************************************/
+__attribute__((noinline))
+void lockprofile_lock(spinlock_t *lock)
+{
+    if (!lockprofile_sample()) {
+        os_lock_lock(&lock->mLock);
+        return;
+    }
+
+    lockprofile_kind_t kind = LOCKPROFILE_ACQUIRED;
+    uint64_t wait = 0;
+    if (!os_lock_trylock(&lock->mLock)) {
+        uint64_t start = mach_absolute_time();
+        os_lock_lock(&lock->mLock);
+        wait = mach_absolute_time() - start;
+        kind = LOCKPROFILE_CONTENDED;
+    }
+    lockprofile_record(lock, __builtin_return_address(0), kind, wait);
+}
+
+__attribute__((noinline))
+void lockprofile_lockContended(spinlock_t *lock, void *caller)
+{
+    if (!lockprofile_sample()) {
+        os_lock_lock(&lock->mLock);
+        return;
+    }
+
+    uint64_t start = mach_absolute_time();
+    os_lock_lock(&lock->mLock);
+    uint64_t wait = mach_absolute_time() - start;
+    lockprofile_record(lock, caller, LOCKPROFILE_CONTENDED, wait);
+}
+
+__attribute__((noinline))
+bool lockprofile_trylock(spinlock_t *lock, void *caller)
+{
+    bool locked = os_lock_trylock(&lock->mLock);
+    if (lockprofile_sample()) {
+        lockprofile_record(lock, caller ?: __builtin_return_address(0), 
+                           locked ? LOCKPROFILE_ACQUIRED : LOCKPROFILE_FAILED, 
+                           0);
+    }
+    return locked;
+}
+
+
+/***********************************************************************
+* objc_copyLockProfile
+* Returns the profile so far, most wait time first, with counts scaled 
+* up by the sampling interval. Samples being recorded concurrently 
+* may be partly included.
+* Locking: none
+**********************************************************************/
+static int compareLockProfiles(const void *a, const void *b)
+{
+    const objc_lock_profile_t *pa = (const objc_lock_profile_t *)a;
+    const objc_lock_profile_t *pb = (const objc_lock_profile_t *)b;
+    if (pa->waitNanoseconds != pb->waitNanoseconds) {
+        return (pa->waitNanoseconds < pb->waitNanoseconds) ? 1 : -1;
+    }
+    return (pa->acquisitions < pb->acquisitions) ? 1 : 
+        (pa->acquisitions > pb->acquisitions) ? -1 : 0;
+}
+
+objc_lock_profile_t *
+objc_copyLockProfile(unsigned int *outCount)
+{
+    if (!lockprofile_enabled) {
+        if (outCount) *outCount = 0;
+        return nil;
+    }
+
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+
+    // Entries may be claimed while we look. Count them first, 
+    // and ignore any that appear after that.
+    unsigned int capacity = 0;
+    for (size_t i = 0; i < LOCKPROFILE_CAPACITY; i++) {
+        if (lockprofile_table[i].lock) capacity++;
+    }
+
+    objc_lock_profile_t *result = nil;
+    unsigned int count = 0;
+    if (capacity) {
+        result = (objc_lock_profile_t *)
+            calloc(capacity, sizeof(objc_lock_profile_t));
+    }
+
+    for (size_t i = 0; i < LOCKPROFILE_CAPACITY  &&  count < capacity; i++) {
+        lockprofile_entry_t *entry = &lockprofile_table[i];
+        if (!entry->lock) continue;
+
+        objc_lock_profile_t *p = &result[count++];
+        p->lock = entry->lock;
+        p->name = lockprofile_nameForLock(entry->lock, &p->offset);
+        p->acquisitions = entry->samples * lockprofile_interval;
+        p->contended = entry->contended * lockprofile_interval;
+        p->failedTrylocks = entry->failedTrylocks * lockprofile_interval;
+        p->waitNanoseconds = entry->waitTime * lockprofile_interval 
+            * timebase.numer / timebase.denom;
+
+        lockprofile_caller_t callers[OBJC_LOCK_PROFILE_CALLERS];
+        memcpy(callers, entry->callers, sizeof(callers));
+        for (unsigned int c = 0; c < countof(callers); c++) {
+            // Selection sort, hottest first.
+            for (unsigned int d = c + 1; d < countof(callers); d++) {
+                if (lockprofile_hotter(&callers[d], &callers[c])) {
+                    lockprofile_caller_t tmp = callers[c];
+                    callers[c] = callers[d];
+                    callers[d] = tmp;
+                }
+            }
+            p->callers[c] = callers[c].pc;
+        }
+    }
+
+    if (count) {
+        qsort(result, count, sizeof(result[0]), &compareLockProfiles);
+    }
+
+    if (outCount) *outCount = count;
+    return result;
+}
+
+
+/***********************************************************************
+* _objc_printLockProfile
+* Logs the hottest locks and their callers. 
+* Called at exit when OBJC_PROFILE_LOCKS is set.
+**********************************************************************/
+void _objc_printLockProfile(void)
+{
+    if (!lockprofile_enabled) {
+        _objc_inform("LOCKS: profiling is off; set OBJC_PROFILE_LOCKS");
+        return;
+    }
+
+    unsigned int count;
+    objc_lock_profile_t *profile = objc_copyLockProfile(&count);
+    _objc_inform("LOCKS: %u locks sampled, one in %u acquisitions", 
+                 count, lockprofile_interval);
+    if (lockprofile_dropped) {
+        _objc_inform("LOCKS: %llu samples dropped; more than %u locks", 
+                     lockprofile_dropped, LOCKPROFILE_CAPACITY);
+    }
+
+    for (unsigned int i = 0; i < count  &&  i < 32; i++) {
+        objc_lock_profile_t *p = &profile[i];
+        _objc_inform("LOCKS: %s+%#zx (%p): %llu acquisitions, "
+                     "%llu contended, %llu failed trylocks, %.3f ms waiting", 
+                     p->name ?: "spinlock", p->offset, p->lock, 
+                     p->acquisitions, p->contended, p->failedTrylocks, 
+                     p->waitNanoseconds / 1000000.0);
+        for (unsigned int c = 0; c < countof(p->callers); c++) {
+            if (!p->callers[c]) break;
+            Dl_info info;
+            if (dladdr(p->callers[c], &info)  &&  info.dli_sname) {
+                _objc_inform("LOCKS:     %s+%#lx", info.dli_sname, 
+                             (uintptr_t)p->callers[c] - (uintptr_t)info.dli_saddr);
+            } else {
+                _objc_inform("LOCKS:     %p", p->callers[c]);
+            }
+        }
+    }
+
+    free(profile);
+}
+
+
+void lockprofile_init(void)
+{
+    if (!ProfileLocks) return;
+
+    // OBJC_PROFILE_LOCKS=YES samples every acquisition.
+    lockprofile_interval = (unsigned int)numericOption(ProfileLocks, 1);
+    if (lockprofile_interval == 0) return;
+
+    lockprofile_table = (lockprofile_entry_t *)
+        calloc(LOCKPROFILE_CAPACITY, sizeof(lockprofile_entry_t));
+    lockprofile_tls = tls_create(nil);
+    atexit(&_objc_printLockProfile);
+
+    OSMemoryBarrier();
+    lockprofile_enabled = true;
+}
+
+#endif
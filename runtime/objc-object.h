@@ -131,6 +131,13 @@ objc_object::initInstanceIsa(Class cls, bool hasCxxDtor)
     assert(!cls->requiresRawIsa());
     assert(hasCxxDtor == cls->hasCxxDtor());
 
+    if (__builtin_expect(biasedrc_enabled, 0)  &&  
+        biasedrc_initInstance(cls))
+    {
+        // Biased objects have a raw isa. See biasedrc_initInstance().
+        return;
+    }
+
     initIsa(cls, true, hasCxxDtor);
 }
 
@@ -309,6 +316,14 @@ objc_object::clearDeallocating()
 }
 
 
+// True if this thread is inside objc_deallocBatchPush().
+static inline bool
+deallocBatchActive()
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(false);
+    return data  &&  data->deallocBatch;
+}
+
 inline void
 objc_object::rootDealloc()
 {
@@ -324,6 +339,10 @@ objc_object::rootDealloc()
         assert(!sidetable_present());
         free(this);
     } 
+    else if (__builtin_expect(deallocBatchActive(), 0)) {
+        // Inside objc_deallocBatchPush(). Free later.
+        rootDealloc_batched();
+    }
     else {
         object_dispose((id)this);
     }
@@ -358,13 +377,20 @@ objc_object::retain()
 ALWAYS_INLINE id 
 objc_object::rootRetain()
 {
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RETAIN, __builtin_return_address(0));
+    }
     return rootRetain(false, false);
 }
 
 ALWAYS_INLINE bool 
 objc_object::rootTryRetain()
 {
-    return rootRetain(true, false) ? true : false;
+    if (!rootRetain(true, false)) return false;
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RETAIN, __builtin_return_address(0));
+    }
+    return true;
 }
 
 ALWAYS_INLINE id 
@@ -416,6 +442,9 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
 
  unindexed:
     if (!tryRetain && sideTableLocked) sidetable_unlock();
+    if (__builtin_expect(biasedrc_enabled, 0)  &&  biasedrc_retainOwned()) {
+        return (id)this;
+    }
     if (tryRetain) return sidetable_tryRetain() ? (id)this : nil;
     else return sidetable_retain();
 }
@@ -451,12 +480,18 @@ objc_object::release()
 ALWAYS_INLINE bool 
 objc_object::rootRelease()
 {
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RELEASE, __builtin_return_address(0));
+    }
     return rootRelease(true, false);
 }
 
 ALWAYS_INLINE bool 
 objc_object::rootReleaseShouldDealloc()
 {
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RELEASE, __builtin_return_address(0));
+    }
     return rootRelease(false, false);
 }
 
@@ -574,6 +609,10 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
 
  unindexed:
     if (sideTableLocked) sidetable_unlock();
+    if (__builtin_expect(biasedrc_enabled, 0)) {
+        bool result;
+        if (biasedrc_releaseOwned(performDealloc, &result)) return result;
+    }
     return sidetable_release(performDealloc);
 }
 
@@ -601,6 +640,9 @@ objc_object::rootAutorelease()
     if (isTaggedPointer()) return (id)this;
     if (prepareOptimizedReturn(ReturnAtPlus1)) return (id)this;
 
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_AUTORELEASE, __builtin_return_address(0));
+    }
     return rootAutorelease2();
 }
 
@@ -811,6 +853,9 @@ objc_object::retain()
     assert(!isTaggedPointer());
 
     if (! ISA()->hasCustomRR()) {
+        if (__builtin_expect(rrtrace_enabled, 0)) {
+            rrtrace(OBJC_RR_TRACE_RETAIN, __builtin_return_address(0));
+        }
         return sidetable_retain();
     }
 
@@ -827,6 +872,9 @@ objc_object::rootRetain()
     assert(!UseGC);
 
     if (isTaggedPointer()) return (id)this;
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RETAIN, __builtin_return_address(0));
+    }
     return sidetable_retain();
 }
 
@@ -840,6 +888,9 @@ objc_object::release()
     assert(!isTaggedPointer());
 
     if (! ISA()->hasCustomRR()) {
+        if (__builtin_expect(rrtrace_enabled, 0)) {
+            rrtrace(OBJC_RR_TRACE_RELEASE, __builtin_return_address(0));
+        }
         sidetable_release();
         return;
     }
@@ -859,6 +910,9 @@ objc_object::rootRelease()
     assert(!UseGC);
 
     if (isTaggedPointer()) return false;
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RELEASE, __builtin_return_address(0));
+    }
     return sidetable_release(true);
 }
 
@@ -866,6 +920,9 @@ inline bool
 objc_object::rootReleaseShouldDealloc()
 {
     if (isTaggedPointer()) return false;
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RELEASE, __builtin_return_address(0));
+    }
     return sidetable_release(false);
 }
 
@@ -893,6 +950,9 @@ objc_object::rootAutorelease()
     if (isTaggedPointer()) return (id)this;
     if (prepareOptimizedReturn(ReturnAtPlus1)) return (id)this;
 
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_AUTORELEASE, __builtin_return_address(0));
+    }
     return rootAutorelease2();
 }
 
@@ -906,7 +966,11 @@ objc_object::rootTryRetain()
     assert(!UseGC);
 
     if (isTaggedPointer()) return true;
-    return sidetable_tryRetain();
+    if (!sidetable_tryRetain()) return false;
+    if (__builtin_expect(rrtrace_enabled, 0)) {
+        rrtrace(OBJC_RR_TRACE_RETAIN, __builtin_return_address(0));
+    }
+    return true;
 }
 
 
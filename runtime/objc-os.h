@@ -220,14 +220,53 @@ StoreReleaseExclusive(uintptr_t *dst, uintptr_t oldvalue, uintptr_t value)
 #endif
 
 
+// Spinlock profiling for OBJC_PROFILE_LOCKS. See objc-lockdebug.mm.
+// Only acquisitions are profiled, so unlock() never checks.
+class spinlock_t;
+extern bool lockprofile_enabled;
+extern void lockprofile_lock(spinlock_t *lock);
+extern void lockprofile_lockContended(spinlock_t *lock, void *caller);
+extern bool lockprofile_trylock(spinlock_t *lock, void *caller);
+
 class spinlock_t {
     os_lock_handoff_s mLock;
+
+    friend void lockprofile_lock(spinlock_t *lock);
+    friend void lockprofile_lockContended(spinlock_t *lock, void *caller);
+    friend bool lockprofile_trylock(spinlock_t *lock, void *caller);
+
  public:
     spinlock_t() : mLock(OS_LOCK_HANDOFF_INIT) { }
     
-    void lock() { os_lock_lock(&mLock); }
+    void lock() { 
+        if (__builtin_expect(lockprofile_enabled, 0)) {
+            return lockprofile_lock(this);
+        }
+        os_lock_lock(&mLock); 
+    }
     void unlock() { os_lock_unlock(&mLock); }
-    bool trylock() { return os_lock_trylock(&mLock); }
+    bool trylock() { 
+        if (__builtin_expect(lockprofile_enabled, 0)) {
+            return lockprofile_trylock(this, nil);
+        }
+        return os_lock_trylock(&mLock); 
+    }
+
+    // trylock() and lock() for lock wrappers that are not inlined. 
+    // caller is the wrapper's call site, for the lock profile.
+    // lockContended() is for use after trylock(caller) failed.
+    bool trylock(void *caller) {
+        if (__builtin_expect(lockprofile_enabled, 0)) {
+            return lockprofile_trylock(this, caller);
+        }
+        return os_lock_trylock(&mLock); 
+    }
+    void lockContended(void *caller) {
+        if (__builtin_expect(lockprofile_enabled, 0)) {
+            return lockprofile_lockContended(this, caller);
+        }
+        os_lock_lock(&mLock); 
+    }
 
 
     // Address-ordered lock discipline for a pair of locks.
@@ -375,6 +414,9 @@ extern void _objc_fatal(const char *fmt, ...) __attribute__((noreturn, format (p
 # if SUPPORT_QOS_HACK
 #   define QOS_KEY               ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY5)
 # endif
+# if SUPPORT_NONPOINTER_ISA
+#   define BIASED_OWNER_KEY      ((tls_key_t)__PTK_FRAMEWORK_OBJC_KEY6)
+# endif
 #else
 #   define SUPPORT_DIRECT_THREAD_KEYS 0
 #endif
@@ -685,6 +727,9 @@ static bool is_valid_direct_key(tls_key_t k) {
 #   endif
 #   if SUPPORT_QOS_HACK
             || k == QOS_KEY
+#   endif
+#   if SUPPORT_NONPOINTER_ISA
+            || k == BIASED_OWNER_KEY
 #   endif
                );
 }
@@ -821,7 +821,11 @@ void _objc_init(void)
     tls_init();
     static_init();
     lock_init();
+    lockprofile_init();
     exception_init();
+#if __OBJC2__
+    cache_init();
+#endif
         
     // Register for unmap first, in case some +load unmaps something
     _dyld_register_func_for_remove_image(&unmap_image);
@@ -55,6 +55,9 @@ namespace {
     struct SideTable;
 };
 
+struct BiasedOwner;
+struct BiasedCount;
+
 
 union isa_t 
 {
@@ -179,11 +182,27 @@ public:
     bool rootReleaseShouldDealloc();
     uintptr_t rootRetainCount();
 
+    // Implementations of objc_retainBatch() and objc_releaseBatch()
+    static void rootRetainBatch(id *objs, size_t count);
+    static void rootReleaseBatch(id *objs, size_t count);
+
+    // Retain count tracing; see _class_setTracesRetainCounts()
+    void rrtrace(uint32_t op, void *caller);
+
     // Implementation of dealloc methods
     bool rootIsDeallocating();
     void clearDeallocating();
     void rootDealloc();
 
+#if SUPPORT_NONPOINTER_ISA
+    // Unbias a thread's objects at autorelease pool pop and thread exit
+    static void biasedrc_handOff(BiasedOwner *owner, bool all);
+
+    // Retain for objc_loadWeakRetained() without the side table lock.
+    // Returns false if the caller must take the lock instead.
+    bool rootTryRetainLockFree(id *result);
+#endif
+
 private:
     void initIsa(Class newCls, bool indexed, bool hasCxxDtor);
 
@@ -199,6 +218,8 @@ private:
     bool rootRelease_underflow(bool performDealloc);
 
     void clearDeallocating_slow();
+    bool clearDeallocating_slow_nolock(SideTable& table);
+    void rootDealloc_batched();
 
     // Side table retain count overflow for nonpointer isa
     void sidetable_lock();
@@ -208,20 +229,32 @@ private:
     bool sidetable_addExtraRC_nolock(size_t delta_rc);
     size_t sidetable_subExtraRC_nolock(size_t delta_rc);
     size_t sidetable_getExtraRC_nolock();
+    bool sidetable_retainOverflow(bool tryRetain, id *result);
+
+    // Biased retain counts for objects owned by one thread
+    bool biasedrc_initInstance(Class cls);
+    bool biasedrc_retainOwned();
+    bool biasedrc_releaseOwned(bool performDealloc, bool *result);
+    bool biasedrc_unbias(BiasedOwner *owner, BiasedCount *c, bool all);
+    bool biasedrc_addDebt_nolock(SideTable& table);
+    uintptr_t biasedrc_retainCount_nolock(SideTable& table, uintptr_t rc);
 #endif
 
     // Side-table-only retain count
     bool sidetable_isDeallocating();
     void sidetable_clearDeallocating();
+    bool sidetable_clearDeallocating_nolock(SideTable& table);
 
     bool sidetable_isWeaklyReferenced();
     void sidetable_setWeaklyReferenced_nolock();
 
     id sidetable_retain();
     id sidetable_retain_slow(SideTable& table);
+    void sidetable_retain_nolock(SideTable& table);
 
     uintptr_t sidetable_release(bool performDealloc = true);
     uintptr_t sidetable_release_slow(SideTable& table, bool performDealloc = true);
+    bool sidetable_release_nolock(SideTable& table);
 
     bool sidetable_tryRetain();
 
@@ -502,6 +535,12 @@ extern char *copyPropertyAttributeValue(const char *attrs, const char *name);
 
 /* locking */
 extern void lock_init(void);
+#if !TARGET_OS_WIN32
+extern void lockprofile_init(void);
+extern void lockprofile_name(const void *start, size_t size, const char *name);
+#else
+static inline void lockprofile_name(const void *, size_t, const char *) { }
+#endif
 extern rwlock_t selLock;
 extern mutex_t cacheUpdateLock;
 extern recursive_mutex_t loadMethodLock;
@@ -512,6 +551,14 @@ extern mutex_t classLock;
 extern mutex_t methodListLock;
 #endif
 
+/* method caches */
+#if __OBJC2__
+extern void cache_init(void);
+extern void cache_quiescent(void);
+extern void cache_miss(Class cls);
+extern void cache_prewarmFromProfile(Class cls);
+#endif
+
 class monitor_locker_t : nocopy_t {
     monitor_t& lock;
   public:
@@ -641,10 +688,13 @@ extern bool _objc_dumpHeap(auto_zone_t *zone, const char *filename);
 
 // Settings from environment variables
 #define OPTION(var, env, help) extern bool var;
+#define VALUE_OPTION(var, env, help) extern const char *var;
 #include "objc-env.h"
 #undef OPTION
+#undef VALUE_OPTION
 
 extern void environ_init(void);
+extern unsigned long numericOption(const char *value, unsigned long defaultValue);
 
 extern void logReplacedMethod(const char *className, SEL s, bool isMeta, const char *catName, IMP oldImp, IMP newImp);
 
@@ -655,6 +705,17 @@ typedef struct {
     struct SyncCache *syncCache;  // for @synchronize
     struct alt_handler_list *handlerList;  // for exception alt handlers
     char *printableNames[4];  // temporary demangled names for logging
+#if __OBJC2__
+    struct cache_reader_t *cacheReader;  // for method cache reclamation
+#endif
+    struct rrtrace_buffer_t *rrTraceBuffer;  // for retain count tracing
+#if SUPPORT_NONPOINTER_ISA
+    struct weak_reader_t *weakReader;  // for lock-free weak loads
+    struct DeallocBatch *deallocBatch;  // for objc_deallocBatchPush()
+#endif
+#if !TARGET_OS_WIN32
+    struct association_reader_t *associationReader;  // for lock-free associations
+#endif
 
     // If you add new fields here, don't forget to update 
     // _objc_pthread_destroyspecific()
@@ -678,6 +739,17 @@ extern void _destroySyncCache(struct SyncCache *cache);
 
 // arr
 extern void arr_init(void);
+#if SUPPORT_NONPOINTER_ISA
+extern bool biasedrc_enabled;
+extern void weak_reader_threadExit(struct weak_reader_t *rec);
+extern void deallocBatch_threadExit(struct DeallocBatch *batch);
+#endif
+extern bool rrtrace_enabled;
+extern void rrtrace_threadExit(struct rrtrace_buffer_t *buffer);
+#if SUPPORT_NONPOINTER_ISA
+extern void weak_reader_threadExit(struct weak_reader_t *rec);
+extern void deallocBatch_threadExit(struct DeallocBatch *batch);
+#endif
 extern id objc_autoreleaseReturnValue(id obj);
 
 // block trampolines
@@ -835,45 +907,82 @@ class TimeLogger {
 // for cache-friendly lock striping. 
 // For example, this may be used as StripedMap<spinlock_t>
 // or as StripedMap<SomeStruct> where SomeStruct stores a spin lock.
-template<typename T>
-class StripedMap {
-
-    enum { CacheLineSize = 64 };
-
+// 
+// The stripe count is a power of two chosen when the map is 
+// constructed, up to MaxStripeCount. Only the stripes in use are 
+// constructed, so unused stripes cost address space but no memory.
 #if TARGET_OS_EMBEDDED
-    enum { StripeCount = 8 };
+enum { StripedMapDefaultStripeCount = 8 };
 #else
-    enum { StripeCount = 64 };
+enum { StripedMapDefaultStripeCount = 64 };
 #endif
 
+template<typename T, unsigned int MaxStripeCount = StripedMapDefaultStripeCount>
+class StripedMap {
+
+    enum { CacheLineSize = 64 };
+
     struct PaddedT {
         T value alignas(CacheLineSize);
     };
 
-    PaddedT array[StripeCount];
+    unsigned int stripeMask;
+    unsigned int stripeShift;
+    alignas(PaddedT) uint8_t storage[MaxStripeCount * sizeof(PaddedT)];
+
+    PaddedT *array() { return reinterpret_cast<PaddedT *>(storage); }
 
-    static unsigned int indexForPointer(const void *p) {
-        uintptr_t addr = reinterpret_cast<uintptr_t>(p);
-        return ((addr >> 4) ^ (addr >> 9)) % StripeCount;
+    unsigned int indexForPointer(const void *p) const {
+        // Fibonacci hashing. The multiply mixes every address bit 
+        // into the high bits of the product, which pick the stripe.
+        // The low 4 bits are always zero for malloc blocks.
+#if __LP64__
+        const uintptr_t multiplier = 0x9e3779b97f4a7c15ULL;
+#else
+        const uintptr_t multiplier = 0x9e3779b9U;
+#endif
+        uintptr_t addr = reinterpret_cast<uintptr_t>(p) >> 4;
+        return (unsigned int)((addr * multiplier) >> stripeShift) & stripeMask;
     }
 
  public:
-    T& operator[] (const void *p) { 
-        return array[indexForPointer(p)].value; 
-    }
-    const T& operator[] (const void *p) const { 
-        return const_cast<StripedMap<T>>(this)[p]; 
-    }
+    // name identifies these locks in OBJC_PROFILE_LOCKS output.
+    StripedMap(const char *name, unsigned int stripeCount = MaxStripeCount) {
+        assert(stripeCount > 0  &&  stripeCount <= MaxStripeCount);
+        assert((stripeCount & (stripeCount - 1)) == 0);
+        stripeMask = stripeCount - 1;
+        // Keep the shift below WORD_BITS even for a single stripe.
+        stripeShift = WORD_BITS - (stripeCount > 1 ? log2u(stripeCount) : 1);
+        for (unsigned int i = 0; i < stripeCount; i++) {
+            new (&array()[i]) PaddedT();
+        }
+        lockprofile_name(storage, sizeof(storage), name);
 
 #if DEBUG
-    StripedMap() {
         // Verify alignment expectations.
-        uintptr_t base = (uintptr_t)&array[0].value;
-        uintptr_t delta = (uintptr_t)&array[1].value - base;
+        uintptr_t base = (uintptr_t)&array()[0].value;
+        uintptr_t delta = (uintptr_t)&array()[1].value - base;
         assert(delta % CacheLineSize == 0);
         assert(base % CacheLineSize == 0);
-    }
 #endif
+    }
+
+    unsigned int stripeCount() const { 
+        return stripeMask + 1; 
+    }
+
+    T& operator[] (const void *p) { 
+        return array()[indexForPointer(p)].value; 
+    }
+    const T& operator[] (const void *p) const { 
+        return const_cast<StripedMap *>(this)->operator[](p); 
+    }
+
+    // For iterating over every stripe, 0 <= i < stripeCount().
+    T& stripeAtIndex(unsigned int i) {
+        assert(i < stripeCount());
+        return array()[i].value;
+    }
 };
 
 
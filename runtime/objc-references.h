@@ -35,6 +35,9 @@ __BEGIN_DECLS
 extern void _object_set_associative_reference(id object, void *key, id value, uintptr_t policy);
 extern id _object_get_associative_reference(id object, void *key);
 extern void _object_remove_assocations(id object);
+#if !TARGET_OS_WIN32
+extern void association_reader_threadExit(struct association_reader_t *rec);
+#endif
 
 __END_DECLS
 
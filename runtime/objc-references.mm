@@ -166,15 +166,16 @@ namespace objc_references_support {
     };
 
 #if TARGET_OS_WIN32
-    typedef hash_map<void *, ObjcAssociation> ObjectAssociationMap;
-    typedef hash_map<disguised_ptr_t, ObjectAssociationMap *> AssociationsHashMap;
+    typedef hash_map<void *, ObjcAssociation> HashedAssociationMap;
+    typedef hash_map<disguised_ptr_t, class ObjectAssociationMap *> AssociationsHashMap;
 #else
-    typedef ObjcAllocator<std::pair<void * const, ObjcAssociation> > ObjectAssociationMapAllocator;
-    class ObjectAssociationMap : public std::map<void *, ObjcAssociation, ObjectPointerLess, ObjectAssociationMapAllocator> {
+    typedef ObjcAllocator<std::pair<void * const, ObjcAssociation> > HashedAssociationMapAllocator;
+    class HashedAssociationMap : public unordered_map<void *, ObjcAssociation, ObjcPointerHash, std::equal_to<void *>, HashedAssociationMapAllocator> {
     public:
         void *operator new(size_t n) { return ::malloc(n); }
         void operator delete(void *ptr) { ::free(ptr); }
     };
+    class ObjectAssociationMap;
     typedef ObjcAllocator<std::pair<const disguised_ptr_t, ObjectAssociationMap*> > AssociationsHashMapAllocator;
     class AssociationsHashMap : public unordered_map<disguised_ptr_t, ObjectAssociationMap *, DisguisedPointerHash, DisguisedPointerEqual, AssociationsHashMapAllocator> {
     public:
@@ -182,31 +183,189 @@ namespace objc_references_support {
         void operator delete(void *ptr) { ::free(ptr); }
     };
 #endif
+
+    // The associations of one object, key -> association.
+    // Most objects have only a few, so they live in a small unsorted 
+    // array, inline in the map at first, and lookups scan it. 
+    // An object with more than FlatCapacity switches to a hash table.
+    class ObjectAssociationMap {
+        struct Entry {
+            void *key;
+            ObjcAssociation association;
+        };
+        enum { InlineCapacity = 4, FlatCapacity = 16 };
+
+        uint32_t _count;                // entries in the array
+        uint32_t _capacity;
+        Entry *_entries;                // _inline or malloc'd
+        HashedAssociationMap *_hashed;  // replaces the array if not nil
+        Entry _inline[InlineCapacity];
+
+        void grow() {
+            if (_capacity < FlatCapacity) {
+                Entry *entries = (Entry *)malloc(_capacity * 2 * sizeof(Entry));
+                memcpy(entries, _entries, _count * sizeof(Entry));
+                if (_entries != _inline) free(_entries);
+                _entries = entries;
+                _capacity *= 2;
+            } else {
+                _hashed = new HashedAssociationMap;
+                for (uint32_t i = 0; i < _count; i++) {
+                    (*_hashed)[_entries[i].key] = _entries[i].association;
+                }
+                if (_entries != _inline) free(_entries);
+                _entries = _inline;
+                _capacity = InlineCapacity;
+                _count = 0;
+            }
+        }
+
+    public:
+        ObjectAssociationMap() 
+            : _count(0), _capacity(InlineCapacity), 
+              _entries(_inline), _hashed(nil) { }
+        ~ObjectAssociationMap() {
+            if (_entries != _inline) free(_entries);
+            delete _hashed;
+        }
+        void *operator new(size_t n) { return ::malloc(n); }
+        void operator delete(void *ptr) { ::free(ptr); }
+
+        ObjcAssociation *find(void *key) {
+            if (_hashed) {
+                HashedAssociationMap::iterator i = _hashed->find(key);
+                return (i != _hashed->end()) ? &i->second : nil;
+            }
+            for (uint32_t i = 0; i < _count; i++) {
+                if (_entries[i].key == key) return &_entries[i].association;
+            }
+            return nil;
+        }
+
+        // key must not be in the map already.
+        void insert(void *key, const ObjcAssociation& association) {
+            if (!_hashed  &&  _count == _capacity) grow();
+            if (_hashed) {
+                (*_hashed)[key] = association;
+                return;
+            }
+            _entries[_count].key = key;
+            _entries[_count].association = association;
+            _count++;
+        }
+
+        // Returns false if key is not in the map.
+        bool erase(void *key, ObjcAssociation *old) {
+            if (_hashed) {
+                HashedAssociationMap::iterator i = _hashed->find(key);
+                if (i == _hashed->end()) return false;
+                *old = i->second;
+                _hashed->erase(i);
+                return true;
+            }
+            for (uint32_t i = 0; i < _count; i++) {
+                if (_entries[i].key == key) {
+                    *old = _entries[i].association;
+                    _entries[i] = _entries[--_count];
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Calls visitor(key, association) for every association.
+        template <typename Visitor> void forEach(Visitor &visitor) {
+            if (_hashed) {
+                for (HashedAssociationMap::iterator i = _hashed->begin(), end = _hashed->end(); i != end; ++i) {
+                    visitor(i->first, i->second);
+                }
+                return;
+            }
+            for (uint32_t i = 0; i < _count; i++) {
+                visitor(_entries[i].key, _entries[i].association);
+            }
+        }
+
+        template <typename Vector> void copyAssociations(Vector &elements) {
+            if (_hashed) {
+                for (HashedAssociationMap::iterator i = _hashed->begin(), end = _hashed->end(); i != end; ++i) {
+                    elements.push_back(i->second);
+                }
+                return;
+            }
+            for (uint32_t i = 0; i < _count; i++) {
+                elements.push_back(_entries[i].association);
+            }
+        }
+    };
 }
 
 using namespace objc_references_support;
 
-// class AssociationsManager manages a lock / hash table singleton pair.
-// Allocating an instance acquires the lock, and calling its assocations() method
-// lazily allocates it.
+#if !TARGET_OS_WIN32
+#   define SUPPORT_LOCKFREE_ASSOCIATIONS 1
+#else
+#   define SUPPORT_LOCKFREE_ASSOCIATIONS 0
+#endif
+
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+// Open-addressed index of all of a stripe's associations.
+// See "Lock-free association reads" below.
+struct AssociationIndexEntry {
+    disguised_ptr_t object;     // 0 if empty
+    void *key;
+    id value;
+    uintptr_t policy;
+};
+
+struct AssociationIndex {
+    uintptr_t mask;
+    uintptr_t count;
+    AssociationIndexEntry entries[0];
+};
+#endif
+
+// class AssociationsManager manages the lock / hash table pair of the 
+// stripe that holds an object's associations. Allocating an instance 
+// acquires the stripe's lock, and calling its assocations() method 
+// lazily allocates the stripe's table.
+// Objects are spread across stripes by address, so threads working 
+// on unrelated objects rarely contend.
+
+struct AssociationsStripe {
+    spinlock_t lock;
+    AssociationsHashMap *map;   // associative references:  object pointer -> ObjectAssociationMap.
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+    AssociationIndex *index;    // same associations, for lock-free readers
+    uintptr_t seq;              // odd while index is being written
+#endif
+
+    AssociationsStripe() : map(nil) {
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+        index = nil;
+        seq = 0;
+#endif
+    }
+};
+
+static StripedMap<AssociationsStripe> AssociationsStripes("Associations");
 
 class AssociationsManager {
-    static spinlock_t _lock;
-    static AssociationsHashMap *_map;               // associative references:  object pointer -> PtrPtrHashMap.
+    AssociationsStripe &_stripe;
 public:
-    AssociationsManager()   { _lock.lock(); }
-    ~AssociationsManager()  { _lock.unlock(); }
+    AssociationsManager(id object) 
+        : _stripe(AssociationsStripes[object]) { _stripe.lock.lock(); }
+    ~AssociationsManager()  { _stripe.lock.unlock(); }
+
+    AssociationsStripe &stripe() { return _stripe; }
     
     AssociationsHashMap &associations() {
-        if (_map == NULL)
-            _map = new AssociationsHashMap();
-        return *_map;
+        if (_stripe.map == NULL)
+            _stripe.map = new AssociationsHashMap();
+        return *_stripe.map;
     }
 };
 
-spinlock_t AssociationsManager::_lock;
-AssociationsHashMap *AssociationsManager::_map = NULL;
-
 // expanded policy bits.
 
 enum { 
@@ -218,24 +377,524 @@ enum {
     OBJC_ASSOCIATION_GETTER_AUTORELEASE = (2 << 8)
 }; 
 
+
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+/***********************************************************************
+* Lock-free association reads.
+* Each stripe also keeps all of its associations in an AssociationIndex, 
+* an open-addressed table updated under the stripe lock. Readers probe 
+* it without the lock and retry with the lock if the stripe's sequence 
+* number changed meanwhile. Only associations whose getter just reads 
+* the value (OBJC_ASSOCIATION_ASSIGN, OBJC_ASSOCIATION_RETAIN_NONATOMIC, 
+* OBJC_ASSOCIATION_COPY_NONATOMIC) are answered this way; the atomic 
+* getter's retain must not race with the setter's release.
+* 
+* The index is the only place a nonatomic association's value is kept. 
+* The object's ObjectAssociationMap records its key and policy with a 
+* nil value. Atomic values are kept only in the ObjectAssociationMap; 
+* their index entries have a nil value and send readers to the lock.
+* 
+* A reader publishes the index it is probing as the hazard in its 
+* association_reader_t. A writer that replaces the index waits, after 
+* dropping the stripe lock, until no hazard is the old index before 
+* freeing it.
+* 
+* Records are never freed; a terminated thread's record is reused.
+**********************************************************************/
+enum { AssociationIndexInitialCapacity = 16 };
+
+struct association_reader_t {
+    association_reader_t *next;
+    const void *hazard;         // an AssociationIndex or InlineAssociations
+    int32_t active;
+};
+
+static association_reader_t * volatile association_readers = nil;
+
+static association_reader_t *association_reader_self(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    association_reader_t *rec = data->associationReader;
+    if (rec) return rec;
+
+    // Reuse a dead thread's record, or push a new one.
+    for (rec = association_readers; rec; rec = rec->next) {
+        if (!rec->active  &&  
+            OSAtomicCompareAndSwap32Barrier(0, 1, &rec->active)) 
+        {
+            break;
+        }
+    }
+    if (!rec) {
+        rec = (association_reader_t *)calloc(1, sizeof(association_reader_t));
+        rec->active = 1;
+        do {
+            rec->next = association_readers;
+        } while (!OSAtomicCompareAndSwapPtrBarrier(rec->next, rec, 
+                                 (void * volatile *)&association_readers));
+    }
+
+    data->associationReader = rec;
+    return rec;
+}
+
+// Called by _objc_pthread_destroyspecific().
+void association_reader_threadExit(association_reader_t *rec)
+{
+    assert(rec->hazard == nil);
+    OSMemoryBarrier();
+    rec->active = 0;
+}
+
+// Called after ptr is unpublished and before it is freed.
+static void association_waitForReaders(const void *ptr)
+{
+    // Order the unpublishing store before the hazard loads.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (association_reader_t *rec = association_readers; rec; rec = rec->next) {
+        while (__atomic_load_n(&rec->hazard, __ATOMIC_ACQUIRE) == ptr) {
+            sched_yield();
+        }
+    }
+}
+
+// Called after index is unpublished, without the stripe lock.
+static void association_index_retire(AssociationIndex *index)
+{
+    association_waitForReaders(index);
+    free(index);
+}
+
+// True if the association's value is kept in the index.
+static inline bool association_valueInIndex(uintptr_t policy)
+{
+    return !(policy & (OBJC_ASSOCIATION_GETTER_RETAIN | 
+                       OBJC_ASSOCIATION_GETTER_AUTORELEASE));
+}
+
+static inline uintptr_t 
+association_index_hash(disguised_ptr_t object, void *key)
+{
+    return DisguisedPointerHash()(object ^ (uintptr_t)key);
+}
+
+// Every change to a stripe's index is bracketed by these.
+// The stripe lock must be held.
+static void association_index_beginWrite(AssociationsStripe &stripe)
+{
+    __atomic_fetch_add(&stripe.seq, 1, __ATOMIC_SEQ_CST);
+}
+
+static void association_index_endWrite(AssociationsStripe &stripe)
+{
+    __atomic_fetch_add(&stripe.seq, 1, __ATOMIC_RELEASE);
+}
+
+static inline void 
+association_index_storeEntry(AssociationIndexEntry *entry, 
+                             disguised_ptr_t object, void *key, 
+                             id value, uintptr_t policy)
+{
+    __atomic_store_n(&entry->object, object, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->key, key, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&entry->policy, policy, __ATOMIC_RELAXED);
+}
+
+// index must have room for one more entry.
+// Returns the entry's previous value, or nil if the entry is new.
+static id association_index_insert(AssociationIndex *index, 
+                                   disguised_ptr_t object, void *key, 
+                                   id value, uintptr_t policy)
+{
+    uintptr_t i = association_index_hash(object, key) & index->mask;
+    while (true) {
+        AssociationIndexEntry *entry = &index->entries[i];
+        if (entry->object == 0) {
+            index->count++;
+            association_index_storeEntry(entry, object, key, value, policy);
+            return nil;
+        }
+        if (entry->object == object  &&  entry->key == key) {
+            id old = entry->value;
+            __atomic_store_n(&entry->value, value, __ATOMIC_RELAXED);
+            __atomic_store_n(&entry->policy, policy, __ATOMIC_RELAXED);
+            return old;
+        }
+        i = (i + 1) & index->mask;
+    }
+}
+
+// The stripe lock must be held. Returns the entry's value, 
+// or nil if there is no entry.
+static id association_index_lookup(AssociationsStripe &stripe, 
+                                   disguised_ptr_t object, void *key)
+{
+    AssociationIndex *index = stripe.index;
+    if (!index) return nil;
+
+    uintptr_t i = association_index_hash(object, key) & index->mask;
+    while (true) {
+        AssociationIndexEntry *entry = &index->entries[i];
+        if (entry->object == 0) return nil;
+        if (entry->object == object  &&  entry->key == key) {
+            return entry->value;
+        }
+        i = (i + 1) & index->mask;
+    }
+}
+
+// Replaces the stripe's index with one twice as big.
+// Returns the old index for association_index_retire().
+static AssociationIndex *association_index_grow(AssociationsStripe &stripe)
+{
+    AssociationIndex *old = stripe.index;
+    uintptr_t capacity = old ? 2 * (old->mask + 1) 
+                             : AssociationIndexInitialCapacity;
+    AssociationIndex *index = (AssociationIndex *)
+        calloc(1, sizeof(AssociationIndex) + 
+                  capacity * sizeof(AssociationIndexEntry));
+    index->mask = capacity - 1;
+    if (old) {
+        for (uintptr_t i = 0; i <= old->mask; i++) {
+            AssociationIndexEntry *entry = &old->entries[i];
+            if (entry->object == 0) continue;
+            association_index_insert(index, entry->object, entry->key, 
+                                     entry->value, entry->policy);
+        }
+    }
+
+    __atomic_store_n(&stripe.index, index, __ATOMIC_RELEASE);
+    return old;
+}
+
+// Sets the entry's value, which is nil for atomic associations. 
+// Returns the entry's previous value. If the index was replaced, 
+// sets *retired to the old index; the caller must pass it to 
+// association_index_retire() after dropping the stripe lock.
+static id association_index_set(AssociationsStripe &stripe, 
+                                disguised_ptr_t object, void *key, 
+                                id value, uintptr_t policy, 
+                                AssociationIndex **retired)
+{
+    association_index_beginWrite(stripe);
+    AssociationIndex *index = stripe.index;
+    // Keep the load factor at or below 3/4.
+    if (!index  ||  4 * (index->count + 1) > 3 * (index->mask + 1)) {
+        *retired = association_index_grow(stripe);
+        index = stripe.index;
+    }
+    id old = association_index_insert(index, object, key, 
+                                      association_valueInIndex(policy) ? value : nil, 
+                                      policy);
+    association_index_endWrite(stripe);
+    return old;
+}
+
+// The stripe must be in a write.
+// Returns the entry's value, or nil if there was no entry.
+static id association_index_remove(AssociationsStripe &stripe, 
+                                   disguised_ptr_t object, void *key)
+{
+    AssociationIndex *index = stripe.index;
+    if (!index) return nil;
+
+    uintptr_t mask = index->mask;
+    uintptr_t hole = association_index_hash(object, key) & mask;
+    while (true) {
+        AssociationIndexEntry *entry = &index->entries[hole];
+        if (entry->object == 0) return nil;
+        if (entry->object == object  &&  entry->key == key) break;
+        hole = (hole + 1) & mask;
+    }
+    id value = index->entries[hole].value;
+
+    // Shift later entries of the run back into the hole so lookups 
+    // never need tombstones. An entry can move if its home slot is 
+    // not after the hole.
+    for (uintptr_t i = (hole + 1) & mask; ; i = (i + 1) & mask) {
+        AssociationIndexEntry *entry = &index->entries[i];
+        if (entry->object == 0) break;
+        uintptr_t home = association_index_hash(entry->object, entry->key) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            association_index_storeEntry(&index->entries[hole], 
+                                         entry->object, entry->key, 
+                                         entry->value, entry->policy);
+            hole = i;
+        }
+    }
+    association_index_storeEntry(&index->entries[hole], 0, nil, nil, 0);
+    index->count--;
+    return value;
+}
+
+// Removes each of an object's associations from the stripe's index, 
+// and collects them with their values for release.
+template <typename Vector> struct AssociationIndexRemover {
+    AssociationsStripe &stripe;
+    disguised_ptr_t object;
+    Vector &elements;
+
+    AssociationIndexRemover(AssociationsStripe &s, disguised_ptr_t o, 
+                            Vector &e) 
+        : stripe(s), object(o), elements(e) { }
+    void operator() (void *key, ObjcAssociation &association) {
+        id value = association_index_remove(stripe, object, key);
+        if (association_valueInIndex(association.policy())) {
+            elements.push_back(ObjcAssociation(association.policy(), value));
+        } else {
+            elements.push_back(association);
+        }
+    }
+};
+
+// Returns false if the caller must take the stripe lock instead.
+static bool association_getLockFree(id object, void *key, id *result)
+{
+    AssociationsStripe &stripe = AssociationsStripes[object];
+    uintptr_t seq = __atomic_load_n(&stripe.seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return false;
+    AssociationIndex *index = __atomic_load_n(&stripe.index, __ATOMIC_ACQUIRE);
+    if (!index) {
+        *result = nil;
+        return true;
+    }
+
+    association_reader_t *rec = association_reader_self();
+    __atomic_store_n(&rec->hazard, (const void *)index, __ATOMIC_SEQ_CST);
+    bool handled = false;
+    // If no write has started, the index can't be freed until we're done.
+    if (__atomic_load_n(&stripe.seq, __ATOMIC_SEQ_CST) == seq) {
+        disguised_ptr_t disguised_object = DISGUISE(object);
+        uintptr_t mask = index->mask;
+        uintptr_t i = association_index_hash(disguised_object, key) & mask;
+        bool found = false;
+        id value = nil;
+        uintptr_t policy = 0;
+        // Bounded, since a concurrent write can leave the probe 
+        // looking at a torn table.
+        for (uintptr_t n = 0; n <= mask; n++, i = (i + 1) & mask) {
+            AssociationIndexEntry *entry = &index->entries[i];
+            disguised_ptr_t entryObject = 
+                __atomic_load_n(&entry->object, __ATOMIC_RELAXED);
+            if (entryObject == 0) break;
+            if (entryObject == disguised_object  &&  
+                __atomic_load_n(&entry->key, __ATOMIC_RELAXED) == key) 
+            {
+                found = true;
+                value = __atomic_load_n(&entry->value, __ATOMIC_RELAXED);
+                policy = __atomic_load_n(&entry->policy, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+
+        // Discard what we read if a write started meanwhile.
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&stripe.seq, __ATOMIC_RELAXED) == seq) {
+            if (!found) {
+                *result = nil;
+                handled = true;
+            } else if (association_valueInIndex(policy)) {
+                *result = value;
+                handled = true;
+            }
+        }
+    }
+    __atomic_store_n(&rec->hazard, (const void *)nil, __ATOMIC_RELEASE);
+    return handled;
+}
+#endif
+
+
+/***********************************************************************
+* Inline associations.
+* Instances of classes set up by _class_setUsesInlineAssociations() 
+* have a hidden slot after their ivars that points to an immutable 
+* InlineAssociations list of the object's associations. Finding them 
+* is one load instead of two hash lookups, and removing them at 
+* dealloc doesn't touch the stripe's tables. The stripe lock still 
+* serializes writers.
+* 
+* Setters build a new list and publish it in the slot. Nonatomic 
+* getters read the list without the lock, publishing it as their 
+* hazard first like index readers do. The setter frees the old list 
+* after dropping the stripe lock, once no hazard is it.
+**********************************************************************/
+struct InlineAssociations {
+    uintptr_t count;
+
+    struct Entry {
+        void *key;
+        ObjcAssociation association;
+    };
+
+    Entry *entries() { return (Entry *)(this + 1); }
+
+    static InlineAssociations *create(uintptr_t count) {
+        InlineAssociations *list = (InlineAssociations *)
+            malloc(sizeof(InlineAssociations) + count * sizeof(Entry));
+        list->count = count;
+        return list;
+    }
+
+    ObjcAssociation *find(void *key) {
+        for (uintptr_t i = 0; i < count; i++) {
+            if (entries()[i].key == key) return &entries()[i].association;
+        }
+        return nil;
+    }
+};
+
+// Returns nil if object's class doesn't use inline associations.
+static inline InlineAssociations **inlineAssociationsSlot(id object)
+{
+#if __OBJC2__
+    if (object->isTaggedPointer()) return nil;
+    Class cls = object->ISA();
+    if (!cls->instancesHaveInlineAssociations()) return nil;
+    return (InlineAssociations **)
+        ((uint8_t *)object + cls->inlineAssociationsOffset());
+#else
+    return nil;
+#endif
+}
+
+// The stripe lock must be held. Returns the old list, if any, 
+// for inlineAssociations_retire().
+static InlineAssociations *
+inlineAssociations_replace(InlineAssociations **slot, 
+                           InlineAssociations *list)
+{
+    InlineAssociations *old = *slot;
+    __atomic_store_n(slot, list, __ATOMIC_RELEASE);
+    return old;
+}
+
+// Called after list is replaced, without the stripe lock.
+static void inlineAssociations_retire(InlineAssociations *list)
+{
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+    association_waitForReaders(list);
+#endif
+    free(list);
+}
+
+// Sets or, if association has no value, removes key's association.
+// The stripe lock must be held. Returns the replaced list, if any, 
+// for inlineAssociations_retire().
+static InlineAssociations *
+inlineAssociations_set(id object, InlineAssociations **slot, void *key, 
+                       const ObjcAssociation& association, 
+                       ObjcAssociation *old_association)
+{
+    InlineAssociations *list = *slot;
+    uintptr_t count = list ? list->count : 0;
+    uintptr_t index = count;
+    for (uintptr_t i = 0; i < count; i++) {
+        if (list->entries()[i].key == key) {
+            index = i;
+            *old_association = list->entries()[i].association;
+            break;
+        }
+    }
+
+    if (association.value()) {
+        InlineAssociations *newList = 
+            InlineAssociations::create(index < count ? count : count + 1);
+        if (count) {
+            memcpy(newList->entries(), list->entries(), 
+                   count * sizeof(InlineAssociations::Entry));
+        }
+        newList->entries()[index].key = key;
+        newList->entries()[index].association = association;
+        if (!list) object->setHasAssociatedObjects();
+        return inlineAssociations_replace(slot, newList);
+    } 
+    else if (index < count) {
+        InlineAssociations *newList = nil;
+        if (count > 1) {
+            newList = InlineAssociations::create(count - 1);
+            memcpy(newList->entries(), list->entries(), 
+                   index * sizeof(InlineAssociations::Entry));
+            memcpy(newList->entries() + index, list->entries() + index + 1, 
+                   (count - index - 1) * sizeof(InlineAssociations::Entry));
+        }
+        return inlineAssociations_replace(slot, newList);
+    }
+    return nil;
+}
+
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+// Returns false if the caller must take the stripe lock instead.
+static bool inlineAssociations_getLockFree(InlineAssociations **slot, 
+                                           void *key, id *result)
+{
+    InlineAssociations *list = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (!list) {
+        *result = nil;
+        return true;
+    }
+
+    association_reader_t *rec = association_reader_self();
+    __atomic_store_n(&rec->hazard, (const void *)list, __ATOMIC_SEQ_CST);
+    bool handled = false;
+    // If the slot still holds list, list can't be freed until we're done.
+    if (__atomic_load_n(slot, __ATOMIC_SEQ_CST) == list) {
+        ObjcAssociation *entry = list->find(key);
+        if (!entry) {
+            *result = nil;
+            handled = true;
+        } else if (!(entry->policy() & (OBJC_ASSOCIATION_GETTER_RETAIN | 
+                                        OBJC_ASSOCIATION_GETTER_AUTORELEASE))) 
+        {
+            *result = entry->value();
+            handled = true;
+        }
+    }
+    __atomic_store_n(&rec->hazard, (const void *)nil, __ATOMIC_RELEASE);
+    return handled;
+}
+#endif
+
 id _object_get_associative_reference(id object, void *key) {
     id value = nil;
     uintptr_t policy = OBJC_ASSOCIATION_ASSIGN;
+    InlineAssociations **slot = inlineAssociationsSlot(object);
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+    if (slot ? inlineAssociations_getLockFree(slot, key, &value)
+             : association_getLockFree(object, key, &value))
     {
-        AssociationsManager manager;
-        AssociationsHashMap &associations(manager.associations());
-        disguised_ptr_t disguised_object = DISGUISE(object);
-        AssociationsHashMap::iterator i = associations.find(disguised_object);
-        if (i != associations.end()) {
-            ObjectAssociationMap *refs = i->second;
-            ObjectAssociationMap::iterator j = refs->find(key);
-            if (j != refs->end()) {
-                ObjcAssociation &entry = j->second;
-                value = entry.value();
-                policy = entry.policy();
-                if (policy & OBJC_ASSOCIATION_GETTER_RETAIN) ((id(*)(id, SEL))objc_msgSend)(value, SEL_retain);
+        return value;
+    }
+#endif
+    {
+        AssociationsManager manager(object);
+        if (slot) {
+            ObjcAssociation *entry = *slot ? (*slot)->find(key) : nil;
+            if (entry) {
+                value = entry->value();
+                policy = entry->policy();
+            }
+        } else {
+            AssociationsHashMap &associations(manager.associations());
+            disguised_ptr_t disguised_object = DISGUISE(object);
+            AssociationsHashMap::iterator i = associations.find(disguised_object);
+            if (i != associations.end()) {
+                ObjectAssociationMap *refs = i->second;
+                ObjcAssociation *entry = refs->find(key);
+                if (entry) {
+                    value = entry->value();
+                    policy = entry->policy();
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+                    if (association_valueInIndex(policy)) {
+                        value = association_index_lookup(manager.stripe(), 
+                                                          disguised_object, key);
+                    }
+#endif
+                }
             }
         }
+        if (policy & OBJC_ASSOCIATION_GETTER_RETAIN) ((id(*)(id, SEL))objc_msgSend)(value, SEL_retain);
     }
     if (value && (policy & OBJC_ASSOCIATION_GETTER_AUTORELEASE)) {
         ((id(*)(id, SEL))objc_msgSend)(value, SEL_autorelease);
@@ -265,12 +924,30 @@ struct ReleaseValue {
     }
 };
 
+// The value kept in an object's ObjectAssociationMap.
+static inline id association_mapValue(id value, uintptr_t policy) {
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+    if (association_valueInIndex(policy)) return nil;
+#endif
+    return value;
+}
+
 void _object_set_associative_reference(id object, void *key, id value, uintptr_t policy) {
     // retain the new value (if any) outside the lock.
     ObjcAssociation old_association(0, nil);
     id new_value = value ? acquireValue(value, policy) : nil;
-    {
-        AssociationsManager manager;
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+    AssociationIndex *retired = nil;
+#endif
+    InlineAssociations *retiredList = nil;
+    InlineAssociations **slot = inlineAssociationsSlot(object);
+    if (slot) {
+        AssociationsManager manager(object);
+        retiredList = inlineAssociations_set(object, slot, key, 
+                                             ObjcAssociation(policy, new_value), 
+                                             &old_association);
+    } else {
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         disguised_ptr_t disguised_object = DISGUISE(object);
         if (new_value) {
@@ -279,41 +956,68 @@ void _object_set_associative_reference(id object, void *key, id value, uintptr_t
             if (i != associations.end()) {
                 // secondary table exists
                 ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    j->second = ObjcAssociation(policy, new_value);
+                ObjcAssociation *entry = refs->find(key);
+                if (entry) {
+                    old_association = *entry;
+                    *entry = ObjcAssociation(policy, association_mapValue(new_value, policy));
                 } else {
-                    (*refs)[key] = ObjcAssociation(policy, new_value);
+                    refs->insert(key, ObjcAssociation(policy, association_mapValue(new_value, policy)));
                 }
             } else {
                 // create the new association (first time).
                 ObjectAssociationMap *refs = new ObjectAssociationMap;
                 associations[disguised_object] = refs;
-                (*refs)[key] = ObjcAssociation(policy, new_value);
+                refs->insert(key, ObjcAssociation(policy, association_mapValue(new_value, policy)));
                 object->setHasAssociatedObjects();
             }
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+            id old_value = association_index_set(manager.stripe(), disguised_object, 
+                                                 key, new_value, policy, &retired);
+            if (association_valueInIndex(old_association.policy())) {
+                old_association = ObjcAssociation(old_association.policy(), old_value);
+            }
+#endif
         } else {
             // setting the association to nil breaks the association.
             AssociationsHashMap::iterator i = associations.find(disguised_object);
             if (i !=  associations.end()) {
                 ObjectAssociationMap *refs = i->second;
-                ObjectAssociationMap::iterator j = refs->find(key);
-                if (j != refs->end()) {
-                    old_association = j->second;
-                    refs->erase(j);
+                if (refs->erase(key, &old_association)) {
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+                    association_index_beginWrite(manager.stripe());
+                    id old_value = association_index_remove(manager.stripe(), 
+                                                            disguised_object, key);
+                    association_index_endWrite(manager.stripe());
+                    if (association_valueInIndex(old_association.policy())) {
+                        old_association = ObjcAssociation(old_association.policy(), old_value);
+                    }
+#endif
                 }
             }
         }
     }
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+    if (retired) association_index_retire(retired);
+#endif
+    if (retiredList) inlineAssociations_retire(retiredList);
     // release the old value (outside of the lock).
     if (old_association.hasValue()) ReleaseValue()(old_association);
 }
 
 void _object_remove_assocations(id object) {
     vector< ObjcAssociation,ObjcAllocator<ObjcAssociation> > elements;
-    {
-        AssociationsManager manager;
+    InlineAssociations *retiredList = nil;
+    InlineAssociations **slot = inlineAssociationsSlot(object);
+    if (slot) {
+        AssociationsManager manager(object);
+        InlineAssociations *list = *slot;
+        if (!list) return;
+        for (uintptr_t i = 0; i < list->count; i++) {
+            elements.push_back(list->entries()[i].association);
+        }
+        retiredList = inlineAssociations_replace(slot, nil);
+    } else {
+        AssociationsManager manager(object);
         AssociationsHashMap &associations(manager.associations());
         if (associations.size() == 0) return;
         disguised_ptr_t disguised_object = DISGUISE(object);
@@ -321,14 +1025,22 @@ void _object_remove_assocations(id object) {
         if (i != associations.end()) {
             // copy all of the associations that need to be removed.
             ObjectAssociationMap *refs = i->second;
-            for (ObjectAssociationMap::iterator j = refs->begin(), end = refs->end(); j != end; ++j) {
-                elements.push_back(j->second);
-            }
+#if SUPPORT_LOCKFREE_ASSOCIATIONS
+            // nonatomic values are taken from the index.
+            AssociationIndexRemover< vector< ObjcAssociation,ObjcAllocator<ObjcAssociation> > > 
+                remover(manager.stripe(), disguised_object, elements);
+            association_index_beginWrite(manager.stripe());
+            refs->forEach(remover);
+            association_index_endWrite(manager.stripe());
+#else
+            refs->copyAssociations(elements);
+#endif
             // remove the secondary table.
             delete refs;
             associations.erase(i);
         }
     }
+    if (retiredList) inlineAssociations_retire(retiredList);
     // the calls to releaseValue() happen outside of the lock.
     for_each(elements.begin(), elements.end(), ReleaseValue());
 }
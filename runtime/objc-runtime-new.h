@@ -46,6 +46,7 @@ public:
     inline void setImp(IMP newImp) { _imp = newImp; }
 
     void set(cache_key_t newKey, IMP newImp);
+    bool claim(IMP newImp);
 };
 
 
@@ -58,8 +59,10 @@ public:
     struct bucket_t *buckets();
     mask_t mask();
     mask_t occupied();
-    void incrementOccupied();
+    bool reserveOccupied(mask_t limit);
+    void unreserveOccupied();
     void setBucketsAndMask(struct bucket_t *newBuckets, mask_t newMask);
+    void shrinkMask(mask_t newMask);
     void initializeToEmpty();
 
     mask_t capacity();
@@ -69,9 +72,10 @@ public:
     static size_t bytesForCapacity(uint32_t cap);
     static struct bucket_t * endMarker(struct bucket_t *b, uint32_t cap);
 
-    void expand();
-    void reallocate(mask_t oldCapacity, mask_t newCapacity);
+    void expand(Class cls);
+    void reallocate(Class cls, mask_t oldCapacity, mask_t newCapacity);
     struct bucket_t * find(cache_key_t key, id receiver);
+    bool insert(Class cls, cache_key_t key, IMP imp, id receiver);
 
     static void bad_cache(id receiver, SEL sel, Class isa) __attribute__((noreturn));
 };
@@ -408,10 +412,16 @@ struct locstamped_category_list_t {
 #endif
 // class has instance-specific GC layout
 #define RW_HAS_INSTANCE_SPECIFIC_LAYOUT (1 << 21)
-// available for use
-// #define RW_20       (1<<20)
+// class instances use biased retain counts
+#define RW_BIASED_RC          (1<<20)
 // class has started realizing but not yet completed it
 #define RW_REALIZING          (1<<19)
+// class instances' retains and releases are traced
+#define RW_TRACE_RR           (1<<15)
+// class instances have an inline associations slot
+#define RW_INLINE_ASSOCIATIONS (1<<14)
+// class has allocated instances
+#define RW_INSTANCES_ALLOCATED (1<<13)
 
 // NOTE: MORE RW_ FLAGS DEFINED BELOW
 
@@ -775,6 +785,72 @@ class protocol_array_t :
 };
 
 
+// Coordinates lock-free method cache fills with replacement of the 
+// cache's buckets. See cache_fill() in objc-cache.mm.
+// generation is odd while the buckets are being replaced, and advances 
+// by 2 each time they are replaced (e.g. by expansion or flushing).
+struct cache_fill_gate_t {
+    uint32_t generation;
+    uint32_t fillers;
+
+    bool tryEnter() 
+    {
+        OSAtomicIncrement32Barrier((volatile int32_t *)&fillers);
+        if (generation & 1) {
+            leave();
+            return false;
+        }
+        return true;
+    }
+
+    void leave() 
+    {
+        OSAtomicDecrement32Barrier((volatile int32_t *)&fillers);
+    }
+
+    // Caller must hold cacheUpdateLock.
+    void beginReplace() 
+    {
+        assert((generation & 1) == 0);
+        OSAtomicIncrement32Barrier((volatile int32_t *)&generation);
+        while (fillers != 0) sched_yield();
+    }
+
+    // Caller must hold cacheUpdateLock.
+    void endReplace() 
+    {
+        assert(generation & 1);
+        OSAtomicIncrement32Barrier((volatile int32_t *)&generation);
+    }
+};
+
+
+// Per-class hints for the adaptive method cache size policy.
+// See cache_erase_nolock() and cache_fill_nolock() in objc-cache.mm.
+// probes and inserts are updated atomically by cache_t::insert(), which 
+// may run without cacheUpdateLock, and reset only while the class's 
+// cacheGate is closed. The other fields are written only with 
+// cacheUpdateLock held.
+struct cache_policy_t {
+    uint32_t probes;         // sum of probe distances since last reallocation
+    uint32_t inserts;        // entries added since last reallocation
+    uint32_t sparseFlushes;  // consecutive flushes that found the cache sparse
+    uint32_t shrunkFrom;     // capacity before an unfinished shrink, or 0
+    uintptr_t shrinkEpoch;   // cache epoch of that shrink
+
+    // for objc_copyCacheStatistics()
+    // misses is updated atomically by cache_miss() without any lock.
+    uint64_t misses __attribute__((aligned(8)));  // message sends that missed
+    uint32_t reallocations;  // times the buckets were replaced by a bigger 
+                             // or private array
+};
+
+
+// Selectors a class definitely does not implement.
+// See cache_negativeContains() in objc-cache.mm.
+struct cache_negative_t;
+
+
 struct class_rw_t {
     uint32_t flags;
     uint32_t version;
@@ -790,6 +866,13 @@ struct class_rw_t {
 
     char *demangledName;
 
+    cache_fill_gate_t cacheGate;
+    cache_policy_t cachePolicy;
+    cache_negative_t *negativeCache;
+    uint32_t flushGeneration;  // see flushCaches()
+    uint32_t inlineAssociationsOffset; // if RW_INLINE_ASSOCIATIONS
+    uintptr_t cacheGeneration; // see objc_imp_cache_lookup()
+
     void setFlags(uint32_t set) 
     {
         OSAtomicOr32Barrier(set, &flags);
@@ -1065,6 +1148,33 @@ struct objc_class : objc_object {
     void setRequiresRawIsa(bool inherited = false);
     void printRequiresRawIsa(bool inherited);
 
+    bool instancesHaveBiasedRC() {
+        return data()->flags & RW_BIASED_RC;
+    }
+    void setInstancesHaveBiasedRC();
+
+    bool instancesTraceRR() {
+        return data()->flags & RW_TRACE_RR;
+    }
+    void setInstancesTraceRR();
+
+    bool instancesHaveInlineAssociations() {
+        return data()->flags & RW_INLINE_ASSOCIATIONS;
+    }
+    // Offset of the associations slot in each instance.
+    uint32_t inlineAssociationsOffset() {
+        assert(instancesHaveInlineAssociations());
+        return data()->inlineAssociationsOffset;
+    }
+
+    bool instancesAllocated() {
+        return data()->flags & RW_INSTANCES_ALLOCATED;
+    }
+    void setInstancesAllocated() {
+        // Check first so allocation doesn't write the flags every time.
+        if (!instancesAllocated()) setInfo(RW_INSTANCES_ALLOCATED);
+    }
+
     bool canAllocIndexed() {
         assert(!isFuture());
         return !requiresRawIsa();
@@ -1438,6 +1438,20 @@ static void addSubclass(Class supercls, Class subcls)
         if (supercls->requiresRawIsa()) {
             subcls->setRequiresRawIsa(true);
         }
+
+        if (supercls->instancesHaveBiasedRC()) {
+            subcls->setInfo(RW_BIASED_RC);
+        }
+
+        if (supercls->instancesTraceRR()) {
+            subcls->setInfo(RW_TRACE_RR);
+        }
+
+        if (supercls->instancesHaveInlineAssociations()) {
+            subcls->data()->inlineAssociationsOffset = 
+                supercls->inlineAssociationsOffset();
+            subcls->setInfo(RW_INLINE_ASSOCIATIONS);
+        }
     }
 }
 
@@ -2081,17 +2095,15 @@ BOOL _class_isFutureClass(Class cls)
 
 
 /***********************************************************************
-* _objc_flush_caches
-* Flushes all caches.
-* (Historical behavior: flush caches for cls, its metaclass, 
-* and subclasses thereof. Nil flushes all classes.)
-* Locking: acquires runtimeLock
+* eraseCaches
+* Erases the caches of cls, its metaclass, and subclasses thereof.
+* Nil erases all caches.
+* Locking: runtimeLock and cacheUpdateLock must be held by the caller
 **********************************************************************/
-static void flushCaches(Class cls)
+static void eraseCaches(Class cls)
 {
     runtimeLock.assertWriting();
-
-    mutex_locker_t lock(cacheUpdateLock);
+    cacheUpdateLock.assertLocked();
 
     if (cls) {
         foreach_realized_class_and_subclass(cls, ^(Class c){
@@ -2122,6 +2134,130 @@ static void flushCaches(Class cls)
 }
 
 
+/***********************************************************************
+* Batched cache flushes.
+* Each category attachment and method addition flushes the caches of 
+* the class and all of its subclasses, so an image with many categories 
+* on a widely subclassed class walks those subclasses once per category.
+* Between beginFlushBatch() and endFlushBatch(), flushCaches() only 
+* records the class. endFlushBatch() then erases each affected cache 
+* once, skipping classes whose superclasses were recorded too. Classes 
+* are stamped with the batch's generation number when they are recorded, 
+* which finds duplicates without a side table.
+*
+* The invalidation itself can't be deferred past the end of the batch 
+* because objc_msgSend doesn't check generation numbers. Batches must be 
+* entered and left while holding runtimeLock for writing, so no lookup 
+* fills a cache from the new method lists before the flush. 
+* Message sends may hit stale cache entries until the batch ends, 
+* just as they could before the flush.
+* Locking: runtimeLock
+**********************************************************************/
+static unsigned flushBatchDepth;
+static uint32_t flushBatchGeneration;
+static bool flushBatchAll;
+static Class *flushBatchClasses;
+static unsigned flushBatchCount;
+static unsigned flushBatchCapacity;
+
+static void beginFlushBatch(void)
+{
+    runtimeLock.assertWriting();
+
+    if (DisableFlushBatching) return;
+    if (flushBatchDepth++ > 0) return;
+
+    // Generation 0 is every class's initial stamp.
+    if (++flushBatchGeneration == 0) ++flushBatchGeneration;
+}
+
+static void addFlushBatchClass(Class cls)
+{
+    class_rw_t *rw = cls->data();
+    if (rw->flushGeneration == flushBatchGeneration) return;
+    rw->flushGeneration = flushBatchGeneration;
+
+    if (flushBatchCount == flushBatchCapacity) {
+        flushBatchCapacity = flushBatchCapacity ? flushBatchCapacity*2 : 16;
+        flushBatchClasses = (Class *)
+            realloc(flushBatchClasses, flushBatchCapacity * sizeof(Class));
+    }
+    flushBatchClasses[flushBatchCount++] = cls;
+}
+
+static bool superclassInFlushBatch(Class cls)
+{
+    while ((cls = cls->superclass)) {
+        if (cls->data()->flushGeneration == flushBatchGeneration) return true;
+    }
+    return false;
+}
+
+static void endFlushBatch(void)
+{
+    runtimeLock.assertWriting();
+
+    if (DisableFlushBatching) return;
+    assert(flushBatchDepth > 0);
+    if (--flushBatchDepth > 0) return;
+
+    if (flushBatchAll  ||  flushBatchCount > 0) {
+        mutex_locker_t lock(cacheUpdateLock);
+        if (flushBatchAll) {
+            eraseCaches(nil);
+        } else {
+            for (unsigned i = 0; i < flushBatchCount; i++) {
+                Class cls = flushBatchClasses[i];
+                if (superclassInFlushBatch(cls)) continue;
+                foreach_realized_class_and_subclass(cls, ^(Class c){
+                    cache_erase_nolock(c);
+                });
+            }
+        }
+        if (PrintCaches) {
+            _objc_inform("CACHES: coalesced flushes for %u classes%s", 
+                         flushBatchCount, flushBatchAll ? " (all)" : "");
+        }
+    }
+
+    flushBatchAll = false;
+    flushBatchCount = 0;
+}
+
+
+/***********************************************************************
+* flushCaches
+* Flushes the caches of cls, its metaclass, and subclasses thereof.
+* Nil flushes all classes.
+* Inside a flush batch the flush is deferred to endFlushBatch().
+* Locking: runtimeLock must be held by the caller
+**********************************************************************/
+static void flushCaches(Class cls)
+{
+    runtimeLock.assertWriting();
+
+    if (flushBatchDepth > 0) {
+        if (!cls) {
+            flushBatchAll = true;
+        } else {
+            addFlushBatchClass(cls);
+            if (cls->superclass) addFlushBatchClass(cls->ISA());
+        }
+        return;
+    }
+
+    mutex_locker_t lock(cacheUpdateLock);
+    eraseCaches(cls);
+}
+
+
+/***********************************************************************
+* _objc_flush_caches
+* Flushes all caches.
+* (Historical behavior: flush caches for cls, its metaclass, 
+* and subclasses thereof. Nil flushes all classes.)
+* Locking: acquires runtimeLock
+**********************************************************************/
 void _objc_flush_caches(Class cls)
 {
     {
@@ -2137,6 +2273,241 @@ void _objc_flush_caches(Class cls)
 }
 
 
+/***********************************************************************
+* objc_cache_prewarm
+* Fills cls's method cache with the given selectors in one pass.
+* cls may be a metaclass. +initialize and the method resolvers run 
+* first if needed, just as they would for the same messages.
+* Locking: acquires runtimeLock and cacheUpdateLock
+**********************************************************************/
+void objc_cache_prewarm(Class cls, const SEL *sels, unsigned int count)
+{
+    if (!cls  ||  !sels  ||  count == 0) return;
+
+    if (!cls->isRealized()) {
+        rwlock_writer_t lock(runtimeLock);
+        realizeClass(cls);
+    }
+
+    if (!cls->isInitialized()) {
+        _class_initialize(_class_getNonMetaClass(cls, nil));
+    }
+
+    // Allocate the cache once at its final size, then fill it.
+    cache_reserve(cls, count);
+    for (unsigned int i = 0; i < count; i++) {
+        if (!sels[i]) continue;
+        lookUpImpOrForward(cls, sels[i], nil, 
+                           NO/*initialize*/, YES/*cache*/, YES/*resolver*/);
+    }
+}
+
+
+/***********************************************************************
+* objc_copyCacheStatistics
+* Returns method cache statistics for each realized class and metaclass 
+* whose cache has been used, sorted by misses, most first.
+* The caller must free() the result.
+* Locking: acquires runtimeLock and cacheUpdateLock
+**********************************************************************/
+static int compareCacheStatistics(const void *a, const void *b)
+{
+    uint64_t am = ((const objc_class_cache_stats_t *)a)->misses;
+    uint64_t bm = ((const objc_class_cache_stats_t *)b)->misses;
+    return (am < bm) ? 1 : (am > bm) ? -1 : 0;
+}
+
+objc_class_cache_stats_t *
+objc_copyCacheStatistics(unsigned int *outCount, objc_cache_totals_t *outTotals)
+{
+    rwlock_reader_t lock(runtimeLock);
+    mutex_locker_t lock2(cacheUpdateLock);
+
+    if (outTotals) cache_getTotals(outTotals);
+
+    NXHashTable *classes[2] = { realizedClasses(), realizedMetaclasses() };
+    unsigned int max = 
+        NXCountHashTable(classes[0]) + NXCountHashTable(classes[1]);
+    objc_class_cache_stats_t *result = (objc_class_cache_stats_t *)
+        malloc(max * sizeof(objc_class_cache_stats_t));
+
+    unsigned int count = 0;
+    for (int i = 0; i < 2; i++) {
+        NXHashState state = NXInitHashState(classes[i]);
+        Class cls;
+        while (NXNextHashState(classes[i], &state, (void **)&cls)) {
+            objc_class_cache_stats_t *stats = &result[count];
+            cache_getStatistics(cls, stats);
+            if (stats->capacity  ||  stats->misses) count++;
+        }
+    }
+
+    if (count == 0) {
+        free(result);
+        result = nil;
+    } else {
+        qsort(result, count, sizeof(result[0]), &compareCacheStatistics);
+    }
+
+    if (outCount) *outCount = count;
+    return result;
+}
+
+
+/***********************************************************************
+* Method cache profiles
+* OBJC_RECORD_CACHE_PROFILE=path writes the selectors in every class's 
+* method cache to path at exit, one class per line:
+*   ClassName sel1 sel2 ...
+*   +ClassName sel1 sel2 ...     (class methods)
+* OBJC_REPLAY_CACHE_PROFILE=path reads such a file at launch. 
+* Each class's caches are then prewarmed when its +initialize finishes.
+**********************************************************************/
+struct cache_profile_t {
+    SEL *sels[2];        // [0] instance methods, [1] class methods
+    uint32_t counts[2];
+};
+
+// class name => cache_profile_t; never changes after launch
+static NXMapTable *cache_profile_map = nil;
+
+static void writeCacheProfileForClass(FILE *f, Class cls)
+{
+    cache_t *cache = &cls->cache;
+    if (cache->occupied() == 0) return;
+
+    fprintf(f, "%s%s", cls->isMetaClass() ? "+" : "", cls->mangledName());
+    bucket_t *b = cache->buckets();
+    mask_t capacity = cache->capacity();
+    for (mask_t i = 0; i < capacity; i++) {
+        if (b[i].key()) fprintf(f, " %s", sel_getName((SEL)b[i].key()));
+    }
+    fprintf(f, "\n");
+}
+
+// Called by atexit(). Another thread may still hold runtimeLock 
+// or cacheUpdateLock, and may never release it while we exit; 
+// skip the profile rather than deadlock.
+static void writeCacheProfile(void)
+{
+    if (!runtimeLock.tryRead()) {
+        _objc_inform("CACHES: runtime busy at exit; "
+                     "not writing cache profile %s", RecordCacheProfile);
+        return;
+    }
+    // Keeps the buckets from being replaced while we read them.
+    if (!cacheUpdateLock.tryLock()) {
+        runtimeLock.unlockRead();
+        _objc_inform("CACHES: caches busy at exit; "
+                     "not writing cache profile %s", RecordCacheProfile);
+        return;
+    }
+
+    FILE *f = fopen(RecordCacheProfile, "w");
+    int err = f ? 0 : errno;
+    if (f) {
+        NXHashTable *classes[2] = { realizedClasses(), realizedMetaclasses() };
+        for (int i = 0; i < 2; i++) {
+            NXHashState state = NXInitHashState(classes[i]);
+            Class cls;
+            while (NXNextHashState(classes[i], &state, (void **)&cls)) {
+                writeCacheProfileForClass(f, cls);
+            }
+        }
+        fclose(f);
+    }
+
+    cacheUpdateLock.unlock();
+    runtimeLock.unlockRead();
+
+    if (!f) {
+        _objc_inform("CACHES: can't write cache profile %s (%s)", 
+                     RecordCacheProfile, strerror(err));
+    }
+    else if (PrintCaches) {
+        _objc_inform("CACHES: wrote cache profile %s", RecordCacheProfile);
+    }
+}
+
+static void loadCacheProfile(void)
+{
+    runtimeLock.assertWriting();
+
+    FILE *f = fopen(ReplayCacheProfile, "r");
+    if (!f) {
+        _objc_inform("CACHES: can't read cache profile %s (%s)", 
+                     ReplayCacheProfile, strerror(errno));
+        return;
+    }
+
+    cache_profile_map = NXCreateMapTable(NXStrValueMapPrototype, 32);
+
+    char *line = nil;
+    size_t linecap = 0;
+    ssize_t len;
+    unsigned lines = 0;
+    while ((len = getline(&line, &linecap, f)) > 0) {
+        char *last;
+        char *name = strtok_r(line, " \t\n", &last);
+        if (!name) continue;
+
+        int meta = 0;
+        if (name[0] == '+') {
+            meta = 1;
+            name++;
+        }
+
+        cache_profile_t *profile = (cache_profile_t *)
+            NXMapGet(cache_profile_map, name);
+        if (!profile) {
+            profile = (cache_profile_t *)calloc(1, sizeof(cache_profile_t));
+            NXMapInsert(cache_profile_map, strdup(name), profile);
+        }
+        if (profile->sels[meta]) free(profile->sels[meta]);
+
+        // Every selector needs at least 2 bytes of the line.
+        SEL *sels = (SEL *)malloc((len/2 + 1) * sizeof(SEL));
+        uint32_t count = 0;
+        char *selName;
+        while ((selName = strtok_r(nil, " \t\n", &last))) {
+            sels[count++] = sel_registerName(selName);
+        }
+        profile->sels[meta] = sels;
+        profile->counts[meta] = count;
+        lines++;
+    }
+
+    free(line);
+    fclose(f);
+
+    if (PrintCaches) {
+        _objc_inform("CACHES: read %u classes from cache profile %s", 
+                     lines, ReplayCacheProfile);
+    }
+}
+
+
+/***********************************************************************
+* cache_prewarmFromProfile
+* Prewarm cls's caches from OBJC_REPLAY_CACHE_PROFILE, if any.
+* Called once cls is +initialized.
+* Locking: acquires runtimeLock and cacheUpdateLock
+**********************************************************************/
+void cache_prewarmFromProfile(Class cls)
+{
+    assert(!cls->isMetaClass());
+
+    if (!cache_profile_map) return;
+
+    cache_profile_t *profile = (cache_profile_t *)
+        NXMapGet(cache_profile_map, cls->mangledName());
+    if (!profile) return;
+
+    objc_cache_prewarm(cls, profile->sels[0], profile->counts[0]);
+    objc_cache_prewarm(cls->ISA(), profile->sels[1], profile->counts[1]);
+}
+
+
 /***********************************************************************
 * map_images
 * Process the given images which are being mapped in by dyld.
@@ -2493,6 +2864,10 @@ void _read_images(header_info **hList, uint32_t hCount)
         realized_metaclass_hash = 
             NXCreateHashTable(NXPtrPrototype, total / 8, nil);
 
+        // Method cache profiles
+        if (RecordCacheProfile) atexit(&writeCacheProfile);
+        if (ReplayCacheProfile) loadCacheProfile();
+
         ts.log("IMAGE TIMES: first time tasks");
     }
 
@@ -2651,6 +3026,8 @@ void _read_images(header_info **hList, uint32_t hCount)
     ts.log("IMAGE TIMES: realize future classes");
 
     // Discover categories. 
+    // Attaching them flushes caches once at the end, not once per category.
+    beginFlushBatch();
     for (EACH_HEADER) {
         category_t **catlist = 
             _getObjc2CategoryList(hi, &count);
@@ -2705,6 +3082,8 @@ void _read_images(header_info **hList, uint32_t hCount)
         }
     }
 
+    endFlushBatch();
+
     ts.log("IMAGE TIMES: discover categories");
 
     // Category discovery MUST BE LAST to avoid potential races 
@@ -4637,25 +5016,33 @@ log_and_fill_cache(Class cls, IMP imp, SEL sel, id receiver, Class implementer)
 **********************************************************************/
 IMP _class_lookupMethodAndLoadCache3(id obj, SEL sel, Class cls)
 {
+#if SUPPORT_TAGGED_POINTERS
+    // objc_msgSend passes a tagged pointer cache instead of the class.
+    cls = cache_classForLookup(cls, obj);
+#endif
+
+    // objc_msgSend is done with the cache. Let old caches be freed.
+    cache_miss(cls);
     return lookUpImpOrForward(cls, sel, obj, 
                               YES/*initialize*/, NO/*cache*/, YES/*resolver*/);
 }
 
 
 /***********************************************************************
-* lookUpImpOrForward.
+* lookUpImp.
 * The standard IMP lookup. 
 * initialize==NO tries to avoid +initialize (but sometimes fails)
 * cache==NO skips optimistic unlocked lookup (but uses cache elsewhere)
 * Most callers should use initialize==YES and cache==YES.
 * inst is an instance of cls or a subclass thereof, or nil if none is known. 
 *   If cls is an un-initialized metaclass then a non-nil inst is faster.
-* May return _objc_msgForward_impcache. IMPs destined for external use 
-*   must be converted to _objc_msgForward or _objc_msgForward_stret.
-*   If you don't want forwarding at all, use lookUpImpOrNil() instead.
+* forward==YES caches and returns _objc_msgForward_impcache if no 
+*   implementation is found. forward==NO returns nil instead, and 
+*   records the miss only in cls's negative cache.
+*   Either way a cache hit may return _objc_msgForward_impcache.
 **********************************************************************/
-IMP lookUpImpOrForward(Class cls, SEL sel, id inst, 
-                       bool initialize, bool cache, bool resolver)
+static IMP lookUpImp(Class cls, SEL sel, id inst, 
+                     bool initialize, bool cache, bool resolver, bool forward)
 {
     Class curClass;
     IMP imp = nil;
@@ -4668,6 +5055,15 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
     if (cache) {
         imp = cache_getImp(cls, sel);
         if (imp) return imp;
+
+        // Optimistic negative cache lookup. Forwarding lookups 
+        // fill the method cache, which needs the lock.
+        if (!forward  &&  cls->isRealized()  &&  
+            (!initialize  ||  cls->isInitialized())  &&  
+            cache_negativeContains(cls, sel))
+        {
+            return nil;
+        }
     }
 
     if (!cls->isRealized()) {
@@ -4702,6 +5098,11 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
     imp = cache_getImp(cls, sel);
     if (imp) goto done;
 
+    // Try this class's negative cache. 
+    // The resolver has already had its chance.
+
+    if (cache_negativeContains(cls, sel)) goto notfound;
+
     // Try this class's method lists.
 
     meth = getMethodNoSuper_nolock(cls, sel);
@@ -4731,6 +5132,10 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
             }
         }
 
+        // Superclass negative cache. 
+        // Nothing further up implements it either.
+        if (cache_negativeContains(curClass, sel)) break;
+
         // Superclass method list.
         meth = getMethodNoSuper_nolock(curClass, sel);
         if (meth) {
@@ -4752,10 +5157,17 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
     }
 
     // No implementation found, and method resolver didn't help. 
-    // Use forwarding.
+    // Remember that, then use forwarding.
 
-    imp = (IMP)_objc_msgForward_impcache;
-    cache_fill(cls, sel, imp, inst);
+    if (triedResolver) cache_negativeAdd(cls, sel);
+
+ notfound:
+    if (forward) {
+        imp = (IMP)_objc_msgForward_impcache;
+        cache_fill(cls, sel, imp, inst);
+    } else {
+        imp = nil;
+    }
 
  done:
     runtimeLock.unlockRead();
@@ -4770,14 +5182,30 @@ IMP lookUpImpOrForward(Class cls, SEL sel, id inst,
 }
 
 
+/***********************************************************************
+* lookUpImpOrForward.
+* The standard IMP lookup. See lookUpImp() for the parameters.
+* May return _objc_msgForward_impcache. IMPs destined for external use 
+*   must be converted to _objc_msgForward or _objc_msgForward_stret.
+*   If you don't want forwarding at all, use lookUpImpOrNil() instead.
+**********************************************************************/
+IMP lookUpImpOrForward(Class cls, SEL sel, id inst, 
+                       bool initialize, bool cache, bool resolver)
+{
+    return lookUpImp(cls, sel, inst, initialize, cache, resolver, YES);
+}
+
+
 /***********************************************************************
 * lookUpImpOrNil.
 * Like lookUpImpOrForward, but returns nil instead of _objc_msgForward_impcache
+* Misses go to the negative cache instead of the method cache, so 
+* repeated capability checks stay cheap without taking method cache space.
 **********************************************************************/
 IMP lookUpImpOrNil(Class cls, SEL sel, id inst, 
                    bool initialize, bool cache, bool resolver)
 {
-    IMP imp = lookUpImpOrForward(cls, sel, inst, initialize, cache, resolver);
+    IMP imp = lookUpImp(cls, sel, inst, initialize, cache, resolver, NO);
     if (imp == _objc_msgForward_impcache) return nil;
     else return imp;
 }
@@ -5182,6 +5610,39 @@ void objc_class::setRequiresRawIsa(bool inherited)
 }
 
 
+/***********************************************************************
+* Mark this class and all of its subclasses as using biased retain counts
+**********************************************************************/
+void objc_class::setInstancesHaveBiasedRC() 
+{
+    Class cls = (Class)this;
+    runtimeLock.assertWriting();
+
+    if (instancesHaveBiasedRC()) return;
+
+    foreach_realized_class_and_subclass(cls, ^(Class c){
+        c->setInfo(RW_BIASED_RC);
+    });
+}
+
+
+/***********************************************************************
+* Mark this class and all of its subclasses as traced by 
+* retain count tracing
+**********************************************************************/
+void objc_class::setInstancesTraceRR() 
+{
+    Class cls = (Class)this;
+    runtimeLock.assertWriting();
+
+    if (instancesTraceRR()) return;
+
+    foreach_realized_class_and_subclass(cls, ^(Class c){
+        c->setInfo(RW_TRACE_RR);
+    });
+}
+
+
 /***********************************************************************
 * Update custom RR and AWZ when a method changes its IMP
 **********************************************************************/
@@ -5330,6 +5791,77 @@ class_setIvarLayout(Class cls, const uint8_t *layout)
     ro_w->ivarLayout = ustrdupMaybeNil(layout);
 }
 
+/***********************************************************************
+* _class_setUsesBiasedRetainCounts
+* Instances of cls and its subclasses allocated from now on use 
+* biased retain counts. See objc_object::biasedrc_initInstance().
+* Locking: acquires runtimeLock
+**********************************************************************/
+void
+_class_setUsesBiasedRetainCounts(Class cls)
+{
+    if (!cls) return;
+
+#if SUPPORT_NONPOINTER_ISA
+    rwlock_writer_t lock(runtimeLock);
+
+    realizeClass(cls);
+    cls->setInstancesHaveBiasedRC();
+    biasedrc_enabled = true;
+#endif
+}
+
+
+/***********************************************************************
+* _class_setTracesRetainCounts
+* Retains, releases, and autoreleases of instances of cls and its 
+* subclasses are recorded from now on. See objc_object::rrtrace().
+* Locking: acquires runtimeLock
+**********************************************************************/
+void
+_class_setTracesRetainCounts(Class cls)
+{
+    if (!cls) return;
+
+    rwlock_writer_t lock(runtimeLock);
+
+    realizeClass(cls);
+    cls->setInstancesTraceRR();
+    rrtrace_enabled = true;
+}
+
+
+/***********************************************************************
+* _class_setUsesInlineAssociations
+* Adds a pointer-sized slot after cls's ivars where instances of cls 
+* and its subclasses keep their associated objects.
+* Subclasses realized later slide their ivars past the slot. 
+* Returns NO if a subclass is already realized, because its ivars 
+* would overlap the slot, or if instances of cls were already 
+* allocated without the slot.
+* Locking: acquires runtimeLock
+**********************************************************************/
+BOOL
+_class_setUsesInlineAssociations(Class cls)
+{
+    if (!cls  ||  UseGC) return NO;
+
+    rwlock_writer_t lock(runtimeLock);
+
+    realizeClass(cls);
+    if (cls->instancesHaveInlineAssociations()) return YES;
+    if (cls->data()->firstSubclass) return NO;
+    if (cls->instancesAllocated()) return NO;
+
+    uint32_t offset = cls->alignedInstanceSize();
+    make_ro_writeable(cls->data());
+    cls->setInstanceSize(offset + sizeof(void *));
+    cls->data()->inlineAssociationsOffset = offset;
+    cls->setInfo(RW_INLINE_ASSOCIATIONS);
+    return YES;
+}
+
+
 // SPI:  Instance-specific object layout.
 
 void
@@ -6212,6 +6744,9 @@ _class_createInstanceFromZone(Class cls, size_t extraBytes, void *zone,
 
     assert(cls->isRealized());
 
+    // _class_setUsesInlineAssociations() must not grow cls after this.
+    cls->setInstancesAllocated();
+
     // Read class's info bits all at once for performance
     bool hasCxxCtor = cls->hasCxxCtor();
     bool hasCxxDtor = cls->hasCxxDtor();
@@ -6356,6 +6891,11 @@ _object_copyFromZone(id oldObj, size_t extraBytes, void *zone)
     memmove(copyDst, copySrc, copySize);
 #endif
 
+    // The copy has no associated objects.
+    if (cls->instancesHaveInlineAssociations()) {
+        *(void **)((uint8_t *)obj + cls->inlineAssociationsOffset()) = nil;
+    }
+
 #if SUPPORT_GC
     if (UseGC)
         gc_fixup_weakreferences(obj, oldObj);
@@ -6564,6 +7104,7 @@ _objc_registerTaggedPointerClass(objc_tag_index_t tag, Class cls)
     }
 
     objc_tag_classes[slot] = cls;
+    cache_setTaggedClass(slot, cls);
 }
 
 
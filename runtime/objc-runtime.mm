@@ -46,8 +46,10 @@ OBJC_EXPORT Class getOriginalClassForPosingClass(Class);
 
 // Settings from environment variables
 #define OPTION(var, env, help) bool var = false;
+#define VALUE_OPTION(var, env, help) const char *var = nil;
 #include "objc-env.h"
 #undef OPTION
+#undef VALUE_OPTION
 
 struct option_t {
     bool* var;
@@ -58,8 +60,25 @@ struct option_t {
 
 const option_t Settings[] = {
 #define OPTION(var, env, help) option_t{&var, #env, help, strlen(#env)}, 
+#define VALUE_OPTION(var, env, help)
 #include "objc-env.h"
 #undef OPTION
+#undef VALUE_OPTION
+};
+
+struct value_option_t {
+    const char** var;
+    const char *env;
+    const char *help;
+    size_t envlen;
+};
+
+const value_option_t ValueSettings[] = {
+#define OPTION(var, env, help)
+#define VALUE_OPTION(var, env, help) value_option_t{&var, #env, help, strlen(#env)}, 
+#include "objc-env.h"
+#undef OPTION
+#undef VALUE_OPTION
 };
 
 
@@ -266,6 +285,16 @@ void environ_init(void)
                 break;
             }
         }            
+
+        for (size_t i = 0; i < sizeof(ValueSettings)/sizeof(ValueSettings[0]); i++) {
+            const value_option_t *opt = &ValueSettings[i];
+            if ((size_t)(value - *p) == 1+opt->envlen  &&  
+                0 == strncmp(*p, opt->env, opt->envlen))
+            {
+                *opt->var = *value ? value : nil;
+                break;
+            }
+        }            
     }
 
     // Special case: enable some autorelease pool debugging 
@@ -305,10 +334,32 @@ void environ_init(void)
             if (PrintHelp) _objc_inform("%s: %s", opt->env, opt->help);
             if (PrintOptions && *opt->var) _objc_inform("%s is set", opt->env);
         }
+
+        for (size_t i = 0; i < sizeof(ValueSettings)/sizeof(ValueSettings[0]); i++) {
+            const value_option_t *opt = &ValueSettings[i];            
+            if (PrintHelp) _objc_inform("%s: %s", opt->env, opt->help);
+            if (PrintOptions && *opt->var) _objc_inform("%s is set to %s", opt->env, *opt->var);
+        }
     }
 }
 
 
+/***********************************************************************
+* numericOption
+* Returns the value of a numeric VALUE_OPTION, or defaultValue 
+* if the option is not set or is not a number.
+**********************************************************************/
+unsigned long numericOption(const char *value, unsigned long defaultValue)
+{
+    if (!value) return defaultValue;
+
+    char *end;
+    unsigned long result = strtoul(value, &end, 0);
+    if (end == value  ||  *end != '\0') return defaultValue;
+    return result;
+}
+
+
 /***********************************************************************
 * logReplacedMethod
 * OBJC_PRINT_REPLACED_METHODS implementation
@@ -391,6 +442,23 @@ void _objc_pthread_destroyspecific(void *arg)
                 free(data->printableNames[i]);  
             }
         }
+        // data->cacheReader is not freed. Cache reader records live 
+        // until the thread terminates and are then reused.
+        if (data->rrTraceBuffer) rrtrace_threadExit(data->rrTraceBuffer);
+#if SUPPORT_NONPOINTER_ISA
+        // Flush the dealloc batch before the weak reader record goes.
+        if (data->deallocBatch) {
+            DeallocBatch *batch = data->deallocBatch;
+            data->deallocBatch = nil;
+            deallocBatch_threadExit(batch);
+        }
+        if (data->weakReader) weak_reader_threadExit(data->weakReader);
+#endif
+#if !TARGET_OS_WIN32
+        if (data->associationReader) {
+            association_reader_threadExit(data->associationReader);
+        }
+#endif
 
         // add further cleanup here...
 
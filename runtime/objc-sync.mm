@@ -25,16 +25,128 @@
 #include "objc-sync.h"
 
 //
-// Allocate a lock only when needed.  Since few locks are needed at any point
-// in time, keep them on a single list.
+// Allocate a lock only when needed. Locks are kept in hash tables 
+// keyed by object, and unused ones are reclaimed as the tables grow.
 //
 
 
+/*
+  SyncLock: the lock in a SyncData. It is not recursive. The per-thread 
+  caches count a thread's recursive acquisitions, and only the 
+  outermost ones lock and unlock it.
+  A contended lock() first spins, backing off between attempts. The 
+  spin budget adapts to how long recent spins took to succeed. Then 
+  it parks on a monitor. unlock() with parked waiters hands the lock 
+  straight to one of them instead of releasing it, so spinning and 
+  newly arriving threads can't starve them.
+  The monitor is a pthread mutex and condition variable rather than a 
+  Mach semaphore, because a forked child doesn't inherit Mach ports 
+  and must still be able to use the locks it copied.
+ */
+static inline void sync_pause(void)
+{
+#if __i386__  ||  __x86_64__
+    __asm__ volatile("pause");
+#elif __arm__  ||  __arm64__
+    __asm__ volatile("yield");
+#endif
+}
+
+class SyncLock {
+    // Bit 0 is set while locked. The other bits count parked waiters.
+    uintptr_t state;
+    int32_t spins;          // adaptive spin budget
+    uint32_t handoffs;      // handoffs not yet taken; guarded by parking
+    monitor_t parking;
+
+    enum { LOCKED = 1, WAITER_ONE = 2 };
+    enum { SpinMax = 100, BackoffMax = 8 };
+
+    void lockSlow();
+    void unlockSlow();
+
+  public:
+    SyncLock() : state(0), spins(0), handoffs(0) { }
+
+    void lock() {
+        if (__sync_bool_compare_and_swap(&state, 0, LOCKED)) return;
+        lockSlow();
+    }
+
+    void unlock() {
+        if (__sync_bool_compare_and_swap(&state, LOCKED, 0)) return;
+        unlockSlow();
+    }
+
+    // The lock must be unlocked with no waiters.
+    void destroy() {
+        assert(state == 0  &&  handoffs == 0);
+    }
+};
+
+void SyncLock::lockSlow()
+{
+    // Spin while nobody is parked. Spinners never take the lock 
+    // from a parked waiter, because a handoff never unlocks it.
+    int32_t budget = MIN((int32_t)SpinMax, spins * 2 + 10);
+    int32_t backoff = 1;
+    for (int32_t n = 0; n < budget; n++) {
+        uintptr_t old = __atomic_load_n(&state, __ATOMIC_RELAXED);
+        if (old == 0) {
+            if (__sync_bool_compare_and_swap(&state, 0, LOCKED)) {
+                spins += (n - spins) / 8;
+                return;
+            }
+        } else if (old != LOCKED) {
+            // Waiters are parked. Get in line.
+            break;
+        }
+        for (int32_t i = 0; i < backoff; i++) sync_pause();
+        if (backoff < BackoffMax) backoff *= 2;
+    }
+    spins += (budget - spins) / 8;
+
+    // Park.
+    while (true) {
+        uintptr_t old = __atomic_load_n(&state, __ATOMIC_RELAXED);
+        if (old == 0) {
+            if (__sync_bool_compare_and_swap(&state, 0, LOCKED)) return;
+        } else if (__sync_bool_compare_and_swap(&state, old, old + WAITER_ONE)) {
+            break;
+        }
+    }
+
+    // We return only when the lock is handed to us.
+    parking.enter();
+    while (handoffs == 0) parking.wait();
+    handoffs--;
+    parking.leave();
+}
+
+void SyncLock::unlockSlow()
+{
+    while (true) {
+        uintptr_t old = __atomic_load_n(&state, __ATOMIC_RELAXED);
+        assert(old & LOCKED);
+        if (old == LOCKED) {
+            if (__sync_bool_compare_and_swap(&state, LOCKED, 0)) return;
+        } else if (__sync_bool_compare_and_swap(&state, old, old - WAITER_ONE)) {
+            // Handed off: still locked, one fewer waiter.
+            break;
+        }
+    }
+    parking.enter();
+    handoffs++;
+    parking.notify();
+    parking.leave();
+}
+
+
 typedef struct SyncData {
-    struct SyncData* nextData;
+    struct SyncData* nextData;  // free list link
     DisguisedPtr<objc_object> object;
     int32_t threadCount;  // number of THREADS using this block
-    recursive_mutex_t mutex;
+    SyncLock lock;
 } SyncData;
 
 typedef struct {
@@ -56,17 +168,36 @@ typedef struct SyncCache {
   SYNC_COUNT_DIRECT_KEY == SyncCacheItem.lockCount
  */
 
-struct SyncList {
-    SyncData *data;
+/*
+  SyncTable: open-addressed hash table of SyncData, keyed by object.
+  Entries stay in the table while their threadCount is zero, so a lock 
+  that is taken again soon finds its old SyncData. When the table fills 
+  up it is rebuilt without them, and they are kept on a short free list 
+  for reuse or freed. A SyncData with a zero threadCount may be freed 
+  at any time by a thread holding the table's lock, so a thread must 
+  not touch a SyncData after dropping its threadCount contribution.
+  The table is only used with its lock held.
+ */
+
+enum { 
+    SyncTableMinCapacity = 8,   // power of two
+    SyncFreeListMax = 8
+};
+
+struct SyncTable {
+    SyncData **table;       // nil slots are empty
+    uint32_t mask;
+    uint32_t count;         // occupied slots, used or not
+    SyncData *freeList;     // linked by nextData
+    uint32_t freeCount;
     spinlock_t lock;
 
-    SyncList() : data(nil) { }
+    SyncTable() 
+        : table(nil), mask(0), count(0), freeList(nil), freeCount(0) { }
 };
 
-// Use multiple parallel lists to decrease contention among unrelated objects.
-#define LOCK_FOR_OBJ(obj) sDataLists[obj].lock
-#define LIST_FOR_OBJ(obj) sDataLists[obj].data
-static StripedMap<SyncList> sDataLists;
+// Use multiple parallel tables to decrease contention among unrelated objects.
+static StripedMap<SyncTable> sDataTables("SyncTable");
 
 
 enum usage { ACQUIRE, RELEASE, CHECK };
@@ -107,10 +238,70 @@ void _destroySyncCache(struct SyncCache *cache)
 }
 
 
-static SyncData* id2data(id object, enum usage why)
+static SyncData *syncTableFind(SyncTable& t, id object)
+{
+    if (!t.table) return nil;
+    for (uint32_t i = ptr_hash((uintptr_t)object) & t.mask; ; i = (i+1) & t.mask) {
+        SyncData *data = t.table[i];
+        if (!data  ||  data->object == object) return data;
+    }
+}
+
+static void syncTableInsert(SyncData **table, uint32_t mask, SyncData *data)
+{
+    uint32_t i = ptr_hash((uintptr_t)(objc_object *)data->object) & mask;
+    while (table[i]) i = (i+1) & mask;
+    table[i] = data;
+}
+
+static void syncDataRecycle(SyncTable& t, SyncData *data)
+{
+    if (t.freeCount < SyncFreeListMax) {
+        data->nextData = t.freeList;
+        t.freeList = data;
+        t.freeCount++;
+    } else {
+        data->lock.destroy();
+        free(data);
+    }
+}
+
+// Rebuilds the table without unused SyncData, 
+// with room for at least one more.
+static void syncTableRebuild(SyncTable& t)
+{
+    uint32_t live = 0;
+    for (uint32_t i = 0; t.table  &&  i <= t.mask; i++) {
+        SyncData *data = t.table[i];
+        if (data  &&  data->threadCount > 0) live++;
+    }
+
+    // Leave the new table at most half full.
+    uint32_t capacity = SyncTableMinCapacity;
+    while (capacity < 2 * (live + 1)) capacity *= 2;
+    SyncData **table = (SyncData **)calloc(capacity, sizeof(SyncData *));
+
+    for (uint32_t i = 0; t.table  &&  i <= t.mask; i++) {
+        SyncData *data = t.table[i];
+        if (!data) continue;
+        if (data->threadCount > 0) syncTableInsert(table, capacity - 1, data);
+        else syncDataRecycle(t, data);
+    }
+
+    free(t.table);
+    t.table = table;
+    t.mask = capacity - 1;
+    t.count = live;
+}
+
+
+// *transition is set if this thread's ACQUIRE wasn't recursive, 
+// so the caller must lock the SyncData, or if this thread's RELEASE 
+// was the last, so the caller must unlock the SyncData and then drop 
+// its threadCount.
+static SyncData* id2data(id object, enum usage why, bool *transition)
 {
-    spinlock_t *lockp = &LOCK_FOR_OBJ(object);
-    SyncData **listp = &LIST_FOR_OBJ(object);
+    SyncTable& t = sDataTables[object];
     SyncData* result = NULL;
 
 #if SUPPORT_DIRECT_THREAD_KEYS
@@ -142,8 +333,7 @@ static SyncData* id2data(id object, enum usage why)
                 if (lockCount == 0) {
                     // remove from fast cache
                     tls_set_direct(SYNC_DATA_DIRECT_KEY, NULL);
-                    // atomic because may collide with concurrent ACQUIRE
-                    OSAtomicDecrement32Barrier(&result->threadCount);
+                    *transition = true;
                 }
                 break;
             case CHECK:
@@ -179,8 +369,7 @@ static SyncData* id2data(id object, enum usage why)
                 if (item->lockCount == 0) {
                     // remove from per-thread cache
                     cache->list[i] = cache->list[--cache->used];
-                    // atomic because may collide with concurrent ACQUIRE
-                    OSAtomicDecrement32Barrier(&result->threadCount);
+                    *transition = true;
                 }
                 break;
             case CHECK:
@@ -193,54 +382,50 @@ static SyncData* id2data(id object, enum usage why)
     }
 
     // Thread cache didn't find anything.
-    // Walk in-use list looking for matching object
+    // Look up the object in the table.
     // Spinlock prevents multiple threads from creating multiple 
     // locks for the same new object.
-    // We could keep the nodes in some hash table if we find that there are
-    // more than 20 or so distinct locks active, but we don't do that now.
     
-    lockp->lock();
-
-    {
-        SyncData* p;
-        SyncData* firstUnused = NULL;
-        for (p = *listp; p != NULL; p = p->nextData) {
-            if ( p->object == object ) {
-                result = p;
-                // atomic because may collide with concurrent RELEASE
-                OSAtomicIncrement32Barrier(&result->threadCount);
-                goto done;
-            }
-            if ( (firstUnused == NULL) && (p->threadCount == 0) )
-                firstUnused = p;
-        }
-    
-        // no SyncData currently associated with object
-        if ( (why == RELEASE) || (why == CHECK) )
-            goto done;
-    
-        // an unused one was found, use it
-        if ( firstUnused != NULL ) {
-            result = firstUnused;
-            result->object = (objc_object *)object;
-            result->threadCount = 1;
-            goto done;
-        }
+    t.lock.lock();
+
+    result = syncTableFind(t, object);
+    if (result) {
+        // Another thread's RELEASE or CHECK doesn't own it.
+        if (why != ACQUIRE) result = NULL;
+        // atomic because may collide with concurrent RELEASE
+        else OSAtomicIncrement32Barrier(&result->threadCount);
+        goto done;
+    }
+
+    // no SyncData currently associated with object
+    if ( (why == RELEASE) || (why == CHECK) )
+        goto done;
+
+    if (!t.table  ||  4 * (t.count + 1) > 3 * (t.mask + 1)) {
+        syncTableRebuild(t);
     }
 
-    // malloc a new SyncData and add to list.
+    // Reuse a free SyncData, or malloc a new one.
     // XXX calling malloc with a global lock held is bad practice,
     // might be worth releasing the lock, mallocing, and searching again.
-    // But since we never free these guys we won't be stuck in malloc very often.
-    result = (SyncData*)calloc(sizeof(SyncData), 1);
+    // But since free SyncData is kept for reuse we won't be 
+    // stuck in malloc very often.
+    if (t.freeList) {
+        result = t.freeList;
+        t.freeList = result->nextData;
+        t.freeCount--;
+    } else {
+        result = (SyncData*)calloc(sizeof(SyncData), 1);
+        new (&result->lock) SyncLock();
+    }
+    result->nextData = NULL;
     result->object = (objc_object *)object;
     result->threadCount = 1;
-    new (&result->mutex) recursive_mutex_t();
-    result->nextData = *listp;
-    *listp = result;
+    syncTableInsert(t.table, t.mask, result);
+    t.count++;
     
  done:
-    lockp->unlock();
+    t.lock.unlock();
     if (result) {
         // Only new ACQUIRE should get here.
         // All RELEASE and CHECK and recursive ACQUIRE are 
@@ -252,6 +437,7 @@ static SyncData* id2data(id object, enum usage why)
         }
         if (why != ACQUIRE) _objc_fatal("id2data is buggy");
         if (result->object != object) _objc_fatal("id2data is buggy");
+        *transition = true;
 
 #if SUPPORT_DIRECT_THREAD_KEYS
         if (!fastCacheOccupied) {
@@ -279,16 +465,18 @@ BREAKPOINT_FUNCTION(
 
 
 // Begin synchronizing on 'obj'. 
-// Allocates recursive mutex associated with 'obj' if needed.
+// Allocates lock associated with 'obj' if needed.
 // Returns OBJC_SYNC_SUCCESS once lock is acquired.  
 int objc_sync_enter(id obj)
 {
     int result = OBJC_SYNC_SUCCESS;
 
     if (obj) {
-        SyncData* data = id2data(obj, ACQUIRE);
+        bool transition = false;
+        SyncData* data = id2data(obj, ACQUIRE, &transition);
         assert(data);
-        data->mutex.lock();
+        // Recursive acquires are counted by the thread caches.
+        if (transition) data->lock.lock();
     } else {
         // @synchronized(nil) does nothing
         if (DebugNilSync) {
@@ -308,14 +496,16 @@ int objc_sync_exit(id obj)
     int result = OBJC_SYNC_SUCCESS;
     
     if (obj) {
-        SyncData* data = id2data(obj, RELEASE); 
+        // Only threads that hold the lock find it in their caches.
+        bool transition = false;
+        SyncData* data = id2data(obj, RELEASE, &transition); 
         if (!data) {
             result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
-        } else {
-            bool okay = data->mutex.tryUnlock();
-            if (!okay) {
-                result = OBJC_SYNC_NOT_OWNING_THREAD_ERROR;
-            }
+        } else if (transition) {
+            data->lock.unlock();
+            // data may be freed once this thread's count is gone.
+            // atomic because may collide with concurrent ACQUIRE
+            OSAtomicDecrement32Barrier(&data->threadCount);
         }
     } else {
         // @synchronized(nil) does nothing
@@ -64,8 +64,10 @@ typedef objc_object ** weak_referrer_t;
  * It maintains and stores
  * a hash set of weak references pointing to an object.
  * If out_of_line==0, the set is instead a small inline array.
+ * An entry is four pointers and the table is aligned to the entry size, 
+ * so an entry's referent and inline referrers share one cache line.
  */
-#define WEAK_INLINE_COUNT 4
+#define WEAK_INLINE_COUNT 3
 struct weak_entry_t {
     DisguisedPtr<objc_object> referent;
     union {
@@ -74,7 +76,6 @@ struct weak_entry_t {
             uintptr_t        out_of_line : 1;
             uintptr_t        num_refs : PTR_MINUS_1;
             uintptr_t        mask;
-            uintptr_t        max_hash_displacement;
         };
         struct {
             // out_of_line=0 is LSB of one of these (don't care which)
@@ -86,12 +87,24 @@ struct weak_entry_t {
 /**
  * The global weak references table. Stores object ids as keys,
  * and weak_entry_t structs as their values.
+ * The table and the out-of-line referrer sets use Robin Hood hashing: 
+ * an insertion takes the slot of any entry closer to its home slot, 
+ * which keeps probe lengths short and lets a lookup stop early.
+ * Removal shifts the following entries back, so there are no tombstones.
+ * 
+ * Resizing is incremental. The previous table is kept as old_entries, 
+ * and each weak table operation moves a few of its entries into the 
+ * new table, so no single operation rehashes the whole table while 
+ * holding the side table lock. Lookups check both tables.
  */
 struct weak_table_t {
     weak_entry_t *weak_entries;
-    size_t    num_entries;
+    size_t    num_entries;      // in both tables
     uintptr_t mask;
-    uintptr_t max_hash_displacement;
+    weak_entry_t *old_entries;  // nil unless a resize is in progress
+    size_t    old_num_entries;
+    uintptr_t old_mask;
+    size_t    migrate_index;    // old_entries before this are empty
 };
 
 /// Adds an (object, weak pointer) pair to the weak table.
@@ -30,9 +30,18 @@
 #include <sys/types.h>
 #include <libkern/OSAtomic.h>
 
+#if __x86_64__
+#   include <emmintrin.h>
+#   define WEAK_CLEAR_SSE2 1
+#elif __arm64__  &&  __LP64__
+#   include <arm_neon.h>
+#   define WEAK_CLEAR_NEON 1
+#endif
+
 #define TABLE_SIZE(entry) (entry->mask ? entry->mask + 1 : 0)
 
-static void append_referrer(weak_entry_t *entry, objc_object **new_referrer);
+// weak_resize() aligns the table to the entry size.
+STATIC_ASSERT(sizeof(weak_entry_t) == 4 * sizeof(void *));
 
 BREAKPOINT_FUNCTION(
     void objc_weak_error(void)
@@ -60,6 +69,51 @@ static inline uintptr_t w_hash_pointer(objc_object **key) {
     return ptr_hash((uintptr_t)key);
 }
 
+/** 
+ * Distance of a referrer from its home slot in the entry's hash set.
+ */
+static inline size_t 
+referrer_displacement(weak_entry_t *entry, size_t index)
+{
+    return (index - w_hash_pointer(entry->referrers[index])) & entry->mask;
+}
+
+static void weak_unregister_error(objc_object **old_referrer)
+{
+    _objc_inform("Attempted to unregister unknown __weak variable "
+                 "at %p. This is probably incorrect use of "
+                 "objc_storeWeak() and objc_loadWeak(). "
+                 "Break on objc_weak_error to debug.\n", 
+                 old_referrer);
+    objc_weak_error();
+}
+
+/** 
+ * Insert a referrer into the entry's out-of-line hash set, 
+ * which must have room for it.
+ * Robin Hood hashing: the new referrer takes the slot of the first 
+ * referrer that is closer to its home, which then moves on in turn.
+ */
+static void insert_referrer(weak_entry_t *entry, objc_object **new_referrer)
+{
+    weak_referrer_t *referrers = entry->referrers;
+    size_t index = w_hash_pointer(new_referrer) & entry->mask;
+    size_t hash_displacement = 0;
+    while (referrers[index] != nil) {
+        size_t displacement = referrer_displacement(entry, index);
+        if (displacement < hash_displacement) {
+            weak_referrer_t tmp = referrers[index];
+            referrers[index] = new_referrer;
+            new_referrer = tmp;
+            hash_displacement = displacement;
+        }
+        index = (index+1) & entry->mask;
+        hash_displacement++;
+    }
+    referrers[index] = new_referrer;
+    entry->num_refs++;
+}
+
 /** 
  * Grow the entry's hash table of referrers. Rehashes each
  * of the referrers.
@@ -73,26 +127,23 @@ static void grow_refs_and_insert(weak_entry_t *entry,
     assert(entry->out_of_line);
 
     size_t old_size = TABLE_SIZE(entry);
-    size_t new_size = old_size ? old_size * 2 : 8;
+    size_t new_size = old_size * 2;
 
-    size_t num_refs = entry->num_refs;
     weak_referrer_t *old_refs = entry->referrers;
     entry->mask = new_size - 1;
     
     entry->referrers = (weak_referrer_t *)
         calloc(TABLE_SIZE(entry), sizeof(weak_referrer_t));
     entry->num_refs = 0;
-    entry->max_hash_displacement = 0;
     
-    for (size_t i = 0; i < old_size && num_refs > 0; i++) {
+    for (size_t i = 0; i < old_size; i++) {
         if (old_refs[i] != nil) {
-            append_referrer(entry, old_refs[i]);
-            num_refs--;
+            insert_referrer(entry, old_refs[i]);
         }
     }
     // Insert
-    append_referrer(entry, new_referrer);
-    if (old_refs) free(old_refs);
+    insert_referrer(entry, new_referrer);
+    free(old_refs);
 }
 
 /** 
@@ -114,19 +165,18 @@ static void append_referrer(weak_entry_t *entry, objc_object **new_referrer)
             }
         }
 
-        // Couldn't insert inline. Allocate out of line.
-        weak_referrer_t *new_referrers = (weak_referrer_t *)
-            calloc(WEAK_INLINE_COUNT, sizeof(weak_referrer_t));
-        // This constructed table is invalid, but grow_refs_and_insert
-        // will fix it and rehash it.
+        // Couldn't insert inline. Move the inline referrers out of line.
+        weak_referrer_t inline_referrers[WEAK_INLINE_COUNT];
+        memcpy(inline_referrers, entry->inline_referrers, 
+               sizeof(inline_referrers));
+        entry->referrers = (weak_referrer_t *)
+            calloc(8, sizeof(weak_referrer_t));
+        entry->num_refs = 0;
+        entry->out_of_line = 1;
+        entry->mask = 8-1;
         for (size_t i = 0; i < WEAK_INLINE_COUNT; i++) {
-            new_referrers[i] = entry->inline_referrers[i];
+            insert_referrer(entry, inline_referrers[i]);
         }
-        entry->referrers = new_referrers;
-        entry->num_refs = WEAK_INLINE_COUNT;
-        entry->out_of_line = 1;
-        entry->mask = WEAK_INLINE_COUNT-1;
-        entry->max_hash_displacement = 0;
     }
 
     assert(entry->out_of_line);
@@ -134,25 +184,14 @@ static void append_referrer(weak_entry_t *entry, objc_object **new_referrer)
     if (entry->num_refs >= TABLE_SIZE(entry) * 3/4) {
         return grow_refs_and_insert(entry, new_referrer);
     }
-    size_t index = w_hash_pointer(new_referrer) & (entry->mask);
-    size_t hash_displacement = 0;
-    while (entry->referrers[index] != NULL) {
-        index = (index+1) & entry->mask;
-        hash_displacement++;
-    }
-    if (hash_displacement > entry->max_hash_displacement) {
-        entry->max_hash_displacement = hash_displacement;
-    }
-    weak_referrer_t &ref = entry->referrers[index];
-    ref = new_referrer;
-    entry->num_refs++;
+    insert_referrer(entry, new_referrer);
 }
 
 /** 
  * Remove old_referrer from set of referrers, if it's present.
  * Does not remove duplicates, because duplicates should not exist. 
- * 
- * @todo this is slow if old_referrer is not present. Is this ever the case? 
+ * A missing referrer is found quickly: the search stops at the first 
+ * referrer closer to its home than old_referrer would be.
  *
  * @param entry The entry holding the referrers.
  * @param old_referrer The referrer to remove. 
@@ -166,82 +205,202 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
                 return;
             }
         }
-        _objc_inform("Attempted to unregister unknown __weak variable "
-                     "at %p. This is probably incorrect use of "
-                     "objc_storeWeak() and objc_loadWeak(). "
-                     "Break on objc_weak_error to debug.\n", 
-                     old_referrer);
-        objc_weak_error();
+        weak_unregister_error(old_referrer);
         return;
     }
 
+    weak_referrer_t *referrers = entry->referrers;
     size_t index = w_hash_pointer(old_referrer) & (entry->mask);
     size_t hash_displacement = 0;
-    while (entry->referrers[index] != old_referrer) {
-        index = (index+1) & entry->mask;
-        hash_displacement++;
-        if (hash_displacement > entry->max_hash_displacement) {
-            _objc_inform("Attempted to unregister unknown __weak variable "
-                         "at %p. This is probably incorrect use of "
-                         "objc_storeWeak() and objc_loadWeak(). "
-                         "Break on objc_weak_error to debug.\n", 
-                         old_referrer);
-            objc_weak_error();
+    while (referrers[index] != old_referrer) {
+        if (referrers[index] == nil  ||  
+            referrer_displacement(entry, index) < hash_displacement) 
+        {
+            weak_unregister_error(old_referrer);
             return;
         }
+        index = (index+1) & entry->mask;
+        hash_displacement++;
     }
-    entry->referrers[index] = nil;
+
+    // Shift the following referrers back until one is at its home.
+    size_t next = (index+1) & entry->mask;
+    while (referrers[next] != nil  &&  referrer_displacement(entry, next) > 0) {
+        referrers[index] = referrers[next];
+        index = next;
+        next = (next+1) & entry->mask;
+    }
+    referrers[index] = nil;
     entry->num_refs--;
 }
 
 /** 
- * Add new_entry to the object's table of weak references.
+ * Distance of an entry from its home slot in a table of entries.
+ */
+static inline size_t 
+weak_entry_displacement(weak_entry_t *weak_entries, uintptr_t mask, 
+                        size_t index)
+{
+    objc_object *referent = weak_entries[index].referent;
+    return (index - hash_pointer(referent)) & mask;
+}
+
+/** 
+ * Add new_entry to a table of entries, which must have room for it.
  * Does not check whether the referent is already in the table.
+ * Robin Hood hashing, like insert_referrer().
  */
-static void weak_entry_insert(weak_table_t *weak_table, weak_entry_t *new_entry)
+static void weak_entries_insert(weak_entry_t *weak_entries, uintptr_t mask, 
+                                weak_entry_t *new_entry)
 {
-    weak_entry_t *weak_entries = weak_table->weak_entries;
     assert(weak_entries != nil);
 
-    size_t index = hash_pointer(new_entry->referent) & (weak_table->mask);
+    weak_entry_t entry = *new_entry;
+    size_t index = hash_pointer(entry.referent) & mask;
     size_t hash_displacement = 0;
     while (weak_entries[index].referent != nil) {
-        index = (index+1) & weak_table->mask;
+        size_t displacement = 
+            weak_entry_displacement(weak_entries, mask, index);
+        if (displacement < hash_displacement) {
+            weak_entry_t tmp = weak_entries[index];
+            weak_entries[index] = entry;
+            entry = tmp;
+            hash_displacement = displacement;
+        }
+        index = (index+1) & mask;
         hash_displacement++;
     }
 
-    weak_entries[index] = *new_entry;
-    weak_table->num_entries++;
+    weak_entries[index] = entry;
+}
 
-    if (hash_displacement > weak_table->max_hash_displacement) {
-        weak_table->max_hash_displacement = hash_displacement;
+/** 
+ * Remove the entry at index from a table of entries.
+ * Shifts the following entries back until one is at its home slot.
+ */
+static void weak_entries_remove(weak_entry_t *weak_entries, uintptr_t mask, 
+                                size_t index)
+{
+    size_t next = (index+1) & mask;
+    while (weak_entries[next].referent != nil  &&  
+           weak_entry_displacement(weak_entries, mask, next) > 0) 
+    {
+        weak_entries[index] = weak_entries[next];
+        index = next;
+        next = (next+1) & mask;
     }
+    bzero(&weak_entries[index], sizeof(weak_entry_t));
 }
 
+/** 
+ * Find referent in a table of entries, or return nil.
+ * The search stops at the first entry closer to its home slot 
+ * than referent would be.
+ */
+static weak_entry_t *
+weak_entries_find(weak_entry_t *weak_entries, uintptr_t mask, 
+                  objc_object *referent)
+{
+    size_t index = hash_pointer(referent) & mask;
+    size_t hash_displacement = 0;
+    while (weak_entries[index].referent != referent) {
+        // Robin Hood: referent would have taken this slot.
+        if (weak_entries[index].referent == nil  ||  
+            weak_entry_displacement(weak_entries, mask, index) 
+            < hash_displacement)
+        {
+            return nil;
+        }
+        index = (index+1) & mask;
+        hash_displacement++;
+    }
+    
+    return &weak_entries[index];
+}
 
-static void weak_resize(weak_table_t *weak_table, size_t new_size)
+
+// Slots of the old table scanned, and entries moved, per operation 
+// while a resize is in progress.
+#define WEAK_MIGRATE_SLOTS 64
+#define WEAK_MIGRATE_ENTRIES 8
+
+/** 
+ * Move entries from the old table into the new one, scanning at most 
+ * max_slots slots of the old table and moving at most 
+ * WEAK_MIGRATE_ENTRIES entries. max_slots == SIZE_MAX moves every entry. 
+ * Frees the old table when it is empty.
+ * 
+ * Removing an old entry shifts the following entries back, which may 
+ * refill its slot, so the scan stays on a slot until it is empty. 
+ * A shift stops at an empty slot, so it never refills the slots 
+ * before migrate_index.
+ */
+static void weak_migrate(weak_table_t *weak_table, size_t max_slots)
 {
-    size_t old_size = TABLE_SIZE(weak_table);
+    weak_entry_t *old_entries = weak_table->old_entries;
+    if (!old_entries) return;
+
+    uintptr_t old_mask = weak_table->old_mask;
+    size_t old_size = old_mask + 1;
+    size_t index = weak_table->migrate_index;
+    size_t end = old_size - index > max_slots ? index + max_slots : old_size;
+    size_t max_entries = 
+        (max_slots == SIZE_MAX) ? SIZE_MAX : WEAK_MIGRATE_ENTRIES;
+    size_t moved = 0;
+
+    while (index < end  &&  weak_table->old_num_entries > 0) {
+        if (old_entries[index].referent == nil) {
+            index++;
+            continue;
+        }
+        weak_entries_insert(weak_table->weak_entries, weak_table->mask, 
+                            &old_entries[index]);
+        weak_entries_remove(old_entries, old_mask, index);
+        weak_table->old_num_entries--;
+        if (++moved == max_entries) break;
+    }
+    weak_table->migrate_index = index;
 
-    weak_entry_t *old_entries = weak_table->weak_entries;
-    weak_entry_t *new_entries = (weak_entry_t *)
-        calloc(new_size, sizeof(weak_entry_t));
+    if (weak_table->old_num_entries == 0) {
+        free(old_entries);
+        weak_table->old_entries = nil;
+        weak_table->old_mask = 0;
+        weak_table->migrate_index = 0;
+    }
+}
+
+
+/** 
+ * Replace the table with an empty one of new_size entries. 
+ * The current entries are moved over by later calls to weak_migrate().
+ */
+static void weak_resize(weak_table_t *weak_table, size_t new_size)
+{
+    // Only one resize at a time. Normally the previous one finished 
+    // long ago; if not, finish it now.
+    weak_migrate(weak_table, SIZE_MAX);
+    assert(!weak_table->old_entries);
+
+    // Aligned so that no entry straddles a cache line.
+    weak_entry_t *new_entries;
+    if (posix_memalign((void **)&new_entries, sizeof(weak_entry_t), 
+                       new_size * sizeof(weak_entry_t)) != 0) 
+    {
+        _objc_fatal("weak table allocation failed");
+    }
+    bzero(new_entries, new_size * sizeof(weak_entry_t));
 
+    if (weak_table->weak_entries) {
+        weak_table->old_entries = weak_table->weak_entries;
+        weak_table->old_mask = weak_table->mask;
+        weak_table->old_num_entries = weak_table->num_entries;
+        weak_table->migrate_index = 0;
+    }
+    // num_entries is unchanged: it counts both tables.
     weak_table->mask = new_size - 1;
     weak_table->weak_entries = new_entries;
-    weak_table->max_hash_displacement = 0;
-    weak_table->num_entries = 0;  // restored by weak_entry_insert below
     
-    if (old_entries) {
-        weak_entry_t *entry;
-        weak_entry_t *end = old_entries + old_size;
-        for (entry = old_entries; entry < end; entry++) {
-            if (entry->referent) {
-                weak_entry_insert(weak_table, entry);
-            }
-        }
-        free(old_entries);
-    }
+    weak_migrate(weak_table, WEAK_MIGRATE_SLOTS);
 }
 
 // Grow the given zone's table of weak references if it is full.
@@ -250,6 +409,8 @@ static void weak_grow_maybe(weak_table_t *weak_table)
     size_t old_size = TABLE_SIZE(weak_table);
 
     // Grow if at least 3/4 full.
+    // The new table is at most 3/8 full, and the old table empties 
+    // long before the new one reaches 3/4.
     if (weak_table->num_entries >= old_size * 3 / 4) {
         weak_resize(weak_table, old_size ? old_size*2 : 64);
     }
@@ -260,6 +421,9 @@ static void weak_compact_maybe(weak_table_t *weak_table)
 {
     size_t old_size = TABLE_SIZE(weak_table);
 
+    // Don't finish a resize in progress just to start another.
+    if (weak_table->old_entries) return;
+
     // Shrink if larger than 1024 buckets and at most 1/16 full.
     if (old_size >= 1024  && old_size / 16 >= weak_table->num_entries) {
         weak_resize(weak_table, old_size / 8);
@@ -268,14 +432,41 @@ static void weak_compact_maybe(weak_table_t *weak_table)
 }
 
 
+/**
+ * Add new_entry to the object's table of weak references.
+ * New entries always go in the new table.
+ */
+static void weak_entry_insert(weak_table_t *weak_table, weak_entry_t *new_entry)
+{
+    weak_entries_insert(weak_table->weak_entries, weak_table->mask, 
+                        new_entry);
+    weak_table->num_entries++;
+}
+
+
 /**
  * Remove entry from the zone's table of weak references.
+ * The entry may be in either table.
  */
 static void weak_entry_remove(weak_table_t *weak_table, weak_entry_t *entry)
 {
     // remove entry
     if (entry->out_of_line) free(entry->referrers);
-    bzero(entry, sizeof(*entry));
+
+    weak_entry_t *old_entries = weak_table->old_entries;
+    if (old_entries  &&  
+        entry >= old_entries  &&  entry <= old_entries + weak_table->old_mask)
+    {
+        weak_entries_remove(old_entries, weak_table->old_mask, 
+                            entry - old_entries);
+        weak_table->old_num_entries--;
+        // frees the old table if that was its last entry
+        weak_migrate(weak_table, 0);
+    }
+    else {
+        weak_entries_remove(weak_table->weak_entries, weak_table->mask, 
+                            entry - weak_table->weak_entries);
+    }
 
     weak_table->num_entries--;
 
@@ -286,7 +477,8 @@ static void weak_entry_remove(weak_table_t *weak_table, weak_entry_t *entry)
 /** 
  * Return the weak reference table entry for the given referent. 
  * If there is no entry for referent, return NULL. 
- * Performs a lookup.
+ * Performs a lookup in the new table, then in the old table 
+ * if a resize is in progress.
  *
  * @param weak_table 
  * @param referent The object. Must not be nil.
@@ -298,21 +490,16 @@ weak_entry_for_referent(weak_table_t *weak_table, objc_object *referent)
 {
     assert(referent);
 
-    weak_entry_t *weak_entries = weak_table->weak_entries;
-
-    if (!weak_entries) return nil;
+    if (!weak_table->weak_entries) return nil;
 
-    size_t index = hash_pointer(referent) & weak_table->mask;
-    size_t hash_displacement = 0;
-    while (weak_table->weak_entries[index].referent != referent) {
-        index = (index+1) & weak_table->mask;
-        hash_displacement++;
-        if (hash_displacement > weak_table->max_hash_displacement) {
-            return nil;
-        }
+    weak_entry_t *entry = 
+        weak_entries_find(weak_table->weak_entries, weak_table->mask, 
+                          referent);
+    if (!entry  &&  weak_table->old_entries) {
+        entry = weak_entries_find(weak_table->old_entries, 
+                                  weak_table->old_mask, referent);
     }
-    
-    return &weak_table->weak_entries[index];
+    return entry;
 }
 
 /** 
@@ -341,6 +528,8 @@ weak_unregister_no_lock(weak_table_t *weak_table, id referent_id,
 
     if (!referent) return;
 
+    weak_migrate(weak_table, WEAK_MIGRATE_SLOTS);
+
     if ((entry = weak_entry_for_referent(weak_table, referent))) {
         remove_referrer(entry, referrer);
         bool empty = true;
@@ -410,6 +599,8 @@ weak_register_no_lock(weak_table_t *weak_table, id referent_id,
         }
     }
 
+    weak_migrate(weak_table, WEAK_MIGRATE_SLOTS);
+
     // now remember it and where it is being stored
     weak_entry_t *entry;
     if ((entry = weak_entry_for_referent(weak_table, referent))) {
@@ -444,6 +635,63 @@ weak_is_registered_no_lock(weak_table_t *weak_table, id referent_id)
 #endif
 
 
+static inline void 
+weak_clear_referrer(objc_object **referrer, objc_object *referent)
+{
+    if (referrer) {
+        if (*referrer == referent) {
+            *referrer = nil;
+        }
+        else if (*referrer) {
+            _objc_inform("__weak variable at %p holds %p instead of %p. "
+                         "This is probably incorrect use of "
+                         "objc_storeWeak() and objc_loadWeak(). "
+                         "Break on objc_weak_error to debug.\n", 
+                         referrer, (void*)*referrer, (void*)referent);
+            objc_weak_error();
+        }
+    }
+}
+
+/** 
+ * Nils out each of count referrers that points to referent.
+ * An out-of-line set is at most 3/4 full and its size is a multiple 
+ * of four, so the vector versions skip groups of four empty slots 
+ * with one test.
+ */
+static void 
+weak_clear_referrers(weak_referrer_t *referrers, size_t count, 
+                     objc_object *referent)
+{
+    size_t i = 0;
+
+#if WEAK_CLEAR_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for ( ; i + 4 <= count; i += 4) {
+        const __m128i *p = (const __m128i *)&referrers[i];
+        __m128i any = _mm_or_si128(_mm_loadu_si128(p+0), 
+                                   _mm_loadu_si128(p+1));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, zero)) == 0xffff) continue;
+        for (size_t j = i; j < i + 4; j++) {
+            weak_clear_referrer(referrers[j], referent);
+        }
+    }
+#elif WEAK_CLEAR_NEON
+    for ( ; i + 4 <= count; i += 4) {
+        const uint64_t *p = (const uint64_t *)&referrers[i];
+        uint64x2_t any = vorrq_u64(vld1q_u64(p+0), vld1q_u64(p+2));
+        if (vmaxvq_u32(vreinterpretq_u32_u64(any)) == 0) continue;
+        for (size_t j = i; j < i + 4; j++) {
+            weak_clear_referrer(referrers[j], referent);
+        }
+    }
+#endif
+
+    for ( ; i < count; i++) {
+        weak_clear_referrer(referrers[i], referent);
+    }
+}
+
 /** 
  * Called by dealloc; nils out all weak pointers that point to the 
  * provided object so that they can no longer be used.
@@ -456,6 +704,8 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
 {
     objc_object *referent = (objc_object *)referent_id;
 
+    weak_migrate(weak_table, WEAK_MIGRATE_SLOTS);
+
     weak_entry_t *entry = weak_entry_for_referent(weak_table, referent);
     if (entry == nil) {
         /// XXX shouldn't happen, but does with mismatched CF/objc
@@ -464,33 +714,12 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
     }
 
     // zero out references
-    weak_referrer_t *referrers;
-    size_t count;
-    
     if (entry->out_of_line) {
-        referrers = entry->referrers;
-        count = TABLE_SIZE(entry);
+        weak_clear_referrers(entry->referrers, TABLE_SIZE(entry), referent);
     } 
     else {
-        referrers = entry->inline_referrers;
-        count = WEAK_INLINE_COUNT;
-    }
-    
-    for (size_t i = 0; i < count; ++i) {
-        objc_object **referrer = referrers[i];
-        if (referrer) {
-            if (*referrer == referent) {
-                *referrer = nil;
-            }
-            else if (*referrer) {
-                _objc_inform("__weak variable at %p holds %p instead of %p. "
-                             "This is probably incorrect use of "
-                             "objc_storeWeak() and objc_loadWeak(). "
-                             "Break on objc_weak_error to debug.\n", 
-                             referrer, (void*)*referrer, (void*)referent);
-                objc_weak_error();
-            }
-        }
+        weak_clear_referrers(entry->inline_referrers, WEAK_INLINE_COUNT, 
+                             referent);
     }
     
     weak_entry_remove(weak_table, entry);
@@ -0,0 +1,142 @@
+// TEST_CONFIG MEM=mrc
+
+// Classes set up with _class_setUsesInlineAssociations() keep their
+// instances' associated objects in a hidden slot after the ivars.
+// Associations on them behave like anyone else's, subclass ivars don't
+// overlap the slot, and object_copy() doesn't share the slot.
+// It is too late once instances exist or a subclass is used.
+// object_setClass() to a subclass keeps the associations.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define KEYS 8
+
+static int deallocs;
+
+@interface Value : NSObject @end
+@implementation Value
+-(void)dealloc {
+    deallocs++;
+    [super dealloc];
+}
+@end
+
+@interface Inline : NSObject {
+  @public
+    uintptr_t a;
+}
+@end
+@implementation Inline @end
+
+@interface InlineSub : Inline {
+  @public
+    uintptr_t b;
+}
+@end
+@implementation InlineSub @end
+
+@interface Plain : NSObject {
+    uintptr_t a;
+}
+@end
+@implementation Plain @end
+
+@interface Late : NSObject @end
+@implementation Late @end
+
+@interface LateSub : Late @end
+@implementation LateSub @end
+
+@interface Used : NSObject @end
+@implementation Used @end
+
+@interface Allocated : NSObject @end
+@implementation Allocated @end
+
+static char keys[KEYS];
+
+int main()
+{
+    Class cls = objc_getClass("Inline");
+    testassert(_class_setUsesInlineAssociations(cls));
+    testassert(_class_setUsesInlineAssociations(cls));
+    testassert(class_getInstanceSize(cls) ==
+               class_getInstanceSize([Plain class]) + sizeof(void *));
+
+    // Too late once a subclass has been used, 
+    // even if neither class is initialized.
+    testassert(class_getInstanceMethod(objc_getClass("LateSub"), @selector(self)));
+    testassert(!_class_setUsesInlineAssociations(objc_getClass("Late")));
+
+    // Too late once instances exist, with or without +initialize.
+    Used *used = [Used new];
+    testassert(!_class_setUsesInlineAssociations([Used class]));
+    testassert(class_getInstanceSize([Used class]) ==
+               class_getInstanceSize([NSObject class]));
+    [used release];
+    Class allocatedCls = objc_getClass("Allocated");
+    id allocated = class_createInstance(allocatedCls, 0);
+    testassert(!_class_setUsesInlineAssociations(allocatedCls));
+    testassert(class_getInstanceSize(allocatedCls) ==
+               class_getInstanceSize([NSObject class]));
+    object_dispose(allocated);
+
+    // Subclass ivars come after the slot.
+    InlineSub *sub = [InlineSub new];
+    testassert(class_getInstanceSize([InlineSub class]) >=
+               class_getInstanceSize(cls) + sizeof(uintptr_t));
+    sub->a = 1;
+    sub->b = 2;
+    id values[KEYS];
+    for (int i = 0; i < KEYS; i++) {
+        values[i] = [Value new];
+        objc_setAssociatedObject(sub, &keys[i], values[i], OBJC_ASSOCIATION_RETAIN);
+    }
+    testassert(sub->a == 1  &&  sub->b == 2);
+    for (int i = 0; i < KEYS; i++) {
+        testassert(objc_getAssociatedObject(sub, &keys[i]) == values[i]);
+        testassert([values[i] retainCount] == 2);
+    }
+
+    // Overwrite and remove by nil.
+    objc_setAssociatedObject(sub, &keys[0], values[1], OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    testassert([values[0] retainCount] == 1);
+    testassert(objc_getAssociatedObject(sub, &keys[0]) == values[1]);
+    objc_setAssociatedObject(sub, &keys[3], nil, OBJC_ASSOCIATION_ASSIGN);
+    testassert([values[3] retainCount] == 1);
+    testassert(objc_getAssociatedObject(sub, &keys[3]) == nil);
+    testassert(objc_getAssociatedObject(sub, &keys[4]) == values[4]);
+
+    // A subclass made at runtime shares the slot.
+    Class dynamic = objc_allocateClassPair([InlineSub class], "InlineDynamic", 0);
+    objc_registerClassPair(dynamic);
+    object_setClass(sub, dynamic);
+    testassert(objc_getAssociatedObject(sub, &keys[4]) == values[4]);
+    object_setClass(sub, [InlineSub class]);
+    testassert(objc_getAssociatedObject(sub, &keys[4]) == values[4]);
+
+    // Copies don't get the associations.
+    id copy = object_copy(sub, 0);
+    testassert(objc_getAssociatedObject(copy, &keys[4]) == nil);
+    [copy release];
+    testassert([values[4] retainCount] == 2);
+
+    // objc_removeAssociatedObjects, then dealloc.
+    objc_removeAssociatedObjects(sub);
+    for (int i = 0; i < KEYS; i++) {
+        testassert(objc_getAssociatedObject(sub, &keys[i]) == nil);
+        testassert([values[i] retainCount] == 1);
+    }
+    for (int i = 0; i < KEYS; i++) {
+        objc_setAssociatedObject(sub, &keys[i], values[i], OBJC_ASSOCIATION_RETAIN);
+        [values[i] release];
+    }
+    testassert(deallocs == 0);
+    [sub release];
+    testassert(deallocs == KEYS);
+
+    succeed(__FILE__);
+}
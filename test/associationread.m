@@ -0,0 +1,148 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_getAssociatedObject() reads associations with nonatomic getters
+// without taking the association lock. Readers must still see the
+// current value while another thread sets and removes associations,
+// and concurrent readers of nonatomic and atomic associations must all
+// see it.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+
+#define READERS 4
+#define OBJECTS 16
+#define READS 10000
+#define CHURN 20000
+
+static int deallocs;
+
+@interface Value : NSObject @end
+@implementation Value
+-(void)dealloc {
+    OSAtomicIncrement32(&deallocs);
+    [super dealloc];
+}
+@end
+
+static char key;
+static char otherKey;
+static id objects[OBJECTS];
+static id values[OBJECTS];
+static semaphore_t go;
+static semaphore_t done;
+static volatile int stop;
+
+static void *reader(void *arg __unused)
+{
+    semaphore_wait(go);
+    for (int i = 0; i < READS; i += 1000) {
+        // Atomic getters autorelease.
+        @autoreleasepool {
+            for (int j = i; j < i + 1000; j++) {
+                int n = j % OBJECTS;
+                id got = objc_getAssociatedObject(objects[n], &key);
+                testassert(got == values[n]);
+            }
+        }
+    }
+    semaphore_signal(done);
+    return NULL;
+}
+
+static void *churnReader(void *arg __unused)
+{
+    while (!stop) {
+        for (int n = 0; n < OBJECTS; n++) {
+            testassert(objc_getAssociatedObject(objects[n], &key) == values[n]);
+            id got = objc_getAssociatedObject(objects[n], &otherKey);
+            testassert(got == nil  ||  got == values[n]);
+        }
+    }
+    return NULL;
+}
+
+static void runReaders(void)
+{
+    pthread_t threads[READERS];
+    for (int t = 0; t < READERS; t++) {
+        pthread_create(&threads[t], NULL, &reader, NULL);
+    }
+    for (int t = 0; t < READERS; t++) semaphore_signal(go);
+    for (int t = 0; t < READERS; t++) semaphore_wait(done);
+    for (int t = 0; t < READERS; t++) pthread_join(threads[t], NULL);
+}
+
+static void setAll(objc_AssociationPolicy policy)
+{
+    for (int n = 0; n < OBJECTS; n++) {
+        objc_setAssociatedObject(objects[n], &key, values[n], policy);
+    }
+}
+
+int main()
+{
+    for (int n = 0; n < OBJECTS; n++) {
+        objects[n] = [NSObject new];
+        values[n] = [Value new];
+    }
+
+    // Every policy reads back what was set.
+    objc_AssociationPolicy policies[] = {
+        OBJC_ASSOCIATION_ASSIGN, OBJC_ASSOCIATION_RETAIN_NONATOMIC,
+        OBJC_ASSOCIATION_RETAIN, OBJC_ASSOCIATION_ASSIGN
+    };
+    for (size_t p = 0; p < sizeof(policies)/sizeof(policies[0]); p++) {
+        setAll(policies[p]);
+        for (int n = 0; n < OBJECTS; n++) {
+            testassert(objc_getAssociatedObject(objects[n], &key) == values[n]);
+            testassert(objc_getAssociatedObject(objects[n], &otherKey) == nil);
+            testassert([values[n] retainCount] ==
+                       (policies[p] == OBJC_ASSOCIATION_ASSIGN ? 1 : 2));
+        }
+    }
+
+    // Readers while another thread sets, clears, and removes associations.
+    setAll(OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    pthread_t churners[4];
+    for (int t = 0; t < 4; t++) {
+        pthread_create(&churners[t], NULL, &churnReader, NULL);
+    }
+    for (int i = 0; i < CHURN; i++) {
+        int n = i % OBJECTS;
+        objc_setAssociatedObject(objects[n], &otherKey, values[n],
+                                 OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        if (i % 3 == 0) {
+            objc_setAssociatedObject(objects[n], &otherKey, nil,
+                                     OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        }
+        if (i % 1000 == 0) {
+            // Grow the index with short-lived objects.
+            id temp = [NSObject new];
+            objc_setAssociatedObject(temp, &key, values[n], OBJC_ASSOCIATION_ASSIGN);
+            [temp release];
+        }
+    }
+    stop = 1;
+    for (int t = 0; t < 4; t++) pthread_join(churners[t], NULL);
+    for (int n = 0; n < OBJECTS; n++) {
+        objc_setAssociatedObject(objects[n], &otherKey, nil, OBJC_ASSOCIATION_ASSIGN);
+    }
+
+    // Concurrent readers.
+    semaphore_create(mach_task_self(), &go, 0, 0);
+    semaphore_create(mach_task_self(), &done, 0, 0);
+    setAll(OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+    runReaders();
+    setAll(OBJC_ASSOCIATION_RETAIN);
+    runReaders();
+
+    // Dealloc still removes everything.
+    for (int n = 0; n < OBJECTS; n++) {
+        [objects[n] release];
+        [values[n] release];
+    }
+    testassert(deallocs == OBJECTS);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,118 @@
+// TEST_CONFIG MEM=mrc
+
+// Associated objects are stored in stripes chosen by object address.
+// Threads getting and setting associations on their own objects at the
+// same time see only their own values.
+// Also checks objects with enough keys to move their associations from
+// the inline array to the flat array to the hash table and back out.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+
+#define THREADS 8
+#define OBJECTS 64
+#define OPS 10000
+#define KEYS 64
+
+static int deallocs;
+
+@interface Value : NSObject @end
+@implementation Value
+-(void)dealloc {
+    OSAtomicIncrement32(&deallocs);
+    [super dealloc];
+}
+@end
+
+static char keys[KEYS];
+static semaphore_t go;
+static semaphore_t done;
+
+static void *worker(void *arg __unused)
+{
+    id objects[OBJECTS];
+    id value = [Value new];
+    for (int i = 0; i < OBJECTS; i++) objects[i] = [NSObject new];
+
+    semaphore_wait(go);
+    for (int i = 0; i < OPS; i++) {
+        id obj = objects[i % OBJECTS];
+        void *key = &keys[i % 4];
+        if (i % 4 == 0) {
+            objc_setAssociatedObject(obj, key, value, OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+        } else {
+            id got = objc_getAssociatedObject(obj, key);
+            testassert(got == nil  ||  got == value);
+        }
+    }
+    semaphore_signal(done);
+
+    for (int i = 0; i < OBJECTS; i++) [objects[i] release];
+    [value release];
+    return NULL;
+}
+
+static void runThreads(void)
+{
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &worker, NULL);
+    }
+    for (int t = 0; t < THREADS; t++) semaphore_signal(go);
+    for (int t = 0; t < THREADS; t++) semaphore_wait(done);
+    for (int t = 0; t < THREADS; t++) pthread_join(threads[t], NULL);
+}
+
+int main()
+{
+    // Many keys on one object, including overwrites and removal by nil.
+    id obj = [NSObject new];
+    id values[KEYS];
+    for (int i = 0; i < KEYS; i++) {
+        values[i] = [Value new];
+        objc_setAssociatedObject(obj, &keys[i], values[i], OBJC_ASSOCIATION_RETAIN);
+        for (int j = 0; j <= i; j++) {
+            testassert(objc_getAssociatedObject(obj, &keys[j]) == values[j]);
+        }
+    }
+    for (int i = 0; i < KEYS; i++) {
+        testassert([values[i] retainCount] == 2);
+    }
+    for (int i = 0; i < KEYS; i += 2) {
+        objc_setAssociatedObject(obj, &keys[i], nil, OBJC_ASSOCIATION_RETAIN);
+        testassert([values[i] retainCount] == 1);
+    }
+    for (int i = 0; i < KEYS; i++) {
+        id expected = (i % 2) ? values[i] : nil;
+        testassert(objc_getAssociatedObject(obj, &keys[i]) == expected);
+    }
+    objc_setAssociatedObject(obj, &keys[1], values[0], OBJC_ASSOCIATION_RETAIN);
+    testassert([values[1] retainCount] == 1);
+    testassert(objc_getAssociatedObject(obj, &keys[1]) == values[0]);
+
+    // objc_removeAssociatedObjects releases everything.
+    objc_removeAssociatedObjects(obj);
+    for (int i = 0; i < KEYS; i++) {
+        testassert(objc_getAssociatedObject(obj, &keys[i]) == nil);
+        testassert([values[i] retainCount] == 1);
+    }
+
+    // Dealloc releases everything.
+    for (int i = 0; i < KEYS; i++) {
+        objc_setAssociatedObject(obj, &keys[i], values[i], OBJC_ASSOCIATION_RETAIN);
+        [values[i] release];
+    }
+    testassert(deallocs == 0);
+    [obj release];
+    testassert(deallocs == KEYS);
+    deallocs = 0;
+
+    // Many threads at once.
+    semaphore_create(mach_task_self(), &go, 0, 0);
+    semaphore_create(mach_task_self(), &done, 0, 0);
+    runThreads();
+    testassert(deallocs == THREADS);
+
+    succeed(__FILE__);
+}
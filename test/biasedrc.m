@@ -0,0 +1,197 @@
+// TEST_CONFIG MEM=mrc
+
+// Objects with biased retain counts are retained and released by their
+// allocating thread without atomic operations. Other threads can still
+// retain and release them, and releases they leave for the owner are
+// applied at autorelease pool pop, at _objc_handOffBiasedObjects(),
+// and when the owner exits.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define RETAINS 1000
+
+static int deallocs;
+
+@interface Biased : NSObject @end
+@implementation Biased
+-(void)dealloc {
+    deallocs++;
+    [super dealloc];
+}
+@end
+
+@interface BiasedSub : Biased @end
+@implementation BiasedSub @end
+
+@interface Plain : NSObject @end
+@implementation Plain @end
+
+#if __OBJC2__
+// OS_object's subclasses require a raw isa and override RR.
+@interface OS_object <NSObject>
++(id)new;
+@end
+
+@interface Sub_OS_object : OS_object @end
+@implementation Sub_OS_object @end
+#endif
+
+static id obj;
+
+static void *retainAndRelease(void *arg __unused)
+{
+    for (int i = 0; i < 100; i++) [obj retain];
+    testassert([obj retainCount] >= 100);
+    for (int i = 0; i < 100; i++) [obj release];
+
+    id weakVar = nil;
+    objc_storeWeak(&weakVar, obj);
+    id loaded = objc_loadWeakRetained(&weakVar);
+    testassert(loaded == obj);
+    [loaded release];
+    objc_storeWeak(&weakVar, nil);
+    return NULL;
+}
+
+static void *releaseOnly(void *arg __unused)
+{
+    [obj release];
+    return NULL;
+}
+
+static void *retainOnly(void *arg __unused)
+{
+    [obj retain];
+    return NULL;
+}
+
+#if __OBJC2__
+static void *changeClass(void *arg __unused)
+{
+    object_setClass(obj, [Sub_OS_object class]);
+    return NULL;
+}
+#endif
+
+static void *allocAndExit(void *arg __unused)
+{
+    obj = [Biased new];
+    [obj retain];
+    [obj retain];
+    [obj release];
+    return NULL;
+}
+
+static void runThread(void *(*fn)(void *))
+{
+    pthread_t th;
+    pthread_create(&th, NULL, fn, NULL);
+    pthread_join(th, NULL);
+}
+
+static void retainRelease(id o)
+{
+    for (int i = 0; i < RETAINS; i++) objc_retain(o);
+    testassert([o retainCount] == 1 + RETAINS);
+    for (int i = 0; i < RETAINS; i++) objc_release(o);
+}
+
+int main()
+{
+    _class_setUsesBiasedRetainCounts([Biased class]);
+
+    // Owner thread retains and releases.
+    obj = [BiasedSub new];
+    for (int i = 0; i < 1000; i++) [obj retain];
+    testassert([obj retainCount] == 1001);
+    for (int i = 0; i < 1000; i++) [obj release];
+    testassert([obj retainCount] == 1);
+    [obj release];
+    testassert(deallocs == 1);
+
+    // Weak references on the owner thread.
+    obj = [Biased new];
+    id weakVar = nil;
+    objc_storeWeak(&weakVar, obj);
+    id loaded = objc_loadWeakRetained(&weakVar);
+    testassert(loaded == obj);
+    testassert([obj retainCount] == 2);
+    [loaded release];
+    [obj release];
+    testassert(deallocs == 2);
+    testassert(objc_loadWeak(&weakVar) == nil);
+
+    // Another thread retains and releases.
+    obj = [Biased new];
+    [obj retain];
+    runThread(&retainAndRelease);
+    testassert([obj retainCount] == 2);
+    [obj release];
+    testassert(deallocs == 2);
+    [obj release];
+    testassert(deallocs == 3);
+
+    // Another thread releases the last reference.
+    // The owner applies it at autorelease pool pop.
+    obj = [Biased new];
+    runThread(&releaseOnly);
+    testassert(deallocs == 3);
+    void *pool = objc_autoreleasePoolPush();
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocs == 4);
+
+    // Same, with an explicit handoff.
+    obj = [Biased new];
+    [obj retain];
+    runThread(&releaseOnly);
+    testassert(deallocs == 4);
+    _objc_handOffBiasedObjects();
+    testassert([obj retainCount] == 1);
+    [obj release];
+    testassert(deallocs == 5);
+
+    // The owner exits while another thread holds the object.
+    runThread(&allocAndExit);
+    testassert([obj retainCount] == 2);
+    [obj release];
+    testassert(deallocs == 5);
+    [obj release];
+    testassert(deallocs == 6);
+
+#if __OBJC2__
+    // Changing the class to one that requires a raw isa 
+    // leaves the retain count alone, whichever thread does it.
+    // Use root* to avoid OS_object's overrides.
+    obj = [Biased new];
+    [obj retain];
+    runThread(&retainOnly);
+    object_setClass(obj, [Sub_OS_object class]);
+    testassert(_objc_rootRetainCount(obj) == 3);
+    testassert(!_objc_rootReleaseWasZero(obj));
+    testassert(!_objc_rootReleaseWasZero(obj));
+    testassert(_objc_rootReleaseWasZero(obj));
+
+    obj = [Biased new];
+    [obj retain];
+    runThread(&changeClass);
+    testassert(_objc_rootRetainCount(obj) == 2);
+    testassert(!_objc_rootReleaseWasZero(obj));
+    testassert(_objc_rootReleaseWasZero(obj));
+#endif
+
+    // The owner's counts match an ordinary object's.
+    id biased = [Biased new];
+    id plain = [Plain new];
+    retainRelease(biased);
+    retainRelease(plain);
+    testassert([biased retainCount] == 1);
+    testassert([plain retainCount] == 1);
+    [biased release];
+    [plain release];
+    testassert(deallocs == 7);
+
+    succeed(__FILE__);
+}
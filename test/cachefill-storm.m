@@ -0,0 +1,77 @@
+// TEST_CONFIG MEM=mrc
+
+// Method cache miss storm.
+// Many threads send many cold selectors to many classes at once.
+// Verifies that concurrent lock-free cache fills never return
+// the wrong IMP.
+
+#include "cachetest.h"
+#include "testroot.i"
+
+#define CLASSES 64
+#define SELECTORS 256
+#define ROUNDS 4
+#define THREADS 8
+
+static Class classes[CLASSES];
+static SEL selectors[SELECTORS];
+
+static volatile int32_t started;
+static volatile int32_t go;
+
+static void *threadfn(void *arg)
+{
+    unsigned t = (unsigned)(uintptr_t)arg;
+
+    OSAtomicIncrement32Barrier(&started);
+    while (!go) ;
+
+    // Each thread starts at a different class so that most fills
+    // land in unrelated caches, and then sweeps all of them so
+    // that some fills also collide in the same cache.
+    for (unsigned c = 0; c < CLASSES; c++) {
+        Class cls = classes[(c + t * (CLASSES / THREADS)) % CLASSES];
+        for (unsigned s = 0; s < SELECTORS; s++) {
+            SEL sel = selectors[(s + t) % SELECTORS];
+            testassert(cachetest_send(cls, sel) == (uintptr_t)sel);
+        }
+    }
+
+    return NULL;
+}
+
+static void storm(void)
+{
+    pthread_t threads[THREADS];
+
+    // Cold caches for every class.
+    _objc_flush_caches(nil);
+
+    started = 0;
+    go = 0;
+    for (unsigned t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &threadfn, (void *)(uintptr_t)t);
+    }
+    while (started != THREADS) ;
+
+    OSAtomicIncrement32Barrier(&go);
+    for (unsigned t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+}
+
+int main()
+{
+    cachetest_makeSelectors(selectors, SELECTORS, "storm");
+    for (unsigned c = 0; c < CLASSES; c++) {
+        char *name;
+        asprintf(&name, "Storm%u", c);
+        classes[c] = cachetest_makeClass([TestRoot class], name, 
+                                         selectors, SELECTORS);
+        free(name);
+    }
+
+    for (int r = 0; r < ROUNDS; r++) storm();
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,103 @@
+// TEST_CONFIG MEM=mrc
+
+// Method cache garbage reclamation.
+// Threads fill and hit caches while the main thread keeps flushing them.
+// Verifies that replaced caches are freed once the threads have moved
+// on, and reports how far reclamation lagged. Run with VERBOSE=2
+// to see the counters.
+
+#include "test.h"
+
+#if !__OBJC2__
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#else
+
+#include "cachetest.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+
+#define SELECTORS 512
+#define FILLERS 4
+#define SPINNERS 4
+#define FLUSHES 2000
+
+static Class cls;
+static SEL selectors[SELECTORS];
+static volatile int32_t stop;
+
+// Grows the cache over and over, creating garbage.
+static void *fillfn(void *arg __unused)
+{
+    while (!stop) {
+        PUSH_POOL {
+            for (unsigned s = 0; s < SELECTORS; s++) {
+                testassert(cachetest_send(cls, selectors[s]) == (uintptr_t)selectors[s]);
+            }
+        } POP_POOL;
+    }
+    return NULL;
+}
+
+// Mostly cache hits, so this thread rarely reaches a quiescent point.
+static void *spinfn(void *arg)
+{
+    SEL sel = selectors[(uintptr_t)arg];
+    while (!stop) {
+        testassert(cachetest_send(cls, sel) == (uintptr_t)sel);
+    }
+    return NULL;
+}
+
+int main()
+{
+    cachetest_makeSelectors(selectors, SELECTORS, "garbage");
+    cls = cachetest_makeClass([TestRoot class], "Garbage", selectors, SELECTORS);
+
+    pthread_t threads[FILLERS + SPINNERS];
+    for (uintptr_t t = 0; t < FILLERS; t++) {
+        pthread_create(&threads[t], NULL, &fillfn, NULL);
+    }
+    for (uintptr_t t = 0; t < SPINNERS; t++) {
+        pthread_create(&threads[FILLERS + t], NULL, &spinfn, (void *)t);
+    }
+
+    objc_cache_garbage_info_t info;
+    size_t maxPending = 0;
+    unsigned maxLagging = 0;
+    for (int i = 0; i < FLUSHES; i++) {
+        _objc_flush_caches(object_getClass(cls));
+        _objc_getCacheGarbageInfo(&info);
+        if (info.pendingBytes > maxPending) maxPending = info.pendingBytes;
+        if (info.laggingThreads > maxLagging) maxLagging = info.laggingThreads;
+    }
+
+    OSAtomicIncrement32Barrier(&stop);
+    for (int t = 0; t < FILLERS + SPINNERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    _objc_getCacheGarbageInfo(&info);
+    testprintf("epoch %lu, max pending %zu bytes, max lagging %u threads, "
+               "%u PC checks, %zu bytes freed\n",
+               (unsigned long)info.epoch, maxPending, maxLagging,
+               info.pcChecks, info.freedBytes);
+    testassert(info.epoch > 0);
+    testassert(info.freedBytes > 0);
+
+    // All other threads are gone, so everything is collectable.
+    _objc_flush_caches(nil);
+    _objc_getCacheGarbageInfo(&info);
+    testassert(info.pendingBytes == 0);
+    testassert(info.pendingCount == 0);
+    testassert(info.oldestPendingEpoch == 0);
+    testassert(info.laggingThreads == 0);
+
+    succeed(__FILE__);
+}
+
+#endif
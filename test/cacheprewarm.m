@@ -0,0 +1,93 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_cache_prewarm() fills a cache in one allocation,
+// and runs +initialize and the method resolvers like a message send would.
+
+#include "test.h"
+
+#if !__OBJC2__
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#else
+
+#include "cachetest.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+
+#define SELECTORS 200
+
+static SEL selectors[SELECTORS];
+static int initialized;
+static int resolved;
+static SEL resolvedSel;
+
+@interface Prewarm : TestRoot @end
+@implementation Prewarm
++(void)initialize {
+    if (self == [Prewarm class]) initialized++;
+}
++(BOOL)resolveClassMethod:(SEL)sel {
+    if (sel == resolvedSel) {
+        resolved++;
+        class_addMethod(object_getClass(self), sel, (IMP)cachetest_imp, "L@:");
+        return YES;
+    }
+    return NO;
+}
+@end
+
+static uintptr_t cacheEpoch(void)
+{
+    objc_cache_garbage_info_t info;
+    _objc_getCacheGarbageInfo(&info);
+    return info.epoch;
+}
+
+int main()
+{
+    cachetest_makeSelectors(selectors, SELECTORS, "prewarm");
+
+    // Filling a cold cache by messaging replaces it several times.
+    Class cold = cachetest_makeClass([TestRoot class], "Cold", selectors, SELECTORS);
+    uintptr_t epoch = cacheEpoch();
+    for (unsigned s = 0; s < SELECTORS; s++) {
+        testassert(cachetest_send(cold, selectors[s]) == (uintptr_t)selectors[s]);
+    }
+    testassert(cacheEpoch() > epoch + 1);
+
+    // Prewarming allocates the cache once. Only the small cache 
+    // filled by +initialize is replaced.
+    Class warm = cachetest_makeClass([TestRoot class], "Warm", selectors, SELECTORS);
+    epoch = cacheEpoch();
+    objc_cache_prewarm(object_getClass(warm), selectors, SELECTORS);
+    testassert(cacheEpoch() <= epoch + 1);
+    epoch = cacheEpoch();
+    for (unsigned s = 0; s < SELECTORS; s++) {
+        testassert(cachetest_send(warm, selectors[s]) == (uintptr_t)selectors[s]);
+    }
+    testassert(cacheEpoch() == epoch);
+
+    // +initialize and resolvers run, once each.
+    resolvedSel = sel_registerName("resolved");
+    SEL sels[] = { resolvedSel, @selector(class), resolvedSel };
+    Class meta = objc_getMetaClass("Prewarm");
+    testassert(initialized == 0);
+    objc_cache_prewarm(meta, sels, 3);
+    testassert(initialized == 1);
+    testassert(resolved == 1);
+    testassert(cachetest_send([Prewarm class], resolvedSel) == (uintptr_t)resolvedSel);
+    testassert(resolved == 1);
+
+    // Bad arguments are ignored.
+    objc_cache_prewarm(nil, sels, 3);
+    objc_cache_prewarm(meta, NULL, 3);
+    objc_cache_prewarm(meta, sels, 0);
+
+    succeed(__FILE__);
+}
+
+#endif
@@ -0,0 +1,81 @@
+// TEST_CONFIG
+
+// Method cache bucket probing.
+// Compares the vector probe with the scalar loop at several load
+// factors. Verifies that both find the same bucket for every key.
+
+#include "test.h"
+#include "../runtime/objc-cache-probe.h"
+
+#define CAPACITY 1024
+#define LOOKUPS (CAPACITY * 4)
+
+static cache_probe_bucket_t buckets[CAPACITY];
+static uintptr_t present[CAPACITY];
+static uintptr_t queries[LOOKUPS];
+
+static uintptr_t makeKey(uint32_t n)
+{
+    // Selector-like: nonzero, aligned, and spread out.
+    return ((uintptr_t)n * 0x9E3779B1u + 1) << 3;
+}
+
+static uint32_t hashKey(uintptr_t key)
+{
+    return (uint32_t)(key & (CAPACITY - 1));
+}
+
+static void fill(unsigned percent)
+{
+    bzero(buckets, sizeof(buckets));
+    unsigned count = CAPACITY * percent / 100;
+    for (unsigned n = 0; n < count; n++) {
+        uintptr_t key = makeKey(n);
+        uint32_t i = cache_probe_scalar(buckets, CAPACITY - 1,
+                                        key, hashKey(key), CAPACITY);
+        testassert(i != CACHE_PROBE_NONE);
+        buckets[i].key = key;
+        buckets[i].imp = key;
+        present[n] = key;
+    }
+
+    // Half hits, half misses.
+    for (unsigned q = 0; q < LOOKUPS; q++) {
+        queries[q] = (q & 1) ? present[q % count] : makeKey(count + q);
+    }
+}
+
+int main()
+{
+    // Wrap-around and partial groups, with every start index and count.
+    fill(50);
+    for (uint32_t i = 0; i < CAPACITY; i++) {
+        uintptr_t key = queries[i];
+        for (uint32_t count = 0; count <= 9; count++) {
+            testassert(cache_probe(buckets, CAPACITY - 1, key, i, count) ==
+                       cache_probe_scalar(buckets, CAPACITY - 1, key, i, count));
+        }
+    }
+
+    // Caches too small for a whole group.
+    cache_probe_bucket_t tiny[2] = { { makeKey(1), 0 }, { 0, 0 } };
+    testassert(cache_probe(tiny, 1, makeKey(1), 1, 2) == 1);
+    testassert(cache_probe(tiny, 1, makeKey(2), 0, 1) == CACHE_PROBE_NONE);
+
+    static const unsigned loads[] = { 25, 50, 75 };
+    for (unsigned l = 0; l < sizeof(loads)/sizeof(loads[0]); l++) {
+        fill(loads[l]);
+
+        for (unsigned q = 0; q < LOOKUPS; q++) {
+            uintptr_t key = queries[q];
+            uint32_t i = cache_probe(buckets, CAPACITY - 1,
+                                     key, hashKey(key), CAPACITY);
+            testassert(i == cache_probe_scalar(buckets, CAPACITY - 1,
+                                               key, hashKey(key), CAPACITY));
+            testassert(i != CACHE_PROBE_NONE);
+            testassert(buckets[i].key == key  ||  buckets[i].key == 0);
+        }
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,91 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_CACHE_SHRINK_FLUSHES=2
+
+// A method cache that stays sparse across flushes shrinks,
+// and keeps returning the right IMPs while it does.
+
+#include "test.h"
+
+#if !__OBJC2__
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#else
+
+#include "cachetest.h"
+#include "testroot.i"
+
+#define SELECTORS 256
+#define HOT 4
+
+static SEL selectors[SELECTORS];
+
+// objc_class layout, for peeking at the cache's mask.
+#if __LP64__
+typedef uint32_t mask_t;
+#else
+typedef uint16_t mask_t;
+#endif
+struct peek_class {
+    Class isa;
+    Class superclass;
+    void *buckets;
+    mask_t mask;
+    mask_t occupied;
+};
+
+static uint32_t cacheMask(Class cls)
+{
+    return ((struct peek_class *)cls)->mask;
+}
+
+static void sendAll(Class cls, unsigned count)
+{
+    for (unsigned s = 0; s < count; s++) {
+        testassert(cachetest_send(cls, selectors[s]) == (uintptr_t)selectors[s]);
+    }
+}
+
+int main()
+{
+    cachetest_makeSelectors(selectors, SELECTORS, "shrink");
+    Class cls = cachetest_makeClass([TestRoot class], "Shrink", selectors, SELECTORS);
+    Class meta = object_getClass(cls);
+
+    // A burst of selectors grows the cache.
+    sendAll(cls, SELECTORS);
+    uint32_t bigMask = cacheMask(meta);
+    testassert(bigMask + 1 >= SELECTORS);
+
+    // A full cache is not sparse.
+    _objc_flush_caches(meta);
+    testassert(cacheMask(meta) == bigMask);
+
+    // Sparse once: no change yet.
+    sendAll(cls, HOT);
+    _objc_flush_caches(meta);
+    testassert(cacheMask(meta) == bigMask);
+
+    // Sparse twice: shrink.
+    sendAll(cls, HOT);
+    _objc_flush_caches(meta);
+    uint32_t smallMask = cacheMask(meta);
+    testprintf("mask 0x%x => 0x%x\n", bigMask, smallMask);
+    testassert(smallMask < bigMask);
+    testassert(smallMask + 1 >= HOT * 2);
+
+    // The smaller cache is allocated on the next fill.
+    sendAll(cls, HOT);
+    testassert(cacheMask(meta) == smallMask);
+
+    // It grows again as needed.
+    sendAll(cls, SELECTORS);
+    testassert(cacheMask(meta) + 1 >= SELECTORS);
+
+    succeed(__FILE__);
+}
+
+#endif
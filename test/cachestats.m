@@ -0,0 +1,101 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_copyCacheStatistics() reports per-class cache shape and misses,
+// and process-wide totals added up over all threads.
+
+#include "test.h"
+
+#if !__OBJC2__
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#else
+
+#include "cachetest.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+
+#define SELECTORS 100
+
+static Class cls;
+static SEL selectors[SELECTORS];
+
+static void *sendAll(void *arg __unused)
+{
+    for (unsigned s = 0; s < SELECTORS; s++) {
+        testassert(cachetest_send(cls, selectors[s]) == (uintptr_t)selectors[s]);
+    }
+    return NULL;
+}
+
+static objc_class_cache_stats_t
+statsForClass(Class c, objc_cache_totals_t *totals)
+{
+    unsigned int count;
+    objc_class_cache_stats_t *list = objc_copyCacheStatistics(&count, totals);
+    testassert(list);
+    testassert(count > 0);
+
+    objc_class_cache_stats_t result;
+    bool found = false;
+    for (unsigned int i = 0; i < count; i++) {
+        if (i > 0) testassert(list[i-1].misses >= list[i].misses);
+        if (list[i].cls == c) {
+            result = list[i];
+            found = true;
+        }
+    }
+    free(list);
+    testassert(found);
+    return result;
+}
+
+int main()
+{
+    cachetest_makeSelectors(selectors, SELECTORS, "stats");
+    cls = cachetest_makeClass([TestRoot class], "Stats", selectors, SELECTORS);
+    Class meta = object_getClass(cls);
+
+    objc_cache_totals_t before;
+    objc_class_cache_stats_t stats = statsForClass(meta, &before);
+
+    // Misses on another thread show up in the totals
+    // after that thread is gone.
+    pthread_t th;
+    pthread_create(&th, NULL, &sendAll, NULL);
+    pthread_join(th, NULL);
+    sendAll(NULL);  // all hits
+
+    objc_cache_totals_t after;
+    objc_class_cache_stats_t stats2 = statsForClass(meta, &after);
+
+    testprintf("capacity %u, occupied %u, misses %llu, reallocations %u\n",
+               stats2.capacity, stats2.occupied,
+               stats2.misses, stats2.reallocations);
+    testassert(stats2.misses >= stats.misses + SELECTORS);
+    testassert(stats2.reallocations > stats.reallocations);
+    testassert(stats2.occupied >= SELECTORS);
+    testassert(stats2.capacity > stats2.occupied);
+
+    uint32_t entries = 0;
+    for (unsigned i = 0; i < sizeof(stats2.probeCounts)/sizeof(stats2.probeCounts[0]); i++) {
+        testprintf("probe %u: %u\n", i, stats2.probeCounts[i]);
+        entries += stats2.probeCounts[i];
+    }
+    testassert(entries == stats2.occupied);
+
+    testassert(after.misses >= before.misses + SELECTORS);
+    testassert(after.fills + after.lockfreeFills >=
+               before.fills + before.lockfreeFills + SELECTORS);
+    testassert(after.reallocations > before.reallocations);
+
+    // Statistics for every class can be read without a count.
+    free(objc_copyCacheStatistics(NULL, NULL));
+
+    succeed(__FILE__);
+}
+
+#endif
@@ -0,0 +1,46 @@
+// This file is used in the method cache tests.
+// Their methods return the selector they were called with, 
+// so every send can check that it reached the right IMP.
+
+#include "test.h"
+#include <objc/runtime.h>
+#include <objc/message.h>
+
+static inline uintptr_t cachetest_imp(id self __unused, SEL _cmd)
+{
+    return (uintptr_t)_cmd;
+}
+
+static inline uintptr_t cachetest_send(id obj, SEL sel)
+{
+    return ((uintptr_t(*)(id, SEL))objc_msgSend)(obj, sel);
+}
+
+// Registers count selectors named prefix0, prefix1, ...
+static inline void 
+cachetest_makeSelectors(SEL *selectors, unsigned count, const char *prefix)
+{
+    for (unsigned s = 0; s < count; s++) {
+        char *name;
+        asprintf(&name, "%s%u", prefix, s);
+        selectors[s] = sel_registerName(name);
+        free(name);
+    }
+}
+
+// Makes a subclass of superclass with a cachetest_imp class method 
+// for each of count selectors, so sends need no instances. 
+// Runs its +initialize.
+static inline Class 
+cachetest_makeClass(Class superclass, const char *name, 
+                    SEL *selectors, unsigned count)
+{
+    Class cls = objc_allocateClassPair(superclass, name, 0);
+    for (unsigned s = 0; s < count; s++) {
+        class_addMethod(object_getClass(cls), selectors[s],
+                        (IMP)cachetest_imp, "L@:");
+    }
+    objc_registerClassPair(cls);
+    [cls class];  // +initialize
+    return cls;
+}
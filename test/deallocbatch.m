@@ -0,0 +1,145 @@
+// TEST_CONFIG MEM=mrc
+
+// Objects deallocated inside objc_deallocBatchPush() and
+// objc_deallocBatchPop() have their weak references cleared and are
+// freed by the batch. Weak loads return nil as soon as an object
+// starts deallocating, before the batch clears its weak variables.
+// Weakly referenced objects with custom RR are not batched, so weak
+// loads never send -retainWeakReference to a destroyed object.
+// Object trees bigger than one batch are released with and without a
+// batch, with and without weak references to their nodes.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+// More than one batch's worth.
+#define NODES 3000
+
+static int deallocs;
+
+@interface Node : NSObject {
+  @public
+    Node *left;
+    Node *right;
+}
+@end
+@implementation Node
+-(void)dealloc {
+    deallocs++;
+    [left release];
+    [right release];
+    [super dealloc];
+}
+@end
+
+// Custom RR.
+@interface CustomNode : Node @end
+static bool customDestroyed;
+static bool messagedAfterDestroy;
+@implementation CustomNode
+-(BOOL)retainWeakReference {
+    if (customDestroyed) messagedAfterDestroy = true;
+    return [super retainWeakReference];
+}
+-(void)dealloc {
+    customDestroyed = true;
+    [super dealloc];
+}
+@end
+
+static id *vars;
+
+// Complete binary tree of count nodes, numbered breadth first.
+static Node *makeTree(size_t count, bool weak)
+{
+    Node **nodes = (Node **)malloc(count * sizeof(Node *));
+    for (size_t i = 0; i < count; i++) {
+        nodes[i] = [Node new];
+        if (weak) objc_initWeak(&vars[i], nodes[i]);
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (2*i+1 < count) nodes[i]->left = nodes[2*i+1];
+        if (2*i+2 < count) nodes[i]->right = nodes[2*i+2];
+    }
+    Node *root = nodes[0];
+    free(nodes);
+    return root;
+}
+
+static void releaseTree(size_t count, bool weak, bool batch)
+{
+    Node *root = makeTree(count, weak);
+    deallocs = 0;
+
+    void *token = batch ? objc_deallocBatchPush() : NULL;
+    [root release];
+    if (batch) objc_deallocBatchPop(token);
+
+    testassert(deallocs == (int)count);
+    if (weak) {
+        for (size_t i = 0; i < count; i++) {
+            testassert(vars[i] == nil);
+            objc_destroyWeak(&vars[i]);
+        }
+    }
+}
+
+int main()
+{
+    vars = (id *)calloc(NODES, sizeof(id));
+
+    // Weak loads inside the batch return nil.
+    void *token = objc_deallocBatchPush();
+    Node *obj = [Node new];
+    id weakVar = nil;
+    objc_initWeak(&weakVar, obj);
+    [obj release];
+    testassert(deallocs == 1);
+    testassert(objc_loadWeakRetained(&weakVar) == nil);
+
+    // Nested batches flush at the outermost pop.
+    void *inner = objc_deallocBatchPush();
+    id autoreleased = [[Node new] autorelease];
+    id weakVar2 = nil;
+    objc_initWeak(&weakVar2, autoreleased);
+    objc_deallocBatchPop(inner);
+    testassert(deallocs == 2);
+    testassert(objc_loadWeak(&weakVar2) == nil);
+
+    // Custom RR objects have their weak variables cleared right away.
+    CustomNode *custom = [CustomNode new];
+    id weakVar3 = nil;
+    objc_initWeak(&weakVar3, custom);
+    testassert(weakVar3 == custom);
+    [custom release];
+    testassert(deallocs == 3);
+    testassert(customDestroyed);
+    testassert(weakVar3 == nil);
+    testassert(objc_loadWeakRetained(&weakVar3) == nil);
+    testassert(!messagedAfterDestroy);
+
+    objc_deallocBatchPop(token);
+    testassert(weakVar == nil);
+    testassert(weakVar2 == nil);
+    objc_destroyWeak(&weakVar);
+    objc_destroyWeak(&weakVar2);
+    objc_destroyWeak(&weakVar3);
+
+    // Objects deallocated after the pop are freed immediately.
+    obj = [Node new];
+    objc_initWeak(&weakVar, obj);
+    [obj release];
+    testassert(weakVar == nil);
+    objc_destroyWeak(&weakVar);
+
+    for (int weak = 0; weak <= 1; weak++) {
+        releaseTree(NODES, weak, false);
+        releaseTree(NODES, weak, true);
+    }
+
+    free(vars);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,9 @@
+// This file is used in the flushbatch.m test
+
+#include "test.h"
+
+// flushbatch_categories.m adds 256 categories to FlushTarget.
+// One of them replaces +value to return 1.
+@interface FlushTarget : TestRoot
++(int)value;
+@end
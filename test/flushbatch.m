@@ -0,0 +1,54 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_BUILD
+    $C{COMPILE} $DIR/flushbatch.m -o flushbatch.out
+    $C{COMPILE} -undefined dynamic_lookup -dynamiclib $DIR/flushbatch_categories.m -o flushbatch.dylib
+END
+*/
+
+// Loading an image with many categories on a class with many 
+// subclasses. Verifies that every subclass's cache sees the new 
+// methods. 
+
+#include "flushbatch.h"
+#include "cachetest.h"
+#include "testroot.i"
+#include <dlfcn.h>
+
+#define SUBCLASSES 1000
+
+@implementation FlushTarget
++(int)value { return 0; }
+@end
+
+static Class subclasses[SUBCLASSES];
+
+static int send(Class cls, SEL sel)
+{
+    return ((int(*)(id, SEL))objc_msgSend)(cls, sel);
+}
+
+int main(int argc __unused, char **argv)
+{
+    for (unsigned c = 0; c < SUBCLASSES; c++) {
+        char *name;
+        asprintf(&name, "FlushSub%u", c);
+        subclasses[c] = cachetest_makeClass([FlushTarget class], name, NULL, 0);
+        free(name);
+        testassert([subclasses[c] value] == 0);  // realized and cached
+    }
+
+    void *dylib = dlopen("flushbatch.dylib", RTLD_LAZY);
+    testassert(dylib);
+
+    SEL first = sel_registerName("cat00");
+    SEL last = sel_registerName("catff");
+    for (unsigned c = 0; c < SUBCLASSES; c++) {
+        testassert([subclasses[c] value] == 1);
+        testassert(send(subclasses[c], first) == 1);
+        testassert(send(subclasses[c], last) == 1);
+    }
+    testassert([FlushTarget value] == 1);
+
+    succeed(basename(argv[0]));
+}
@@ -0,0 +1,25 @@
+// This file is used in the flushbatch*.m tests
+
+#include "flushbatch.h"
+
+#define CAT(n)                                  \
+    @interface FlushTarget (Cat##n) @end        \
+    @implementation FlushTarget (Cat##n)        \
+    +(int)cat##n { return 1; }                  \
+    @end
+
+#define CAT16(n)                                \
+    CAT(n##0) CAT(n##1) CAT(n##2) CAT(n##3)     \
+    CAT(n##4) CAT(n##5) CAT(n##6) CAT(n##7)     \
+    CAT(n##8) CAT(n##9) CAT(n##a) CAT(n##b)     \
+    CAT(n##c) CAT(n##d) CAT(n##e) CAT(n##f)
+
+CAT16(0) CAT16(1) CAT16(2) CAT16(3)
+CAT16(4) CAT16(5) CAT16(6) CAT16(7)
+CAT16(8) CAT16(9) CAT16(a) CAT16(b)
+CAT16(c) CAT16(d) CAT16(e) CAT16(f)
+
+@interface FlushTarget (Value) @end
+@implementation FlushTarget (Value)
++(int)value { return 1; }
+@end
@@ -0,0 +1,130 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_imp_cache_lookup() returns the same IMP as
+// class_getMethodImplementation() through method replacement,
+// method exchange, method addition, and concurrent refills.
+
+#include "test.h"
+
+#if !__OBJC2__
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#else
+
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/message.h>
+#include <objc/objc-internal.h>
+
+#define THREADS 4
+
+@interface Base : TestRoot @end
+@implementation Base
+-(int)value { return 1; }
+-(int)other { return 2; }
+@end
+
+@interface Derived : Base @end
+@implementation Derived @end
+
+static int replacement(id self __unused, SEL _cmd __unused)
+{
+    return 3;
+}
+
+static int override(id self __unused, SEL _cmd __unused)
+{
+    return 4;
+}
+
+static int call(objc_imp_cache_t *cache, id obj, SEL sel)
+{
+    IMP imp = objc_imp_cache_lookup(cache, obj, sel);
+    testassert(imp == class_getMethodImplementation(object_getClass(obj), sel));
+    return ((int(*)(id, SEL))imp)(obj, sel);
+}
+
+static objc_imp_cache_t shared = OBJC_IMP_CACHE_INITIALIZER;
+static id objects[2];
+static volatile int32_t stop;
+
+static void *threadfn(void *arg __unused)
+{
+    SEL sel = @selector(value);
+    IMP imps[2] = {
+        class_getMethodImplementation([Base class], sel),
+        class_getMethodImplementation([Derived class], sel),
+    };
+    for (unsigned i = 0; !stop; i++) {
+        testassert(objc_imp_cache_lookup(&shared, objects[i&1], sel) == imps[i&1]);
+    }
+    return NULL;
+}
+
+int main()
+{
+    objc_imp_cache_t cache = OBJC_IMP_CACHE_INITIALIZER;
+    Base *base = [Base new];
+    Derived *derived = [Derived new];
+    SEL value = @selector(value);
+
+    testassert(objc_imp_cache_lookup(&cache, nil, value) == nil);
+    testassert(call(&cache, base, value) == 1);
+    testassert(call(&cache, base, value) == 1);
+
+    // Polymorphic call site.
+    testassert(call(&cache, derived, value) == 1);
+    testassert(call(&cache, base, value) == 1);
+
+    // Different selector through the same cache.
+    testassert(call(&cache, base, @selector(other)) == 2);
+
+    // Unimplemented.
+    testassert(objc_imp_cache_lookup(&cache, base, sel_registerName("unimplemented")) ==
+               (IMP)_objc_msgForward);
+
+    // method_setImplementation
+    testassert(call(&cache, derived, value) == 1);
+    Method m = class_getInstanceMethod([Base class], value);
+    IMP original = method_setImplementation(m, (IMP)replacement);
+    testassert(call(&cache, derived, value) == 3);
+    method_setImplementation(m, original);
+    testassert(call(&cache, derived, value) == 1);
+
+    // method_exchangeImplementations
+    method_exchangeImplementations(m, class_getInstanceMethod([Base class], @selector(other)));
+    testassert(call(&cache, derived, value) == 2);
+    method_exchangeImplementations(m, class_getInstanceMethod([Base class], @selector(other)));
+    testassert(call(&cache, derived, value) == 1);
+
+    // class_addMethod overriding a superclass method
+    class_addMethod([Derived class], value, (IMP)override, "i@:");
+    testassert(call(&cache, derived, value) == 4);
+    testassert(call(&cache, base, value) == 1);
+
+    // Threads share one cache while the caches keep getting flushed.
+    objects[0] = base;
+    objects[1] = derived;
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &threadfn, NULL);
+    }
+    for (int i = 0; i < 1000; i++) {
+        _objc_flush_caches([Base class]);
+    }
+    OSAtomicIncrement32Barrier(&stop);
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    [base release];
+    [derived release];
+
+    succeed(__FILE__);
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_PROFILE_LOCKS=1 OBJC_PROFILE_SIDE_TABLES=YES OBJC_DISABLE_NONPOINTER_ISA=YES
+TEST_RUN_OUTPUT
+OK: lockprofile.m
+objc\[\d+\]: LOCKS: \d+ locks sampled, one in 1 acquisitions
+END
+*/
+
+// OBJC_PROFILE_LOCKS profiles the side table, @synchronized,
+// and atomic property locks, and logs the profile at exit.
+// OBJC_PROFILE_SIDE_TABLES sends side table locks through
+// SideTable::lockCounted(), which profiles them for its caller.
+// Run with VERBOSE=2 to see the hottest locks.
+
+#include "test.h"
+#include <dlfcn.h>
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define THREADS 4
+#define ITERATIONS 20000
+
+@interface Prop : NSObject {
+    id _value;
+}
+@property (atomic, retain) id value;
+@end
+@implementation Prop
+@synthesize value = _value;
+@end
+
+static Prop *shared;
+
+static void *threadfn(void *arg __unused)
+{
+    for (int i = 0; i < ITERATIONS; i++) {
+        [shared retain];
+        [shared release];
+        @synchronized(shared) {
+            [shared.value self];
+        }
+    }
+    return NULL;
+}
+
+static const objc_lock_profile_t *
+find(const objc_lock_profile_t *profile, unsigned int count, const char *name)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        if (profile[i].name  &&  0 == strcmp(profile[i].name, name)) {
+            return &profile[i];
+        }
+    }
+    return NULL;
+}
+
+int main()
+{
+    shared = [Prop new];
+    shared.value = [[NSObject new] autorelease];
+
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &threadfn, NULL);
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // Samples are recorded as they are taken.
+    unsigned int count;
+    objc_lock_profile_t *profile = objc_copyLockProfile(&count);
+    testassert(profile);
+    testassert(count > 0);
+
+    static const char * const names[] = {
+        "SideTable", "SyncTable", "PropertyLocks"
+    };
+    for (unsigned int n = 0; n < sizeof(names)/sizeof(names[0]); n++) {
+        const objc_lock_profile_t *p = find(profile, count, names[n]);
+        testassert(p);
+        testassert(p->acquisitions > 0);
+        testassert(p->contended <= p->acquisitions);
+        testassert(p->callers[0] != NULL);
+        testprintf("%s+%#zx: %llu acquisitions, %llu contended, "
+                   "%llu failed trylocks, %.3f ms waiting\n", 
+                   p->name, p->offset, p->acquisitions, p->contended,
+                   p->failedTrylocks, p->waitNanoseconds / 1000000.0);
+    }
+
+    // Every retain and release took a side table lock.
+    // Side tables try the lock first, so a contended acquisition 
+    // follows a failed trylock. The wait is blamed on the side table's 
+    // caller, not on its out-of-line slow path.
+    uint64_t sideTableAcquisitions = 0;
+    uint64_t sideTableContended = 0;
+    uint64_t sideTableFailedTrylocks = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        if (profile[i].name  &&  0 == strcmp(profile[i].name, "SideTable")) {
+            sideTableAcquisitions += profile[i].acquisitions;
+            sideTableContended += profile[i].contended;
+            sideTableFailedTrylocks += profile[i].failedTrylocks;
+            for (int c = 0; c < OBJC_LOCK_PROFILE_CALLERS; c++) {
+                Dl_info info;
+                if (!profile[i].callers[c]) break;
+                if (dladdr(profile[i].callers[c], &info)  &&  info.dli_sname) {
+                    testassert(!strstr(info.dli_sname, "lockCounted"));
+                }
+            }
+        }
+    }
+    testassert(sideTableAcquisitions >= 2 * THREADS * ITERATIONS);
+    if (sideTableContended) testassert(sideTableFailedTrylocks > 0);
+
+    // Most wait time first.
+    for (unsigned int i = 1; i < count; i++) {
+        testassert(profile[i-1].waitNanoseconds >= profile[i].waitNanoseconds);
+    }
+
+    free(profile);
+    succeed(__FILE__);
+}
@@ -0,0 +1,101 @@
+// TEST_CONFIG MEM=mrc
+
+// class_respondsToSelector() remembers selectors that a class does not
+// implement, without filling the method cache, and forgets them when
+// methods are added to the class or its superclasses.
+
+#include "test.h"
+
+#if !__OBJC2__
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#else
+
+#include "cachetest.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+
+#define SELECTORS 8
+
+static SEL selectors[SELECTORS];
+static int resolves;
+
+@interface Super : TestRoot @end
+@implementation Super
++(BOOL)resolveInstanceMethod:(SEL)sel {
+    for (unsigned s = 0; s < SELECTORS; s++) {
+        if (sel == selectors[s]) resolves++;
+    }
+    return NO;
+}
+@end
+
+@interface Sub : Super @end
+@implementation Sub @end
+
+static uint32_t cacheOccupied(Class cls)
+{
+    unsigned int count;
+    uint32_t result = 0;
+    objc_class_cache_stats_t *list = objc_copyCacheStatistics(&count, NULL);
+    for (unsigned int i = 0; i < count; i++) {
+        if (list[i].cls == cls) result = list[i].occupied;
+    }
+    free(list);
+    return result;
+}
+
+int main()
+{
+    cachetest_makeSelectors(selectors, SELECTORS, "absent");
+
+    Class sub = [Sub class];  // +initialize
+    [[Sub new] release];
+    uint32_t occupied = cacheOccupied(sub);
+
+    // The resolver runs once per selector.
+    // The misses don't take method cache space.
+    for (unsigned s = 0; s < SELECTORS; s++) {
+        testassert(!class_respondsToSelector(sub, selectors[s]));
+    }
+    testassert(resolves == SELECTORS);
+    for (unsigned s = 0; s < SELECTORS; s++) {
+        testassert(!class_respondsToSelector(sub, selectors[s]));
+    }
+    testassert(resolves == SELECTORS);
+    testassert(cacheOccupied(sub) == occupied);
+
+    // Adding a method to the superclass invalidates the subclass's misses.
+    class_addMethod([Super class], selectors[0], (IMP)cachetest_imp, "L@:");
+    testassert(class_respondsToSelector(sub, selectors[0]));
+    Sub *obj = [Sub new];
+    testassert(cachetest_send(obj, selectors[0]) == (uintptr_t)selectors[0]);
+    [obj release];
+
+    // The other misses were flushed too.
+    resolves = 0;
+    for (unsigned s = 1; s < SELECTORS; s++) {
+        testassert(!class_respondsToSelector(sub, selectors[s]));
+    }
+    testassert(resolves == SELECTORS - 1);
+
+    // Adding a method to the class itself.
+    class_addMethod(sub, selectors[1], (IMP)cachetest_imp, "L@:");
+    testassert(class_respondsToSelector(sub, selectors[1]));
+
+    // Flushing all caches.
+    resolves = 0;
+    testassert(!class_respondsToSelector(sub, selectors[2]));
+    testassert(resolves == 1);
+    _objc_flush_caches(nil);
+    testassert(!class_respondsToSelector(sub, selectors[2]));
+    testassert(resolves == 2);
+
+    succeed(__FILE__);
+}
+
+#endif
@@ -0,0 +1,112 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_PROFILE_SIDE_TABLES=YES
+
+// Many threads retain and release one object until its inline retain
+// count overflows into the side table many times over. Overflowing
+// retains should not need the side table lock, and the count must be
+// exact when the threads stop.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define THREADS 8
+#define RETAINS 20000
+
+static int deallocs;
+
+@interface Shared : NSObject @end
+@implementation Shared
+-(void)dealloc {
+    deallocs++;
+    [super dealloc];
+}
+@end
+
+static id shared;
+static semaphore_t go;
+static semaphore_t done;
+
+static void *retainer(void *arg __unused)
+{
+    semaphore_wait(go);
+    for (int i = 0; i < RETAINS; i++) [shared retain];
+    semaphore_signal(done);
+
+    semaphore_wait(go);
+    for (int i = 0; i < RETAINS; i++) [shared release];
+    semaphore_signal(done);
+
+    semaphore_wait(go);
+    id weakVar = nil;
+    objc_storeWeak(&weakVar, shared);
+    for (int i = 0; i < RETAINS; i++) {
+        [shared retain];
+        if (i % 64 == 0) [objc_loadWeakRetained(&weakVar) release];
+        [shared release];
+    }
+    objc_storeWeak(&weakVar, nil);
+    semaphore_signal(done);
+
+    return NULL;
+}
+
+static uint64_t sideTableLocks(void)
+{
+    unsigned int count;
+    objc_side_table_stats_t *stats = objc_copySideTableStatistics(&count);
+    uint64_t result = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        result += stats[i].acquisitions;
+    }
+    free(stats);
+    return result;
+}
+
+static uint64_t runPhase(void)
+{
+    uint64_t locksBefore = sideTableLocks();
+    for (int t = 0; t < THREADS; t++) semaphore_signal(go);
+    for (int t = 0; t < THREADS; t++) semaphore_wait(done);
+    return sideTableLocks() - locksBefore;
+}
+
+int main()
+{
+    shared = [Shared new];
+
+    // Overflow once so the side table has room for the object.
+    for (int i = 0; i < 1000; i++) [shared retain];
+    for (int i = 0; i < 1000; i++) [shared release];
+    testassert([shared retainCount] == 1);
+
+    semaphore_create(mach_task_self(), &go, 0, 0);
+    semaphore_create(mach_task_self(), &done, 0, 0);
+    for (int t = 0; t < THREADS; t++) {
+        pthread_t th;
+        pthread_create(&th, NULL, &retainer, NULL);
+    }
+
+    uint64_t locks = runPhase();
+    testassert([shared retainCount] == 1 + (uintptr_t)THREADS * RETAINS);
+    testprintf("retain: %llu side table locks\n", locks);
+#if SUPPORT_NONPOINTER_ISA
+    // Overflowing retains don't lock. Allow a few for resizing.
+    testassert(locks < THREADS * 4);
+#endif
+
+    runPhase();
+    testassert([shared retainCount] == 1);
+    testassert(deallocs == 0);
+
+    // Mixed, with weak loads.
+    runPhase();
+    testassert([shared retainCount] == 1);
+    testassert(deallocs == 0);
+
+    [shared release];
+    testassert(deallocs == 1);
+
+    succeed(__FILE__);
+}
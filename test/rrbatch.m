@@ -0,0 +1,81 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES
+
+// objc_retainBatch() and objc_releaseBatch() retain and release
+// side-table-refcounted objects, objects with custom RR, nil, and
+// duplicates the same way as a loop of objc_retain() and objc_release().
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/objc-internal.h>
+
+#define OBJECTS 1000
+
+static int deallocs;
+static int customRetains;
+static int customReleases;
+
+@interface Counted : NSObject @end
+@implementation Counted
+-(void)dealloc {
+    deallocs++;
+    [super dealloc];
+}
+@end
+
+@interface CustomRR : NSObject @end
+@implementation CustomRR
+-(id)retain {
+    customRetains++;
+    return [super retain];
+}
+-(oneway void)release {
+    customReleases++;
+    [super release];
+}
+@end
+
+static id objects[OBJECTS];
+
+int main()
+{
+    // Mixed batch with nil, custom RR, and duplicates.
+    id plain = [Counted new];
+    id custom = [CustomRR new];
+    id batch[] = { plain, nil, custom, plain, nil, custom, plain };
+    const size_t count = sizeof(batch)/sizeof(batch[0]);
+
+    objc_retainBatch(batch, count);
+    testassert([plain retainCount] == 4);
+    testassert(customRetains == 2);
+
+    objc_releaseBatch(batch, count);
+    testassert([plain retainCount] == 1);
+    testassert(customReleases == 2);
+    testassert(deallocs == 0);
+
+    // Empty batches.
+    objc_retainBatch(NULL, 0);
+    objc_releaseBatch(NULL, 0);
+
+    // Releasing the last reference deallocates.
+    for (int i = 0; i < OBJECTS; i++) objects[i] = [Counted new];
+    objc_retainBatch(objects, OBJECTS);
+    for (int i = 0; i < OBJECTS; i++) {
+        testassert([objects[i] retainCount] == 2);
+    }
+    objc_releaseBatch(objects, OBJECTS);
+    testassert(deallocs == 0);
+    for (int i = 0; i < OBJECTS; i++) {
+        testassert([objects[i] retainCount] == 1);
+    }
+
+    objc_releaseBatch(objects, OBJECTS);
+    testassert(deallocs == OBJECTS);
+
+    [plain release];
+    [custom release];
+    testassert(deallocs == OBJECTS + 1);
+
+    succeed(__FILE__);
+}
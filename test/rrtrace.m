@@ -0,0 +1,123 @@
+// TEST_CONFIG MEM=mrc
+
+// Retain count tracing records retains, releases, and autoreleases of
+// instances of traced classes and their subclasses, per thread, and
+// nothing for other classes. Each thread's buffer keeps only its most
+// recent records. objc_dumpRetainCountTrace() writes a file that
+// rrdecode can read.
+
+#include "test.h"
+#include <fcntl.h>
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define BUFFER 4096
+
+@interface Traced : NSObject @end
+@implementation Traced @end
+
+@interface TracedSub : Traced @end
+@implementation TracedSub @end
+
+@interface Untraced : NSObject @end
+@implementation Untraced @end
+
+static id traced;
+
+static size_t countRecords(id obj, uint32_t op, uint32_t *thread)
+{
+    size_t count;
+    objc_rr_trace_record_t *records = objc_copyRetainCountTrace(&count);
+    size_t result = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i > 0) testassert(records[i-1].time <= records[i].time);
+        if (records[i].object == (uintptr_t)obj  &&  records[i].op == op) {
+            if (thread) *thread = records[i].thread;
+            result++;
+        }
+    }
+    free(records);
+    return result;
+}
+
+static void *otherThread(void *arg __unused)
+{
+    for (int i = 0; i < 10; i++) [traced retain];
+    for (int i = 0; i < 10; i++) [traced release];
+    return NULL;
+}
+
+int main()
+{
+    _class_setTracesRetainCounts([Traced class]);
+
+    // Other classes are not traced.
+    id untraced = [Untraced new];
+    objc_retain(untraced);
+    objc_release(untraced);
+    testassert(countRecords(untraced, OBJC_RR_TRACE_RETAIN, NULL) == 0);
+    [untraced release];
+
+    // Subclasses are traced too.
+    traced = [TracedSub new];
+    [traced retain];
+    objc_retain(traced);
+    [traced release];
+    objc_release(traced);
+    @autoreleasepool {
+        [[traced retain] autorelease];
+    }
+    testassert(countRecords(traced, OBJC_RR_TRACE_RETAIN, NULL) == 3);
+    testassert(countRecords(traced, OBJC_RR_TRACE_RELEASE, NULL) == 3);
+    testassert(countRecords(traced, OBJC_RR_TRACE_AUTORELEASE, NULL) == 1);
+
+    // Another thread's records carry its thread.
+    uint32_t mainThread = 0;
+    uint32_t thread = 0;
+    countRecords(traced, OBJC_RR_TRACE_RETAIN, &mainThread);
+    pthread_t th;
+    pthread_create(&th, NULL, &otherThread, NULL);
+    pthread_join(th, NULL);
+    testassert(countRecords(traced, OBJC_RR_TRACE_RETAIN, NULL) == 13);
+    countRecords(traced, OBJC_RR_TRACE_RETAIN, &thread);
+    testassert(thread != mainThread);
+
+    // The buffer keeps only the most recent records.
+    for (int i = 0; i < BUFFER * 2; i++) {
+        [traced retain];
+        [traced release];
+    }
+    size_t count;
+    objc_rr_trace_record_t *records = objc_copyRetainCountTrace(&count);
+    size_t mine = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].thread == mainThread) mine++;
+    }
+    testassert(mine <= BUFFER);
+    testassert(mine >= BUFFER - 1);
+    testassert(records[count-1].op == OBJC_RR_TRACE_RELEASE);
+    free(records);
+
+    // Dump format.
+    char path[] = "/tmp/rrtrace.XXXXXX";
+    int fd = mkstemp(path);
+    testassert(fd >= 0);
+    testassert(objc_dumpRetainCountTrace(fd));
+    lseek(fd, 0, SEEK_SET);
+    objc_rr_trace_header_t header;
+    testassert(read(fd, &header, sizeof(header)) == sizeof(header));
+    testassert(memcmp(header.magic, OBJC_RR_TRACE_MAGIC, 8) == 0);
+    testassert(header.recordSize == sizeof(objc_rr_trace_record_t));
+    testassert(header.recordCount > 0);
+    testassert(header.imageCount > 0);
+    off_t size = lseek(fd, 0, SEEK_END);
+    testassert(size > (off_t)(sizeof(header) + 
+                              header.recordCount * header.recordSize));
+    close(fd);
+    unlink(path);
+
+    [traced release];
+
+    succeed(__FILE__);
+}
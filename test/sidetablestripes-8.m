@@ -0,0 +1,7 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES OBJC_PROFILE_SIDE_TABLES=YES OBJC_SIDE_TABLE_STRIPES=6
+TEST_BUILD
+    $C{COMPILE} $DIR/sidetablestripes.m -o sidetablestripes-8.out -DSTRIPES=8
+END
+*/
@@ -0,0 +1,105 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES OBJC_PROFILE_SIDE_TABLES=YES
+
+// Retain counts and weak references are striped over many side tables.
+// Runs retain/release/weak traffic from several threads and checks
+// that objc_copySideTableStatistics() sees it spread over the stripes.
+// Run with VERBOSE=2 to see the lock wait times.
+// sidetablestripes-8.m runs the same test with OBJC_SIDE_TABLE_STRIPES=6, 
+// which must be rounded up to 8 stripes.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define THREADS 8
+#define OBJECTS 4096
+#define ITERATIONS 20000
+
+static id objects[OBJECTS];
+static semaphore_t go;
+static semaphore_t done;
+
+static void *threadfn(void *arg)
+{
+    uintptr_t t = (uintptr_t)arg;
+    id weakVar = nil;
+
+    semaphore_wait(go);
+    for (unsigned i = 0; i < ITERATIONS; i++) {
+        id obj = objects[(i * 7 + t * (OBJECTS / THREADS)) % OBJECTS];
+        [obj retain];
+        [obj release];
+        if (i % 4 == 0) {
+            objc_storeWeak(&weakVar, obj);
+            [objc_loadWeakRetained(&weakVar) release];
+        }
+    }
+    objc_storeWeak(&weakVar, nil);
+    semaphore_signal(done);
+
+    return NULL;
+}
+
+int main(int argc __unused, char **argv)
+{
+    for (int i = 0; i < OBJECTS; i++) {
+        objects[i] = [NSObject new];
+    }
+
+    semaphore_create(mach_task_self(), &go, 0, 0);
+    semaphore_create(mach_task_self(), &done, 0, 0);
+    for (uintptr_t t = 0; t < THREADS; t++) {
+        pthread_t th;
+        pthread_create(&th, NULL, &threadfn, (void *)t);
+    }
+
+    unsigned int count;
+    objc_side_table_stats_t *before = objc_copySideTableStatistics(&count);
+    testassert(before);
+    testassert(count > 0  &&  (count & (count - 1)) == 0);
+#ifdef STRIPES
+    testassert(count == STRIPES);
+#endif
+
+    for (int t = 0; t < THREADS; t++) semaphore_signal(go);
+    for (int t = 0; t < THREADS; t++) semaphore_wait(done);
+
+    unsigned int count2;
+    objc_side_table_stats_t *after = objc_copySideTableStatistics(&count2);
+    testassert(count2 == count);
+
+    uint64_t acquisitions = 0, contended = 0, wait = 0;
+    uint64_t maxAcq = 0;
+    unsigned int used = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        uint64_t acq = after[i].acquisitions - before[i].acquisitions;
+        acquisitions += acq;
+        contended += after[i].contended - before[i].contended;
+        wait += after[i].waitNanoseconds - before[i].waitNanoseconds;
+        if (acq > 0) used++;
+        if (acq > maxAcq) maxAcq = acq;
+    }
+
+    // Every retain and release took a side table lock.
+    testassert(acquisitions >= (uint64_t)THREADS * ITERATIONS * 2);
+    // The hash spreads the objects over the stripes. The objects' 
+    // addresses vary from run to run, so only a hash that piles them 
+    // onto a few stripes should fail this.
+    testassert(used > count / 2);
+    testassert(maxAcq < acquisitions / 4);
+
+    testprintf("%u stripes: %u used, %llu of %llu locks contended, "
+               "%.3f ms waiting, at most %llu locks per stripe\n",
+               count, used, contended, acquisitions,
+               wait / 1000000.0, maxAcq);
+
+    free(before);
+    free(after);
+    for (int i = 0; i < OBJECTS; i++) {
+        [objects[i] release];
+    }
+
+    succeed(basename(argv[0]));
+}
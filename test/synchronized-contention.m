@@ -0,0 +1,116 @@
+// TEST_CONFIG
+
+#include "test.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <objc/runtime.h>
+#include <objc/objc-sync.h>
+#include <Foundation/NSObject.h>
+
+// synchronized contention test
+// Like synchronized-grid, each thread repeatedly locks one of LOCKS
+// locks (recursively, to a thread-specific depth), increments its
+// counter, and unlocks it. Fewer locks means more contention.
+// Runs with low, medium, and high contention, then again with high 
+// contention in a forked child.
+
+#if defined(__arm__)
+#define THREADS 8
+#define COUNT 1024*4
+#else
+#define THREADS 16
+#define COUNT 1024*16
+#endif
+#define MAXLOCKS 256
+
+static id locks[MAXLOCKS];
+static int counts[MAXLOCKS];
+static int lockCount;
+
+static void *threadfn(void *arg)
+{
+    int depth = 1 + (int)(intptr_t)arg % 4;
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+
+    objc_registerThreadWithCollector();
+
+    for (int n = 0; n < COUNT; n++) {
+        int l = (int)(rand_r(&seed) % lockCount);
+        id lock = locks[l];
+
+        for (int d = 0; d < depth; d++) {
+            int err = objc_sync_enter(lock);
+            testassert(err == OBJC_SYNC_SUCCESS);
+        }
+
+        counts[l]++;
+
+        for (int d = 0; d < depth; d++) {
+            int err = objc_sync_exit(lock);
+            testassert(err == OBJC_SYNC_SUCCESS);
+        }
+    }
+
+    return NULL;
+}
+
+static void run(int count)
+{
+    pthread_t threads[THREADS];
+
+    lockCount = count;
+    bzero(counts, sizeof(counts));
+
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &threadfn, (void*)(intptr_t)(t+1));
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // Verify locks: all should be available
+    // Verify counts: total should be THREADS*COUNT
+    int total = 0;
+    for (int l = 0; l < count; l++) {
+        int err = objc_sync_enter(locks[l]);
+        testassert(err == OBJC_SYNC_SUCCESS);
+        err = objc_sync_exit(locks[l]);
+        testassert(err == OBJC_SYNC_SUCCESS);
+        total += counts[l];
+    }
+    testassert(total == THREADS*COUNT);
+}
+
+int main()
+{
+    for (int l = 0; l < MAXLOCKS; l++) {
+        locks[l] = [[NSObject alloc] init];
+    }
+
+    // Recursion is counted per thread.
+    testassert(objc_sync_enter(locks[0]) == OBJC_SYNC_SUCCESS);
+    testassert(objc_sync_enter(locks[0]) == OBJC_SYNC_SUCCESS);
+    testassert(objc_sync_exit(locks[0]) == OBJC_SYNC_SUCCESS);
+    testassert(objc_sync_exit(locks[0]) == OBJC_SYNC_SUCCESS);
+    testassert(objc_sync_exit(locks[0]) == OBJC_SYNC_NOT_OWNING_THREAD_ERROR);
+
+    run(MAXLOCKS);  // low contention
+    run(4);         // medium
+    run(1);         // high
+
+    // The child inherits locks whose waiters parked in the parent.
+    pid_t pid = fork();
+    testassert(pid >= 0);
+    if (pid == 0) {
+        run(1);
+        _exit(0);
+    }
+    int status;
+    testassert(waitpid(pid, &status, 0) == pid);
+    testassert(WIFEXITED(status)  &&  WEXITSTATUS(status) == 0);
+
+    succeed(__FILE__);
+}
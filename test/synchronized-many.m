@@ -0,0 +1,106 @@
+// TEST_CONFIG
+
+#include "test.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <objc/runtime.h>
+#include <objc/objc-sync.h>
+#include <Foundation/NSObject.h>
+
+// synchronized stress test
+// Thousands of locks, many held at once by each thread.
+// Each thread repeatedly locks a run of HELD consecutive locks
+// (in index order to prevent deadlock), increments their counters,
+// and unlocks them.
+// Then one thread locks and unlocks many short-lived objects,
+// whose unused locks are reclaimed.
+
+#define THREADS 16
+#define LOCKS 4096
+#define HELD 64
+#define COUNT 256
+#define TEMPS 10000
+
+static id locks[LOCKS];
+static int counts[LOCKS];
+
+static void *threadfn(void *arg)
+{
+    unsigned int seed = (unsigned int)(uintptr_t)arg;
+
+    objc_registerThreadWithCollector();
+
+    for (int n = 0; n < COUNT; n++) {
+        int first = rand_r(&seed) % (LOCKS - HELD);
+        for (int l = first; l < first + HELD; l++) {
+            int err = objc_sync_enter(locks[l]);
+            testassert(err == OBJC_SYNC_SUCCESS);
+        }
+        for (int l = first; l < first + HELD; l++) {
+            counts[l]++;
+        }
+        for (int l = first; l < first + HELD; l++) {
+            int err = objc_sync_exit(locks[l]);
+            testassert(err == OBJC_SYNC_SUCCESS);
+        }
+    }
+
+    return NULL;
+}
+
+static void *exitUnowned(void *arg)
+{
+    int err = objc_sync_exit((__bridge id)arg);
+    testassert(err == OBJC_SYNC_NOT_OWNING_THREAD_ERROR);
+    return NULL;
+}
+
+int main()
+{
+    pthread_t threads[THREADS];
+
+    for (int l = 0; l < LOCKS; l++) {
+        locks[l] = [[NSObject alloc] init];
+    }
+
+    // Exiting a lock this thread doesn't hold fails.
+    testassert(objc_sync_exit(locks[0]) == OBJC_SYNC_NOT_OWNING_THREAD_ERROR);
+    testassert(objc_sync_enter(locks[0]) == OBJC_SYNC_SUCCESS);
+    pthread_t th;
+    pthread_create(&th, NULL, &exitUnowned, (__bridge void *)locks[0]);
+    pthread_join(th, NULL);
+    testassert(objc_sync_exit(locks[0]) == OBJC_SYNC_SUCCESS);
+
+    for (int t = 0; t < THREADS; t++) {
+        pthread_create(&threads[t], NULL, &threadfn, (void*)(intptr_t)(t+1));
+    }
+    for (int t = 0; t < THREADS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // Verify locks: all should be available
+    // Verify counts: total should be THREADS*COUNT*HELD
+    uint64_t total = 0;
+    for (int l = 0; l < LOCKS; l++) {
+        int err = objc_sync_enter(locks[l]);
+        testassert(err == OBJC_SYNC_SUCCESS);
+        total += counts[l];
+    }
+    testassert(total == (uint64_t)THREADS*COUNT*HELD);
+    for (int l = 0; l < LOCKS; l++) {
+        int err = objc_sync_exit(locks[l]);
+        testassert(err == OBJC_SYNC_SUCCESS);
+    }
+
+    // Short-lived objects. Their unused locks are reclaimed,
+    // so the tables don't keep growing.
+    for (int i = 0; i < TEMPS; i++) {
+        id temp = [[NSObject alloc] init];
+        testassert(objc_sync_enter(temp) == OBJC_SYNC_SUCCESS);
+        testassert(objc_sync_exit(temp) == OBJC_SYNC_SUCCESS);
+        RELEASE_VAR(temp);
+    }
+
+    succeed(__FILE__);
+}
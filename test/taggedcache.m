@@ -0,0 +1,99 @@
+// TEST_CONFIG MEM=mrc
+
+// Messages to tagged pointers search a method cache reached directly
+// from the tag. Verifies that the cache follows its class through
+// growth, flushes, and method replacement, and that sends to mixed
+// tagged and heap receivers reach the right methods.
+
+#include "cachetest.h"
+#include "testroot.i"
+#include <objc/objc-internal.h>
+
+#if OBJC_HAVE_TAGGED_POINTERS
+
+#define SELECTORS 256
+#define RECEIVERS 64
+#define SENDS (RECEIVERS * 1000)
+
+static SEL selectors[SELECTORS];
+
+@interface TaggedCache : TestRoot @end
+@implementation TaggedCache
+-(uintptr_t)value {
+    return _objc_getTaggedPointerValue((void *)self);
+}
+@end
+
+@interface HeapCache : TestRoot @end
+@implementation HeapCache
+-(uintptr_t)value {
+    return 0;
+}
+@end
+
+static uintptr_t replacement_fn(id self __unused, SEL _cmd __unused)
+{
+    return 12345;
+}
+
+int main()
+{
+    Class cls = [TaggedCache class];
+    _objc_registerTaggedPointerClass(OBJC_TAG_7, cls);
+    id tagged = (id)_objc_makeTaggedPointer(OBJC_TAG_7, 42);
+    testassert(object_getClass(tagged) == cls);
+    testassert([tagged value] == 42);
+
+    // Growing the cache.
+    cachetest_makeSelectors(selectors, SELECTORS, "tagged");
+    for (unsigned s = 0; s < SELECTORS; s++) {
+        class_addMethod(cls, selectors[s], (IMP)cachetest_imp, "L@:");
+    }
+    for (int round = 0; round < 2; round++) {
+        for (unsigned s = 0; s < SELECTORS; s++) {
+            testassert(cachetest_send(tagged, selectors[s]) == (uintptr_t)selectors[s]);
+        }
+    }
+
+    // Flushing the cache.
+    _objc_flush_caches(cls);
+    testassert([tagged value] == 42);
+    _objc_flush_caches(nil);
+    testassert([tagged value] == 42);
+
+    // Replacing a cached method.
+    Method m = class_getInstanceMethod(cls, @selector(value));
+    IMP original = method_setImplementation(m, (IMP)replacement_fn);
+    testassert([tagged value] == 12345);
+    method_setImplementation(m, original);
+    testassert([tagged value] == 42);
+
+    // Mixed receivers.
+    id receivers[RECEIVERS];
+    for (int i = 0; i < RECEIVERS; i++) {
+        receivers[i] = (i & 1)
+            ? (id)_objc_makeTaggedPointer(OBJC_TAG_7, i)
+            : [HeapCache new];
+    }
+
+    uintptr_t sum = 0;
+    for (int i = 0; i < SENDS; i++) {
+        sum += [receivers[i % RECEIVERS] value];
+    }
+    testassert(sum == (uintptr_t)(SENDS / RECEIVERS) * (RECEIVERS / 2) * (RECEIVERS / 2));
+
+    for (int i = 0; i < RECEIVERS; i += 2) {
+        [receivers[i] release];
+    }
+
+    succeed(__FILE__);
+}
+
+#else
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#endif
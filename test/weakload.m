@@ -0,0 +1,132 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_PROFILE_SIDE_TABLES=YES
+
+// objc_loadWeakRetained() retains nonpointer isa objects without the
+// side table lock. Many threads load one weak variable; then readers
+// race with the referent's deallocation, and every load must return
+// the object or nil. Objects with custom RR still get their -retain.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define THREADS 8
+#define LOADS 10000
+#define STRESS_ROUNDS 1000
+
+static int deallocs;
+static int customRetains;
+
+@interface Target : NSObject @end
+@implementation Target
+-(void)dealloc {
+    OSAtomicIncrement32Barrier(&deallocs);
+    [super dealloc];
+}
+@end
+
+@interface CustomRR : NSObject @end
+@implementation CustomRR
+-(id)retain {
+    customRetains++;
+    return [super retain];
+}
+@end
+
+static id target;
+static id weakVar;
+static semaphore_t go;
+static semaphore_t done;
+static volatile int32_t stop;
+
+static void *loader(void *arg __unused)
+{
+    semaphore_wait(go);
+    for (int i = 0; i < LOADS; i++) {
+        id loaded = objc_loadWeakRetained(&weakVar);
+        testassert(loaded == target);
+        [loaded release];
+    }
+    semaphore_signal(done);
+
+    semaphore_wait(go);
+    while (!stop) {
+        id loaded = objc_loadWeakRetained(&weakVar);
+        if (loaded) {
+            testassert([loaded retainCount] >= 1);
+            [loaded release];
+        }
+    }
+    semaphore_signal(done);
+
+    return NULL;
+}
+
+static uint64_t sideTableLocks(void)
+{
+    unsigned int count;
+    objc_side_table_stats_t *stats = objc_copySideTableStatistics(&count);
+    uint64_t result = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        result += stats[i].acquisitions;
+    }
+    free(stats);
+    return result;
+}
+
+int main()
+{
+    // Custom RR goes through -retain.
+    id custom = [CustomRR new];
+    id customWeak = nil;
+    objc_storeWeak(&customWeak, custom);
+    id loaded = objc_loadWeakRetained(&customWeak);
+    testassert(loaded == custom);
+    testassert(customRetains == 1);
+    [loaded release];
+    objc_storeWeak(&customWeak, nil);
+    [custom release];
+
+    // nil.
+    id nilWeak = nil;
+    testassert(objc_loadWeakRetained(&nilWeak) == nil);
+
+    semaphore_create(mach_task_self(), &go, 0, 0);
+    semaphore_create(mach_task_self(), &done, 0, 0);
+    for (int t = 0; t < THREADS; t++) {
+        pthread_t th;
+        pthread_create(&th, NULL, &loader, NULL);
+    }
+
+    // Concurrent loads of a live object.
+    target = [Target new];
+    objc_storeWeak(&weakVar, target);
+    uint64_t locksBefore = sideTableLocks();
+    for (int t = 0; t < THREADS; t++) semaphore_signal(go);
+    for (int t = 0; t < THREADS; t++) semaphore_wait(done);
+    uint64_t locks = sideTableLocks() - locksBefore;
+    testprintf("%d threads: %llu side table locks\n", THREADS, locks);
+    testassert([target retainCount] == 1);
+#if SUPPORT_NONPOINTER_ISA
+    testassert(locks < THREADS * 4);
+#endif
+
+    // Loads racing with deallocation.
+    for (int t = 0; t < THREADS; t++) semaphore_signal(go);
+    for (int r = 0; r < STRESS_ROUNDS; r++) {
+        // Deallocation clears weakVar while the loaders read it.
+        [target release];
+        target = [Target new];
+        objc_storeWeak(&weakVar, target);
+    }
+    stop = 1;
+    for (int t = 0; t < THREADS; t++) semaphore_wait(done);
+    testassert(deallocs == STRESS_ROUNDS);
+
+    objc_storeWeak(&weakVar, nil);
+    [target release];
+    testassert(deallocs == STRESS_ROUNDS + 1);
+
+    succeed(__FILE__);
+}
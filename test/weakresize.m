@@ -0,0 +1,59 @@
+// TEST_CONFIG MEM=mrc
+
+// The weak table resizes incrementally. Lookups must find entries in
+// both the old and the new table while a resize is in progress, and a
+// resize that starts before the previous one has finished must keep
+// the previous one's entries.
+// Grows the tables, shrinks them, and immediately grows them again,
+// then checks that every weak variable is still found and is cleared
+// when its object is deallocated.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+
+// Enough that every side table stripe's weak table grows past the
+// size where it may shrink.
+#define COUNT 200000
+
+@interface Target : NSObject @end
+@implementation Target @end
+
+static id *objs;
+static id *vars;
+
+int main()
+{
+    objs = (id *)calloc(COUNT, sizeof(id));
+    vars = (id *)calloc(COUNT, sizeof(id));
+    for (size_t i = 0; i < COUNT; i++) objs[i] = [Target new];
+
+    // Grow.
+    for (size_t i = 0; i < COUNT; i++) objc_initWeak(&vars[i], objs[i]);
+    for (size_t i = 0; i < COUNT; i++) testassert(vars[i] == objs[i]);
+
+    // Shrink: keep one entry in 32.
+    for (size_t i = 0; i < COUNT; i++) {
+        if (i % 32) objc_destroyWeak(&vars[i]);
+    }
+    for (size_t i = 0; i < COUNT; i += 32) testassert(vars[i] == objs[i]);
+
+    // Grow again right away, while the shrunken tables are still
+    // moving their entries over.
+    for (size_t i = 0; i < COUNT; i++) {
+        if (i % 32) objc_initWeak(&vars[i], objs[i]);
+    }
+    for (size_t i = 0; i < COUNT; i++) testassert(vars[i] == objs[i]);
+
+    // Every weak variable is cleared.
+    for (size_t i = 0; i < COUNT; i++) [objs[i] release];
+    for (size_t i = 0; i < COUNT; i++) {
+        testassert(vars[i] == nil);
+        objc_destroyWeak(&vars[i]);
+    }
+
+    free(objs);
+    free(vars);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,75 @@
+// TEST_CONFIG MEM=mrc
+
+// Weak references stay correct when many objects are weakly referenced
+// and when one object has many weak references, through table growth,
+// shrinking, and removal of referrers in any order.
+
+#include "test.h"
+#include <objc/NSObject.h>
+#include <objc/runtime.h>
+
+// Enough that the weak table and an entry's referrer list grow.
+#define MAX_REFS 10000
+
+@interface Target : NSObject @end
+@implementation Target @end
+
+static id *objs;
+static id *vars;
+
+// count objects with one weak reference each.
+static void manyReferents(size_t count)
+{
+    for (size_t i = 0; i < count; i++) objs[i] = [Target new];
+    for (size_t i = 0; i < count; i++) objc_initWeak(&vars[i], objs[i]);
+
+    for (size_t i = 0; i < count; i++) {
+        id o = objc_loadWeakRetained(&vars[i]);
+        testassert(o == objs[i]);
+        [o release];
+    }
+
+    for (size_t i = 0; i < count; i++) [objs[i] release];
+    for (size_t i = 0; i < count; i++) {
+        testassert(vars[i] == nil);
+        objc_destroyWeak(&vars[i]);
+    }
+}
+
+// One object with count weak references.
+static void manyReferrers(size_t count)
+{
+    id obj = [Target new];
+    for (size_t i = 0; i < count; i++) objc_initWeak(&vars[i], obj);
+
+    // Remove every other referrer, out of order, then add them back.
+    for (size_t i = 0; i < count; i += 2) objc_destroyWeak(&vars[i]);
+    for (size_t i = 0; i < count; i += 2) testassert(vars[i] == nil);
+    for (size_t i = 1; i < count; i += 2) testassert(vars[i] == obj);
+    for (size_t i = 0; i < count; i += 2) objc_initWeak(&vars[i], obj);
+
+    [obj release];
+    for (size_t i = 0; i < count; i++) {
+        testassert(vars[i] == nil);
+        objc_destroyWeak(&vars[i]);
+    }
+}
+
+int main()
+{
+    objs = (id *)calloc(MAX_REFS, sizeof(id));
+    vars = (id *)calloc(MAX_REFS, sizeof(id));
+
+    // Entries with up to a few referrers store them inline.
+    for (size_t count = 1; count <= 10; count++) manyReferrers(count);
+
+    for (size_t count = 100; count <= MAX_REFS; count *= 10) {
+        manyReferents(count);
+        manyReferrers(count);
+    }
+
+    free(objs);
+    free(vars);
+
+    succeed(__FILE__);
+}